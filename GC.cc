@@ -2,346 +2,1249 @@
 
 #include "Interpreter.h"
 
-void GarbageCollector::ProcessManagedFields(std::stack<std::uint8_t*>& workingSet, ValueType* begin, std::size_t cnt)
-{
-    //   foreach (refp in object) {
-    for (std::size_t i = 0; i < cnt; i++) {
-        auto field = begin + i;
-        if (!field->type->IsReferenceType()) continue;
-        //       old = *refp;
-        auto inst = (BytePtr)field->data.obj;
-        auto cb = GetCtrlBlk(inst);
-        //Do we really needs marking?
-        //if (cb->isVisited) continue;
-        //cb->isVisited = true;
-
-        //       if (!ptr_in_nursery (old))
-        //           continue;
-        if(!cb->isInNursery)
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+//Size aligned memory straight from the OS, so freed pages really go back
+static void* MapPages(std::size_t bytes)
+{
+#ifdef _WIN32
+    //Allocation granularity is 64KB, same as the page size
+    static_assert(HeapPage::Size == 64 << 10, "VirtualAlloc alignment");
+    return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    //Over map, then trim to the alignment
+    auto raw = mmap(nullptr, bytes + HeapPage::Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return nullptr;
+    auto base = (std::uintptr_t)raw;
+    auto aligned = (base + HeapPage::Size - 1) & ~(std::uintptr_t)(HeapPage::Size - 1);
+    if (aligned > base) munmap(raw, aligned - base);
+    munmap((void*)(aligned + bytes), base + HeapPage::Size - aligned);
+    return (void*)aligned;
+#endif
+}
+
+static void UnmapPages(void* ptr, std::size_t bytes)
+{
+#ifdef _WIN32
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, bytes);
+#endif
+}
+
+MajorHeap::MajorHeap()
+{
+    std::uint32_t size = 0, pow2 = 256;
+    while (size < MaxCellSize)
+    {
+        if (size >= pow2 * 2) pow2 *= 2;
+        size += size < 256 ? 16 : pow2 / 4;
+        classSizes[classCnt++] = size;
+    }
+    assert(classCnt <= ClassCnt);
+    std::size_t cls = 0;
+    for (std::size_t g = 0; g <= MaxCellSize / ObjAlignment; g++)
+    {
+        while (classSizes[cls] < g * ObjAlignment) cls++;
+        classOfGranules[g] = (std::uint8_t)cls;
+    }
+}
+
+MajorHeap::~MajorHeap()
+{
+    for (auto cb : dying) cb->Destroy();
+    for (auto cb : finalizable) cb->Destroy();
+    for (auto page : pages) UnmapPages(page, page->bytes);
+    for (auto page : emptyPages) UnmapPages(page, page->bytes);
+    for (auto page : pagePool) UnmapPages(page, page->bytes);
+}
+
+HeapPage* MajorHeap::NewPage(std::size_t sizeClass)
+{
+    HeapPage* page;
+    //Empty pages not released yet are as good as pooled ones
+    if (pagePool.empty() && !emptyPages.empty() && emptyPages.back()->cellSize != 0)
+    {
+        ReleasePage(emptyPages.back());
+        emptyPages.pop_back();
+    }
+    if (!pagePool.empty())
+    {
+        page = pagePool.back();
+        pagePool.pop_back();
+    }
+    else
+    {
+        page = (HeapPage*)MapPages(HeapPage::Size);
+        if (page == nullptr) throw std::bad_alloc();
+        mappedBytes += HeapPage::Size;
+    }
+    //Fresh mappings are zero, pooled pages were cleared on release
+    page->bytes = HeapPage::Size;
+    page->cellSize = classSizes[sizeClass];
+    page->sizeClass = (std::uint32_t)sizeClass;
+    page->cellCnt = (std::uint32_t)((HeapPage::Size - AlignObjSize(sizeof(HeapPage))) / page->cellSize);
+    page->freeIdx = 0;
+    page->bumpIdx = 0;
+    page->liveCnt = 0;
+    page->isRemembered = false;
+    page->cards = page->smallCards;
+    pages.push_back(page);
+    return page;
+}
+
+HeapPage* MajorHeap::NewLargePage(std::size_t cellSize)
+{
+    auto end = AlignObjSize(sizeof(HeapPage)) + cellSize;
+    auto bytes = (end + HeapPage::Size - 1) & ~(HeapPage::Size - 1);
+    if (bytes - (bytes >> CardShift) < end) bytes += HeapPage::Size;
+
+    auto page = (HeapPage*)MapPages(bytes);
+    if (page == nullptr) throw std::bad_alloc();
+    mappedBytes += bytes;
+    page->bytes = bytes;
+    page->cellSize = 0;
+    page->cellCnt = 1;
+    page->freeIdx = 1;
+    page->bumpIdx = 1;
+    page->liveCnt = 1;
+    page->isRemembered = false;
+    page->cards = (BytePtr)page + bytes - (bytes >> CardShift);
+    pages.push_back(page);
+    return page;
+}
+
+void MajorHeap::ReleasePage(HeapPage* page)
+{
+    if (page->cellSize == 0 || pagePool.size() >= PoolPages)
+    {
+        mappedBytes -= page->bytes;
+        UnmapPages(page, page->bytes);
+        return;
+    }
+    //Keep it ready for reuse, cells are overwritten on allocation
+    HeapPage::ClearBits(page->allocBits);
+    HeapPage::ClearBits(page->markBits);
+    memset(page->smallCards, 0, sizeof(page->smallCards));
+    pagePool.push_back(page);
+}
+
+void* MajorHeap::AllocateOnHeap(std::size_t size)
+{
+    size = AlignObjSize(size);
+    BytePtr cell = nullptr;
+    HeapPage* page = nullptr;
+    if (size > MaxCellSize)
+    {
+        page = NewLargePage(size);
+        cell = page->Cells();
+    }
+    else
+    {
+        auto sizeClass = classOfGranules[size / ObjAlignment];
+        auto& avail = availPages[sizeClass];
+        while (cell == nullptr)
         {
-            if (cb->isRaw)
-                workingSet.push((BytePtr)inst);
-            continue;
+            //Dead cells of the class first, then a new page
+            if (avail.empty() && !SweepNext(sizeClass)) avail.push_back(NewPage(sizeClass));
+            if (avail.empty()) continue;
+            page = avail.back();
+            if (page->HasFreeCell()) cell = page->TakeFreeCell();
+            else avail.pop_back();
         }
-        
+        page->liveCnt++;
+    }
+    if (allocateMarked) MajorHeap::Mark((ManagedObjectCtrlBlock*)cell);
+    HeapPage::SetBit(page->allocBits, page->Granule(cell));
+    objectCnt++;
+    return cell;
+}
 
-        //       if (object_is_forwarded (old)) {
-        //           new = forwarding_destination (old);
-        BytePtr newPos;
-        if (cb->isForward)
+void MajorHeap::SweepPage(HeapPage* page)
+{
+    //Host resources may hang off the dead, release them before their
+    //cells are handed out again
+    for (auto cb : dying) cb->Destroy();
+    dying.clear();
+    for (std::size_t w = 0; w < HeapPage::Granules / 64; w++)
+    {
+        auto mark = page->markBits[w].load(std::memory_order_relaxed);
+        auto dead = mark & ~page->allocBits[w].load(std::memory_order_relaxed);
+        if (dead == 0) continue;
+        //The marker may be setting bits of live cells in the same word
+        page->markBits[w].fetch_and(~dead, std::memory_order_relaxed);
+    }
+    page->freeIdx = 0;
+}
+
+bool MajorHeap::SweepNext(std::size_t c)
+{
+    auto& queue = unsweptPages[c];
+    if (queue.empty()) return false;
+    auto page = queue.back();
+    queue.pop_back();
+    unsweptCnt--;
+    SweepPage(page);
+    if (page->HasFreeCell()) availPages[c].push_back(page);
+    return true;
+}
+
+void MajorHeap::StartSweep()
+{
+    //Queued pages not swept yet are queued again, with more dead cells
+    for (auto& avail : availPages) avail.clear();
+    for (auto& queue : unsweptPages) queue.clear();
+    unsweptCnt = 0;
+    for (auto page : pages)
+    {
+        std::uint64_t pending = 0;
+        std::uint32_t live = 0;
+        for (std::size_t w = 0; w < HeapPage::Granules / 64; w++)
         {
-            newPos = (BytePtr)cb->vptr;
+            auto alloc = page->allocBits[w].load(std::memory_order_relaxed);
+            auto mark = page->markBits[w].load(std::memory_order_relaxed);
+            if ((alloc | mark) == 0) continue;
+            live += PopCount(alloc & mark);
+            objectCnt -= PopCount(alloc & ~mark);
+            page->allocBits[w].store(alloc & mark, std::memory_order_relaxed);
+            page->markBits[w].store(alloc ^ mark, std::memory_order_relaxed);
+            pending |= alloc ^ mark;
         }
-        //       } else {
-        else {
-            //            new = major_alloc (object_size (old));
-            //            copy_object (new, old);
-            auto gen = cb->generation;
-            ManagedObjectCtrlBlock* newInst;
-            if(gen >= matureGen)
+        page->liveCnt = live;
+        if (pending != 0)
+        {
+            unsweptPages[page->cellSize != 0 ? page->sizeClass : ClassCnt].push_back(page);
+            unsweptCnt++;
+        }
+        else if (page->HasFreeCell()) availPages[page->sizeClass].push_back(page);
+    }
+    //Alloc bits tell the dead, their cells are not read
+    std::size_t kept = 0;
+    for (auto cb : finalizable)
+    {
+        auto page = HeapPage::Of(cb);
+        if (HeapPage::TestBit(page->allocBits, page->Granule(cb))) finalizable[kept++] = cb;
+        else dying.push_back(cb);
+    }
+    finalizable.resize(kept);
+    isReleasePending = true;
+}
+
+bool MajorHeap::SweepPages(std::chrono::steady_clock::time_point deadline)
+{
+    for (std::size_t c = 0; c <= ClassCnt && unsweptCnt != 0; c++)
+    {
+        while (SweepNext(c))
+        {
+            if (std::chrono::steady_clock::now() >= deadline) return unsweptCnt == 0;
+        }
+    }
+    return true;
+}
+
+bool MajorHeap::DetachEmptyPages()
+{
+    assert(unsweptCnt == 0);
+    if (!isReleasePending) return false;
+    for (auto& avail : availPages) avail.clear();
+    std::size_t kept = 0;
+    for (auto page : pages)
+    {
+        if (page->liveCnt == 0)
+        {
+            emptyPages.push_back(page);
+            continue;
+        }
+        pages[kept++] = page;
+        if (page->HasFreeCell()) availPages[page->sizeClass].push_back(page);
+    }
+    pages.resize(kept);
+    isReleasePending = false;
+    return true;
+}
+
+bool MajorHeap::ReleaseEmptyPages(std::chrono::steady_clock::time_point deadline)
+{
+    //Unmapping takes a syscall per page
+    while (!emptyPages.empty())
+    {
+        ReleasePage(emptyPages.back());
+        emptyPages.pop_back();
+        if (std::chrono::steady_clock::now() >= deadline) break;
+    }
+    return emptyPages.empty();
+}
+
+void MajorHeap::ClearCards()
+{
+    for (auto page : pages)
+    {
+        page->isRemembered = false;
+        memset(page->cards, 0, page->CardCnt());
+    }
+}
+
+std::size_t MajorHeap::SmallPageCount() const
+{
+    std::size_t cnt = 0;
+    //Pages left empty are released by the sweep anyway
+    for (auto page : pages)
+    {
+        if (page->cellSize != 0 && page->liveCnt != 0) cnt++;
+    }
+    return cnt;
+}
+
+std::size_t MajorHeap::ReclaimablePages() const
+{
+    std::size_t pageCnt[ClassCnt] = {}, liveCnt[ClassCnt] = {}, cellCnt[ClassCnt] = {};
+    for (auto page : pages)
+    {
+        if (page->cellSize == 0 || page->liveCnt == 0) continue;
+        pageCnt[page->sizeClass]++;
+        liveCnt[page->sizeClass] += page->liveCnt;
+        cellCnt[page->sizeClass] = page->cellCnt;
+    }
+    std::size_t cnt = 0;
+    for (std::size_t c = 0; c < classCnt; c++)
+    {
+        if (pageCnt[c] != 0) cnt += pageCnt[c] - (liveCnt[c] + cellCnt[c] - 1) / cellCnt[c];
+    }
+    return cnt;
+}
+
+std::size_t MajorHeap::PlanCompaction()
+{
+    //Pages of a class in the order they were made
+    std::vector<HeapPage*> classPages[ClassCnt];
+    for (auto page : pages)
+    {
+        if (page->cellSize != 0) classPages[page->sizeClass].push_back(page);
+    }
+    //Next free cell of each class, never past the object being planned
+    std::size_t dstPage[ClassCnt] = {}, dstIdx[ClassCnt] = {}, pageIdx[ClassCnt] = {};
+    std::size_t bytes = 0;
+    movedTypes.clear();
+    //Classes are interleaved in page order, the order Compact takes
+    //the types back in
+    for (auto page : pages)
+    {
+        if (page->cellSize == 0) continue;
+        auto c = page->sizeClass;
+        auto& list = classPages[c];
+        auto k = pageIdx[c]++;
+        for (std::size_t i = 0; i < page->bumpIdx; i++)
+        {
+            auto cb = (ManagedObjectCtrlBlock*)(page->Cells() + i * page->cellSize);
+            if (!HeapPage::TestBit(page->allocBits, page->Granule(cb))) continue;
+            if (!cb->IsRaw())
             {
-                newInst = heap.AllocateRaw(cb->objectSize);
-                allocMajorHeap += cb->objectSize;
+                dstPage[c] = k;
+                dstIdx[c] = i + 1;
+                continue;
             }
-            else
+            if (dstIdx[c] == list[dstPage[c]]->cellCnt)
             {
-                newInst = m2->AllocateRaw(cb->objectSize);
-                newInst->generation = cb->generation + 1;
-                allocManaged += cb->objectSize;
+                dstPage[c]++;
+                dstIdx[c] = 0;
             }
-            //newInst->vptr = cb->vptr;
-            //newInst->isRaw = cb->isRaw;
-            (cb->move)((BytePtr)cb, (BytePtr)newInst, cb->objectSize);
-            //cb->~ManagedObjectCtrlBlock();
-            //            forwarding_set (old, new);
-            //cb->vptr = ((BytePtr)newInst) + MOCtrlBlkSize;
-            //cb->isForward = true;
-            //            gray_stack_push (new);
-            if (cb->isRaw)
-                workingSet.push((BytePtr)newInst);
-            newPos = (BytePtr)newInst + MOCtrlBlkSize;
-            //       }
+            auto dst = list[dstPage[c]]->Cells() + dstIdx[c]++ * page->cellSize;
+            if (dst == (BytePtr)cb) continue;
+            movedTypes.push_back(cb->vptr);
+            cb->vptr = dst + MOCtrlBlkSize;
+            cb->TrySet(ManagedObjectCtrlBlock::Forward);
+            bytes += cb->TotalBytes();
+        }
+    }
+    return bytes;
+}
+
+void MajorHeap::Compact()
+{
+    //Destinations come earlier in the same order, and are free or
+    //moved out of by then
+    std::size_t moved = 0;
+    for (auto page : pages)
+    {
+        if (page->cellSize == 0) continue;
+        for (std::size_t i = 0; i < page->bumpIdx; i++)
+        {
+            auto cb = (ManagedObjectCtrlBlock*)(page->Cells() + i * page->cellSize);
+            if (!HeapPage::TestBit(page->allocBits, page->Granule(cb)) || !cb->IsForward()) continue;
+            auto newInst = ManagedObjectCtrlBlock::EmplaceRaw(GetCtrlBlk(cb->vptr), cb->ObjectSize());
+            auto dstPage = HeapPage::Of(newInst);
+            cb->vptr = movedTypes[moved++];
+            cb->MoveTo(newInst);
+            HeapPage::ClearBit(page->allocBits, page->Granule(cb));
+            HeapPage::SetBit(dstPage->allocBits, dstPage->Granule(newInst));
+        }
+    }
+    assert(moved == movedTypes.size());
+    movedTypes.clear();
+
+    //Holes below the last object are taken first, see TakeFreeCell
+    for (auto& avail : availPages) avail.clear();
+    std::size_t kept = 0;
+    for (auto page : pages)
+    {
+        if (page->cellSize != 0)
+        {
+            std::size_t top = 0;
+            page->liveCnt = 0;
+            for (std::size_t i = 0; i < page->bumpIdx; i++)
+            {
+                if (!HeapPage::TestBit(page->allocBits, page->Granule(page->Cells() + i * page->cellSize))) continue;
+                page->liveCnt++;
+                top = i + 1;
+            }
+            page->freeIdx = 0;
+            page->bumpIdx = (std::uint32_t)top;
+        }
+        if (page->liveCnt == 0)
+        {
+            ReleasePage(page);
+            continue;
+        }
+        pages[kept++] = page;
+        if (page->HasFreeCell()) availPages[page->sizeClass].push_back(page);
+    }
+    pages.resize(kept);
+}
+
+//Calls fn on the slots in [begin, end) of cb holding references. Typed
+//objects only look at the slots set in the refMap of their type, these
+//are declared references: nulls and inline strings are all to skip
+template<typename Fn>
+static void ForEachRefSlot(ManagedObjectCtrlBlock* cb, std::size_t begin, std::size_t end, Fn&& fn)
+{
+    auto slots = (ValueType*)GetPayload(cb);
+    if (cb->Kind() != ManagedObjectCtrlBlock::TypedKind)
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            if (slots[i].IsRef()) fn(slots[i]);
+        }
+        return;
+    }
+    auto& refMap = ((TypeTable*)cb->vptr)->refMap;
+    for (auto w = begin / 64; w * 64 < end; w++)
+    {
+        auto bits = refMap[w];
+        if (w == begin / 64) bits &= ~0ull << (begin % 64);
+        if (end - w * 64 < 64) bits &= (1ull << (end - w * 64)) - 1;
+        while (bits != 0)
+        {
+            auto& slot = slots[w * 64 + MajorHeap::CountTrailingZeros(bits)];
+            bits &= bits - 1;
+            auto obj = (std::uintptr_t)slot.data.obj;
+            if (obj != 0 && !(obj & 1)) fn(slot);
         }
-        //       *refp = new;
-        field->data.obj = newPos;
     }
 }
 
+/* Marking reads the header of every object it reaches, mostly a cache
+ * miss. Edges found by the mark loops wait here until Depth more are
+ * found, the target's header is prefetched meanwhile
+ */
+template<typename Edge>
+class EdgeBuffer
+{
+    static constexpr std::size_t Depth = 16;
+    Edge edges[Depth];
+    std::size_t head = 0, cnt = 0;
+
+public:
+    //Follows the oldest edge once full
+    template<typename Fn>
+    void Push(const Edge& e, Fn&& follow)
+    {
+        if (cnt < Depth)
+        {
+            edges[(head + cnt++) % Depth] = e;
+            return;
+        }
+        auto oldest = edges[head];
+        edges[head] = e;
+        head = (head + 1) % Depth;
+        follow(oldest);
+    }
+    //False once empty
+    template<typename Fn>
+    bool FollowOldest(Fn&& follow)
+    {
+        if (cnt == 0) return false;
+        auto oldest = edges[head];
+        head = (head + 1) % Depth;
+        cnt--;
+        follow(oldest);
+        return true;
+    }
+};
+
 void GarbageCollector::SweepManaged(const std::vector<ValueType*>& marked)
 {
     allocManaged = 0;
+    PrepareWorkers();
+
+    //Process backward refs, that is Heap->Nursery. Only dirty cards are
+    //scanned, they are cleaned and dirtied again by slots still pointing
+    //into the nursery. Their slots are collected before anything is
+    //copied, promoted objects may land on the same pages
+    std::vector<HeapPage*> dirty;
+    dirty.swap(dirtyPages);
+    std::atomic<std::size_t> nextPage{ 0 };
+    pool.Run([&](std::size_t idx) {
+        auto& w = workers[idx];
+        for (auto p = nextPage++; p < dirty.size(); p = nextPage++)
+        {
+            auto page = dirty[p];
+            page->isRemembered = false;
+            for (std::size_t c = 0; c < page->CardCnt(); c++)
+            {
+                if (!page->cards[c]) continue;
+                page->cards[c] = 0;
+                MajorHeap::ForEachSlotInCard(page, c, [&](ManagedObjectCtrlBlock* objCB, ValueType* begin, ValueType* end) {
+                    w.cardRanges.push_back({ objCB, begin, end });
+                });
+            }
+        }
+    });
 
-    std::stack<std::uint8_t*> workingSet;
+    //Roots are split evenly, the rest is balanced by stealing
+    pool.Run([&](std::size_t idx) {
+        auto& w = workers[idx];
+        auto first = marked.size() * idx / workers.size(), last = marked.size() * (idx + 1) / workers.size();
+        for (auto i = first; i < last; i++)
+        {
+            assert(!marked[i]->IsNull());
+            //Static fields are allocated on heap, so
+            //not all objects are of reference type
+            //assert(v->IsRef());
+            ScavengeSlot(w, *marked[i], nullptr);
+        }
+        for (auto& range : w.cardRanges)
+        {
+            //Slots may have been overwritten since
+            auto payload = (ValueType*)GetPayload(range.holder);
+            ForEachRefSlot(range.holder, range.begin - payload, range.end - payload, [&](ValueType& slot) {
+                ScavengeSlot(w, slot, range.holder);
+            });
+        }
+        w.cardRanges.clear();
+        Scavenge(w, idx);
+    });
 
-    auto _ProcessVT = [&](ValueType& v, bool fromHeap)
+    for (auto& w : workers)
     {
-        //       old = *refp;
-        auto inst = (BytePtr)v.data.obj;
-        auto cb = GetCtrlBlk(inst);
-        //Do we really needs marking?
-        //if (cb->isVisited) continue;
-        //cb->isVisited = true;
+        RetireLab(w);
+        for (auto& slot : w.remembered) RememberSlot(slot.first, slot.second);
+        for (auto cb : w.shaded) QueueMarked(cb);
+        allocManaged += w.copiedBytes;
+        w.remembered.clear();
+        w.shaded.clear();
+        w.copiedBytes = 0;
+    }
 
-        //       if (!ptr_in_nursery (old))
-        //           continue;
-        if (!cb->isInNursery)
+    //Finalizing pass, only objects with a dtor are looked at. The
+    //survivors are listed again where they were copied to
+    for (auto objCB : m1->finalizable)
+    {
+        if (!objCB->IsForward())
         {
-            //if (cb->isRaw)
-            //    workingSet.push((BytePtr)inst);
-            return false;
+            objCB->Destroy();
+            continue;
         }
+        auto newInst = GetCtrlBlk(objCB->vptr);
+        (newInst->IsInNursery() ? m2->finalizable : heap.finalizable).push_back(newInst);
+    }
+    m1->finalizable.clear();
+    for (auto blk : m1->blks)
+    {
+        blk->usedBytes = 0;
+        blk->objectCnt = 0;
+    }
 
+    m1->inUseBlkCnt = 0;
 
-        //       if (object_is_forwarded (old)) {
-        //           new = forwarding_destination (old);
-        bool hasBackRef = false;
-        BytePtr newPos;
-        if (cb->isForward)
+
+    SwapActiveMM();
+    CloseFastPath();
+
+    if (isMarking)
+    {
+        isNurseryShaded = true;
+        shadedAllocManaged = allocManaged;
+    }
+}
+
+void GarbageCollector::ScavengeSlot(GCWorker& w, ValueType& v, ManagedObjectCtrlBlock* holder)
+{
+    //       old = *refp;
+    auto cb = GetCtrlBlk(v.data.obj);
+
+    //       if (!ptr_in_nursery (old))
+    //           continue;
+    if (!cb->IsInNursery())
+    {
+        //Heap objects held by live nursery objects, see FinishMarking
+        if (isMarking && !cb->IsFrameLocal() && MajorHeap::Mark(cb)) w.shaded.push_back(cb);
+        return;
+    }
+
+    auto newPos = Evacuate(w, cb);
+    //       *refp = new;
+    if (holder != nullptr && GetCtrlBlk(newPos)->IsInNursery())
+        RememberLater(w, holder, &v);
+    v.data.obj = newPos;
+}
+
+BytePtr GarbageCollector::Evacuate(GCWorker& w, ManagedObjectCtrlBlock* cb)
+{
+    //       if (object_is_forwarded (old)) {
+    //           new = forwarding_destination (old);
+    if (!cb->IsForward())
+    {
+        //A lone worker has nobody to race
+        if (workers.size() == 1 || cb->TrySet(ManagedObjectCtrlBlock::Copying))
         {
-            newPos = (BytePtr)cb->vptr;
-        }
-        //       } else {
-        else {
             //            new = major_alloc (object_size (old));
             //            copy_object (new, old);
-            auto gen = cb->generation;
             ManagedObjectCtrlBlock* newInst;
-            if (gen >= matureGen)
+            if (cb->Generation() >= matureGen)
             {
-                newInst = heap.AllocateRaw(cb->objectSize);
-                allocMajorHeap += cb->objectSize;
+                std::unique_lock<std::mutex> guard(heapLock, std::defer_lock);
+                if (workers.size() > 1) guard.lock();
+                //Its slots are scavenged below, which shades the heap
+                //objects they hold, see ScavengeSlot
+                newInst = AllocateOnHeap(cb->ObjectSize(), true);
             }
             else
             {
-                newInst = m2->AllocateRaw(cb->objectSize);
-                newInst->generation = cb->generation + 1;
-                allocManaged += cb->objectSize;
+                newInst = AllocateInLab(w, cb->ObjectSize());
+                newInst->SetGeneration(cb->Generation() + 1);
+                w.copiedBytes += cb->ObjectSize();
             }
-            //newInst->vptr = cb->vptr;
-            //newInst->isRaw = cb->isRaw;
-            (cb->move)((BytePtr)cb, (BytePtr)newInst, cb->objectSize);
-            //cb->~ManagedObjectCtrlBlock();
-            //            forwarding_set (old, new);
-            //cb->vptr = ((BytePtr)newInst) + MOCtrlBlkSize;
-            //cb->isForward = true;
+            //Sets the forwarding address, then Forward
+            cb->MoveTo(newInst);
             //            gray_stack_push (new);
-            if (cb->isRaw)
-                workingSet.push((BytePtr)newInst);
-            newPos = (BytePtr)newInst + MOCtrlBlkSize;
-            //       }
+            //Copies in m2 are scanned from there, see ScanCopied
+            if (!newInst->IsInNursery() && newInst->MayHoldRefs())
+                w.gray.push_back({ newInst, 0 });
+            return GetPayload(newInst);
         }
-        //       *refp = new;
-        if(fromHeap && GetCtrlBlk(newPos)->isInNursery)
+        //Another worker is copying it
+        while (!cb->IsForward())
+            std::this_thread::yield();
+    }
+    return (BytePtr)cb->vptr;
+}
+
+void GarbageCollector::Scavenge(GCWorker& w, std::size_t idx)
+{
+    //process along the reference graph, promoted and stolen objects
+    //first, then the copies
+    auto& gray = w.gray;
+    for (;;)
+    {
+        if (gray.empty())
         {
-            backwardRefs.insert(&v);
-            hasBackRef = true;
+            if (ScanCopied(w)) continue;
+            if (!grayQueues.Refill(idx, gray)) break;
         }
-        v.data.obj = newPos;
-        return hasBackRef;
-    };
+        //   object = gray_stack_pop ();
+        auto objCB = gray.back().cb;
+        auto begin = gray.back().begin;
+        gray.pop_back();
+        auto fieldCnt = objCB->ObjectSize() / sizeof(ValueType);
+        auto end = std::min(fieldCnt, begin + SlotsPerStep);
+        if (end < fieldCnt) gray.push_back({ objCB, end });
+        auto holder = objCB->IsInNursery() ? nullptr : objCB;
+        ForEachRefSlot(objCB, begin, end, [&](ValueType& slot) { ScavengeSlot(w, slot, holder); });
+        grayQueues.Publish(idx, gray);
+    }
+}
 
-    //ProcessManagedFields(workingSet, marked.data(), marked.size());
-    for(auto v : marked)
+bool GarbageCollector::ScanCopied(GCWorker& w)
+{
+    auto& ranges = w.unscanned;
+    for (;;)
     {
-        assert(!v->IsNull());
-        //Static fields are allocated on heap, so
-        //not all objects are of reference type
-        //assert(v->IsRef());
-        //assert(!GetCtrlBlk(v->data.obj)->isForward);
-        _ProcessVT(*v, false);
+        if (w.firstUnscanned == ranges.size())
+        {
+            ranges.clear();
+            w.firstUnscanned = 0;
+            return false;
+        }
+        auto& range = hierarchicalCopy ? ranges.back() : ranges[w.firstUnscanned];
+        if (range.first != range.second) break;
+        if (hierarchicalCopy) ranges.pop_back();
+        else w.firstUnscanned++;
     }
 
-    //Process backward refs, that is Heap->Nursery
-    auto rit = backwardRefs.begin();
-    while(rit != backwardRefs.end())
+    //Ranges may grow while the object is scanned, take it off first
+    auto& range = hierarchicalCopy ? ranges.back() : ranges[w.firstUnscanned];
+    if (grayQueues.IsStarving() && w.gray.empty())
     {
-        auto vp = *rit;
-        //remove empty back refs, possibly because nursery objects
-        //are moved into heap
-        if(_ProcessVT(*vp, true))
-            rit++;
-        else
-            rit = backwardRefs.erase(rit);
+        //Handed to the gray stack, where they can be stolen
+        while (range.first != range.second && w.gray.size() < WorkStealingQueues<GrayObject>::MinShared * 2)
+        {
+            auto cb = (ManagedObjectCtrlBlock*)range.first;
+            range.first += cb->TotalBytes();
+            if (cb->MayHoldRefs()) w.gray.push_back({ cb, 0 });
+        }
+        return true;
+    }
+    auto cb = (ManagedObjectCtrlBlock*)range.first;
+    range.first += cb->TotalBytes();
+    if (cb->MayHoldRefs())
+    {
+        ForEachRefSlot(cb, 0, cb->ObjectSize() / sizeof(ValueType),
+            [&](ValueType& slot) { ScavengeSlot(w, slot, nullptr); });
     }
+    return true;
+}
 
-    //process along the reference graph
-    while (!workingSet.empty())
+ManagedObjectCtrlBlock* GarbageCollector::AllocateInLab(GCWorker& w, std::size_t size)
+{
+    auto totalSize = size + MOCtrlBlkSize;
+    auto objBytes = totalSize;
+    BytePtr space;
+    //What is left must fit a filler, see RetireLab
+    if (totalSize == w.labLeft || totalSize + MOCtrlBlkSize <= w.labLeft)
     {
-        //   object = gray_stack_pop ();
-        auto base = workingSet.top();
-        workingSet.pop();
-        auto objCB = (ManagedObjectCtrlBlock*)(base);
-        auto payload = (ValueType*)(base + MOCtrlBlkSize);
-        auto fieldCnt = objCB->objectSize / sizeof(ValueType);
-        for (std::size_t i = 0; i < fieldCnt; i++) {
-            auto field = payload + i;
-            if (!field->IsRef()) continue;
-
-            _ProcessVT(*field,!objCB->isInNursery);
+        space = w.lab;
+    }
+    else
+    {
+        std::lock_guard<std::mutex> guard(nurseryLock);
+        //Big objects get space of their own, the buffer is kept
+        if (totalSize > LabBytes / 4)
+        {
+            space = (BytePtr)m2->AllocateFromManaged(totalSize);
+            totalSize = 0;
+        }
+        else
+        {
+            RetireLab(w);
+            space = w.lab = (BytePtr)m2->AllocateFromManaged(LabBytes);
+            w.labLeft = LabBytes;
         }
-        //ProcessManagedFields(workingSet, payload, fieldCnt);        
     }
+    w.lab += totalSize;
+    w.labLeft -= totalSize;
+    //Queued for ScanCopied, back to back copies share a range
+    auto& ranges = w.unscanned;
+    if (ranges.size() > w.firstUnscanned && ranges.back().second == space
+        && (!hierarchicalCopy || (std::size_t)(space - ranges.back().first) < CopyWindowBytes)) ranges.back().second += objBytes;
+    else ranges.push_back({ space, space + objBytes });
+    return ManagedObjectCtrlBlock::EmplaceRaw(space, size, m2->newFlags);
+}
+
+void GarbageCollector::RetireLab(GCWorker& w)
+{
+    if (w.labLeft != 0)
+    {
+        //A blob, never scanned, the payload is garbage
+        ManagedObjectCtrlBlock::EmplaceRaw(w.lab, w.labLeft - MOCtrlBlkSize,
+            ManagedObjectCtrlBlock::InNursery, ManagedObjectCtrlBlock::BlobKind);
+    }
+    w.lab = nullptr;
+    w.labLeft = 0;
+}
 
-    //Finalizing pass
-    for (auto blk : m1->blks)
+void GarbageCollector::PrepareWorkers()
+{
+    workerCnt = std::max<std::size_t>(workerCnt, 1);
+    if (pool.Count() != workerCnt) pool.Resize(workerCnt);
+    workers.resize(workerCnt);
+    grayQueues.Reset(workerCnt);
+}
+
+void GarbageCollector::DrainGrayStack(bool followNursery)
+{
+    PrepareWorkers();
+    //Dealt round robin, so every worker starts with some
+    for (std::size_t i = 0; i < grayStack.size(); i++)
+        workers[i % workers.size()].gray.push_back(grayStack[i]);
+    grayStack.clear();
+    pool.Run([&](std::size_t idx) { DrainGray(workers[idx], idx, followNursery); });
+    for (auto& w : workers)
     {
-        auto base = (BytePtr)blk;
-        base += MBCtrlBlkSize;
-        std::size_t currSize = 0;
-        while (currSize < blk->usedBytes)
+        for (auto& slot : w.remembered) RememberSlot(slot.first, slot.second);
+        markedBytes += w.markedBytes;
+        w.remembered.clear();
+        w.markedBytes = 0;
+    }
+}
+
+void GarbageCollector::DrainGray(GCWorker& w, std::size_t idx, bool followNursery)
+{
+    auto& gray = w.gray;
+    //Slot and its holder, if that is a heap object
+    using Edge = std::pair<ManagedObjectCtrlBlock*, ValueType*>;
+    EdgeBuffer<Edge> edges;
+    auto follow = [&](const Edge& e) {
+        auto fieldCB = GetCtrlBlk(e.second->data.obj);
+        auto isHeapField = !fieldCB->IsInNursery() && !fieldCB->IsFrameLocal();
+        if (!isHeapField && !followNursery) return;
+        //Every heap slot into the nursery is remembered, not only the
+        //first path reaching the target
+        if (fieldCB->IsInNursery() && e.first != nullptr)
+            RememberLater(w, e.first, e.second);
+        if (!MarkObject(fieldCB)) return;
+        if (isHeapField) w.markedBytes += fieldCB->ObjectSize();
+        if (fieldCB->MayHoldRefs()) gray.push_back({ fieldCB, 0 });
+    };
+    for (;;)
+    {
+        if (gray.empty())
         {
-            auto objCB = (ManagedObjectCtrlBlock*)(base + currSize);
-            //auto payload = GetPayload(objCB);
-            currSize += MOCtrlBlkSize + objCB->objectSize;
-    
-            if (!objCB->isForward && !objCB->isRaw)
-            {
-                objCB->dtor((BytePtr)objCB);
-            }
+            if (edges.FollowOldest(follow)) continue;
+            if (!grayQueues.Refill(idx, gray)) break;
         }
+        auto objCB = gray.back().cb;
+        auto begin = gray.back().begin;
+        gray.pop_back();
+        assert(!objCB->IsForward());
+        if (!objCB->MayHoldRefs()) continue;
 
-        blk->usedBytes = 0;
-        blk->objectCnt = 0;
+        auto holder = !objCB->IsInNursery() && !objCB->IsFrameLocal() ? objCB : nullptr;
+        auto fieldCnt = objCB->ObjectSize() / sizeof(ValueType);
+        auto end = std::min(fieldCnt, begin + SlotsPerStep);
+        if (end < fieldCnt) gray.push_back({ objCB, end });
+        ForEachRefSlot(objCB, begin, end, [&](ValueType& field) {
+            PrefetchLine(GetCtrlBlk(field.data.obj));
+            edges.Push({ holder, &field }, follow);
+        });
+        grayQueues.Publish(idx, gray);
     }
+}
 
-    m1->inUseBlkCnt = 0;
+void GarbageCollector::SweepMajorHeap(const std::vector<ValueType*>& marked)
+{
+    //Marks of an incremental cycle are kept, finish it in one go
+    if (isMarking)
+    {
+        FinishMarking(marked);
+        return;
+    }
 
+    //Cards are rebuilt by the marking. Heap marks were cleared by the
+    //last sweep, the rest by the last flip of unmarkedFlag
+    dirtyPages.clear();
+    heap.ClearCards();
+    //Mark objects
+    markedBytes = 0;
+    for(auto v:marked)
+    {
+        //assert(v->IsRef());
+        MarkGray(GetCtrlBlk(v->data.obj));
+    }
+    DrainGrayStack(true);
+    unmarkedFlag ^= ManagedObjectCtrlBlock::Visited;
+    m1->newFlags = m2->newFlags = ManagedObjectCtrlBlock::InNursery | unmarkedFlag;
 
-    SwapActiveMM();
+    //Not visited objects are destroyed later, see SweepSlice
+    heap.StartSweep();
+    allocMajorHeap = markedBytes;
+    if (ShouldCompact()) CompactHeap(marked);
 }
 
-void GarbageCollector::SweepMajorHeap(const std::vector<ValueType*>& marked)
+void GarbageCollector::StartMarking(const std::vector<ValueType*>& marked, bool concurrent, bool stressed)
 {
-    allocMajorHeap = 0;
-    backwardRefs.clear();
+    assert(!isMarking && grayStack.empty());
+    isMarking = true;
+    CloseFastPath();
+    isGrayDrained = false;
+    isNurseryShaded = false;
+    markedBytes = 0;
+    heap.allocateMarked = true;
+    for (auto v : marked)
     {
-        //Clear visit flags
-        auto currNode = heap.GetFirstNode();
-        while (currNode!=nullptr)
+        auto cb = GetCtrlBlk(v->data.obj);
+        if (!cb->IsInNursery() && !cb->IsFrameLocal()) MarkGray(cb);
+    }
+    if (!concurrent) return;
+    isMarkerStressed = stressed;
+    StartMarker();
+}
+
+void GarbageCollector::StartMarker()
+{
+    markPages = heap.Pages();
+    std::sort(markPages.begin(), markPages.end());
+    isConcurrent = true;
+    isMarkerIdle = false;
+    stopMarker = false;
+    marker = std::thread(&GarbageCollector::RunMarker, this);
+}
+
+bool GarbageCollector::ScanGray(std::chrono::steady_clock::time_point deadline, bool checked)
+{
+    //Targets, read from their slot once
+    EdgeBuffer<void*> edges;
+    auto follow = [&](void* obj) {
+        //Nursery objects are covered by minor GCs
+        if (checked)
         {
-            auto cb = GetCtrlBlkFromNode(currNode);
-            cb->isVisited = false;
-            currNode = MajorHeap::GetNextNode(currNode);
+            //Slots are read racily, a torn one may pair a ref type
+            //with other data. Objects allocated since the start are
+            //marked already, and may still be under construction
+            if (!MajorHeap::IsObject(markPages, obj)) return;
+            auto fieldCB = GetCtrlBlk(obj);
+            if (!MajorHeap::Mark(fieldCB)) return;
+            markedBytes.fetch_add(fieldCB->ObjectSize(), std::memory_order_relaxed);
+            if (fieldCB->MayHoldRefs()) grayStack.push_back({ fieldCB, 0 });
+            return;
         }
-        for (auto blk : m1->blks)
+        auto fieldCB = GetCtrlBlk(obj);
+        if (!fieldCB->IsInNursery() && !fieldCB->IsFrameLocal()) MarkGray(fieldCB);
+    };
+    //Clock reads are SlotsPerStep slots apart
+    std::size_t work = 0;
+    for (;;)
+    {
+        if (grayStack.empty())
         {
-            auto base = (BytePtr)blk;
-            base += MBCtrlBlkSize;
-            std::size_t currSize = 0;
-            while (currSize < blk->usedBytes)
+            if (edges.FollowOldest(follow)) continue;
+            break;
+        }
+        auto objCB = grayStack.back().cb;
+        auto begin = grayStack.back().begin;
+        grayStack.pop_back();
+        if (!objCB->MayHoldRefs()) continue;
+
+        auto fieldCnt = objCB->ObjectSize() / sizeof(ValueType);
+        auto end = std::min(fieldCnt, begin + SlotsPerStep);
+        if (end < fieldCnt) grayStack.push_back({ objCB, end });
+        ForEachRefSlot(objCB, begin, end, [&](ValueType& slot) {
+            auto obj = slot.data.obj;
+            //Never faults, even for a torn pointer
+            PrefetchLine(GetCtrlBlk(obj));
+            edges.Push(obj, follow);
+        });
+        if (checked && isMarkerStressed && markerRng() % 16 == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(markerRng() % 200));
+        work += end - begin + 1;
+        if (work < SlotsPerStep) continue;
+        work = 0;
+        if (std::chrono::steady_clock::now() < deadline) continue;
+        //What the edges left reach is scanned by the next call
+        while (edges.FollowOldest(follow));
+        break;
+    }
+    return grayStack.empty();
+}
+
+bool GarbageCollector::MarkSlice(std::chrono::steady_clock::time_point deadline)
+{
+    assert(isMarking && !isConcurrent);
+    isGrayDrained = ScanGray(deadline, false);
+    return isGrayDrained;
+}
+
+void GarbageCollector::RunMarker()
+{
+    while (!stopMarker.load(std::memory_order_acquire))
+    {
+        if (grayStack.empty())
+        {
+            std::unique_lock<std::mutex> lock(grayLock);
+            if (sharedGray.empty())
             {
-                auto objCB = (ManagedObjectCtrlBlock*)(base + currSize);
-                currSize += MOCtrlBlkSize + objCB->objectSize;
-                objCB->isVisited = false;
+                isMarkerIdle = true;
+                grayCv.wait(lock, [this] { return !sharedGray.empty() || stopMarker.load(); });
+                isMarkerIdle = false;
+                continue;
             }
+            grayStack.swap(sharedGray);
         }
+        if (isMarkerStressed && markerRng() % 4 == 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(markerRng() % 500));
+        //Short steps, so a stop request is seen soon
+        ScanGray(std::chrono::steady_clock::now() + std::chrono::microseconds(200), true);
     }
-    //Mark objects
-    std::stack<ManagedObjectCtrlBlock*> workingSet;
-    for(auto v:marked)
+}
+
+void GarbageCollector::StopMarker()
+{
     {
-        //assert(v->IsRef());
-        auto cb = GetCtrlBlk(v->data.obj);
-        if(cb->isVisited) continue;
+        std::lock_guard<std::mutex> lock(grayLock);
+        stopMarker = true;
+    }
+    grayCv.notify_all();
+    marker.join();
+    isConcurrent = false;
+    //What is left is drained on this thread
+    grayStack.insert(grayStack.end(), sharedGray.begin(), sharedGray.end());
+    grayStack.insert(grayStack.end(), mutatorGray.begin(), mutatorGray.end());
+    sharedGray.clear();
+    mutatorGray.clear();
+    markPages.clear();
+}
 
-        cb->isVisited = true;
+void GarbageCollector::FlushMarkQueue()
+{
+    if (!isConcurrent || mutatorGray.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(grayLock);
+        sharedGray.insert(sharedGray.end(), mutatorGray.begin(), mutatorGray.end());
+    }
+    mutatorGray.clear();
+    grayCv.notify_one();
+}
+
+bool GarbageCollector::IsGrayDrained()
+{
+    if (!isConcurrent) return isGrayDrained;
+    FlushMarkQueue();
+    std::lock_guard<std::mutex> lock(grayLock);
+    return isMarkerIdle && sharedGray.empty();
+}
 
-        if (!cb->isInNursery)
-            allocMajorHeap += cb->objectSize;
-        if(cb->isRaw)
-            workingSet.push(GetCtrlBlk(v->data.obj));
+bool GarbageCollector::TryFinishMarking(const std::vector<ValueType*>& marked, std::chrono::steady_clock::time_point deadline)
+{
+    assert(isMarking && IsNurseryShaded());
+    auto concurrent = isConcurrent;
+    if (concurrent) StopMarker();
+    for (auto v : marked)
+    {
+        auto cb = GetCtrlBlk(v->data.obj);
+        if (!cb->IsInNursery() && !cb->IsFrameLocal()) MarkGray(cb);
     }
-    while (!workingSet.empty())
+    if (!ScanGray(deadline, false))
     {
-        auto objCB = workingSet.top();
-        workingSet.pop();
-        assert(!objCB->isForward);
-                
-        auto payload = (ValueType*)GetPayload(objCB);
-        auto fieldCnt = objCB->objectSize / sizeof(ValueType);
-        for (std::size_t i = 0; i < fieldCnt; i++) {
-            auto field = payload + i;
-            if(!field->IsRef()) continue;
+        //What the roots reach is gray now, a later try finds less
+        isGrayDrained = false;
+        if (concurrent) StartMarker();
+        return false;
+    }
+    EndMarking(marked);
+    return true;
+}
 
-            auto fieldCB = GetCtrlBlk(field->data.obj);
-            if(fieldCB->isVisited) continue;
+void GarbageCollector::FinishMarking(const std::vector<ValueType*>& marked)
+{
+    assert(isMarking);
+    if (isConcurrent) StopMarker();
+    //Copying the nursery shades the heap objects held by every live
+    //nursery object, so they are not traced here
+    if (!IsNurseryShaded()) SweepManaged(marked);
+    for (auto v : marked)
+    {
+        auto cb = GetCtrlBlk(v->data.obj);
+        if (!cb->IsInNursery() && !cb->IsFrameLocal()) MarkGray(cb);
+    }
+    DrainGrayStack(false);
+    EndMarking(marked);
+}
 
-            fieldCB->isVisited = true;
+void GarbageCollector::EndMarking(const std::vector<ValueType*>& marked)
+{
+    heap.allocateMarked = false;
+    heap.StartSweep();
+    allocMajorHeap = markedBytes;
+    isMarking = false;
+    if (ShouldCompact()) CompactHeap(marked);
+}
 
-            if(fieldCB->isInNursery)
-            {
-                if(!objCB->isInNursery)
-                    backwardRefs.insert(field);
-            }else
-            {
-                allocMajorHeap += fieldCB->objectSize;
-            }
-            if (fieldCB->isRaw)
-                workingSet.push(fieldCB);
+bool GarbageCollector::SweepSlice(std::chrono::steady_clock::time_point deadline)
+{
+    if (!heap.SweepPages(deadline) || isMarking) return false;
+    if (heap.DetachEmptyPages())
+    {
+        //Pages left empty are gone
+        dirtyPages.clear();
+        for (auto page : heap.Pages())
+        {
+            if (page->isRemembered) dirtyPages.push_back(page);
         }
     }
+    return heap.ReleaseEmptyPages(deadline);
+}
+
+bool GarbageCollector::ShouldCompact() const
+{
+    //Not worth a pass for a few pages
+    constexpr std::size_t MinPages = 8;
+    if (compactRatio <= 0) return false;
+    auto reclaimable = heap.ReclaimablePages();
+    return reclaimable >= MinPages && reclaimable > heap.SmallPageCount() * compactRatio;
+}
+
+void GarbageCollector::CompactHeap(const std::vector<ValueType*>& marked)
+{
+    auto begin = std::chrono::steady_clock::now();
+    //Dead cells become destinations, their dtors run first
+    SweepSlice(std::chrono::steady_clock::time_point::max());
+    auto mapped = heap.mappedBytes;
+    compactMovedBytes += heap.PlanCompaction();
 
-    //Destroy not visited objects
+    auto forward = [](ValueType& v) {
+        auto cb = GetCtrlBlk(v.data.obj);
+        if (cb->IsInNursery() || cb->IsFrameLocal()) return;
+        if (cb->IsForward()) v.data.obj = cb->vptr;
+    };
+    for (auto v : marked) forward(*v);
+
+    //Cards are rebuilt for the slots' new places
+    heap.ClearCards();
+    dirtyPages.clear();
+    heap.ForEachObject([&](ManagedObjectCtrlBlock* cb) {
+        if (!cb->IsRaw()) return;
+        auto slots = (ValueType*)GetPayload(cb);
+        auto fieldCnt = cb->ObjectSize() / sizeof(ValueType);
+        auto dst = cb->IsForward() ? GetCtrlBlk(cb->vptr) : cb;
+        for (std::size_t i = 0; i < fieldCnt; i++)
+        {
+            if (!slots[i].IsRef()) continue;
+            if (GetCtrlBlk(slots[i].data.obj)->IsInNursery())
+                RememberSlot(dst, (ValueType*)GetPayload(dst) + i);
+            else forward(slots[i]);
+        }
+    });
+    //The nursery may hold garbage pointing to objects just swept, even
+    //on pages gone already. Only follow pointers to live heap objects
+    auto livePages = heap.Pages();
+    std::sort(livePages.begin(), livePages.end());
+    for (auto blk : m1->blks)
     {
-        //Clear visit flags
-        auto currNode = heap.GetFirstNode();
-        auto prevNode = heap.GetHeaderNode();
-        while (currNode != nullptr)
+        auto base = (BytePtr)blk;
+        base += MBCtrlBlkSize;
+        std::size_t currSize = 0;
+        while (currSize < blk->usedBytes)
         {
-            auto cb = GetCtrlBlkFromNode(currNode);
-            if(!cb->isVisited)
+            auto objCB = (ManagedObjectCtrlBlock*)(base + currSize);
+            currSize += MOCtrlBlkSize + objCB->ObjectSize();
+            if (!objCB->IsRaw() || objCB->IsForward()) continue;
+            auto slots = (ValueType*)GetPayload(objCB);
+            for (std::size_t i = 0; i < objCB->ObjectSize() / sizeof(ValueType); i++)
             {
-                heap.RemoveNode(currNode, prevNode);
-                currNode = MajorHeap::GetNextNode(prevNode);
-                continue;
+                auto obj = slots[i].data.obj;
+                if (slots[i].IsRef() && MajorHeap::IsObject(livePages, obj))
+                    forward(slots[i]);
             }
-
-            prevNode = currNode;
-            currNode = MajorHeap::GetNextNode(currNode);
         }
     }
+
+    heap.Compact();
+    compactFreedBytes += mapped - heap.mappedBytes;
+    compactStats.Record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+}
+
+ManagedObjectCtrlBlock* GarbageCollector::AllocateOnHeap(std::size_t size, bool scanned)
+{
+    auto blk = heap.AllocateRaw(size);
+    allocMajorHeap += blk->ObjectSize();
+    //Born marked while marking, and scanned later since the payload
+    //is filled in by the caller
+    if (!isMarking) return blk;
+    if (scanned) markedBytes.fetch_add(blk->ObjectSize(), std::memory_order_relaxed);
+    else QueueMarked(blk);
+    return blk;
+}
+
+ManagedObjectCtrlBlock* GarbageCollector::AllocateRawBlock(std::size_t size, bool pinned, bool young)
+{
+    //Large and pinned objects go to the heap directly, never copied
+    if(pinned || IsLargeObject(size, young))
+    {
+        //Brings the next major GC check forward
+        CloseFastPath();
+        return AllocateOnHeap(size);
+    }
+    auto blk = m1->AllocateRaw(size);
+    allocManaged += blk->ObjectSize();
+    return blk;
+}
+
+void GarbageCollector::SetKind(ManagedObjectCtrlBlock* cb, std::uint8_t kind)
+{
+    cb->SetKind(kind);
+    if (!cb->HasDtor()) return;
+    (cb->IsInNursery() ? m1->finalizable : heap.finalizable).push_back(cb);
+}
+
+ValueType* GarbageCollector::AllocateRawObject(std::size_t fieldCnt, std::uint8_t kind, bool young)
+{
+    auto blk = AllocateRawBlock(sizeof(ValueType) * fieldCnt, false, young);
+    SetKind(blk, kind);
+    return (ValueType*)GetPayload(blk);
 }
 
-ValueType* GarbageCollector::AllocateRawObject(std::size_t fieldCnt)
+BytePtr GarbageCollector::AllocateBlob(std::size_t size, bool pinned, std::uint8_t kind, bool young)
 {
-    auto blk = m1->AllocateRaw(sizeof(ValueType) * fieldCnt);
-    auto payload = GetPayload(blk);
-    allocManaged += blk->objectSize;
-    return (ValueType*)payload;
+    auto blk = AllocateRawBlock(AlignObjSize(size), pinned, young);
+    //Moved by memcpy like raw objects, but fields are not ValueTypes
+    SetKind(blk, kind);
+    return GetPayload(blk);
 }
 
-bool GarbageCollector::WriteField(const ValueType& src, const ValueType& dst, std::size_t idx)
+bool GarbageCollector::WriteField(const ValueType& src, const ValueType& dst, std::size_t idx, bool retype)
 {
     if(!dst.IsRef()) return false;
     auto inst = (ValueType*)dst.data.obj;
     auto dst_cb = GetCtrlBlk(inst);
-    if(!dst_cb->isRaw) return false;
-    auto fieldCnt = dst_cb->objectSize / sizeof(ValueType);
+    if(!dst_cb->IsRaw()) return false;
+    auto fieldCnt = dst_cb->ObjectSize() / sizeof(ValueType);
     if(idx >= fieldCnt) return false;
 
+    //Snapshot barrier for the marker thread, which may not have
+    //scanned the slot yet
+    if(isConcurrent && inst[idx].IsRef())
+    {
+        auto old_cb = GetCtrlBlk(inst[idx].data.obj);
+        if(!old_cb->IsInNursery() && !old_cb->IsFrameLocal()) Shade(old_cb);
+    }
+
     //assert(inst[idx].type == src.type);
     inst[idx].data = src.data;
+    if(retype) inst[idx].type = src.type;
 
     if(!src.IsRef()) return true;
 
+    //Frame local objects only hold value types and die with
+    //their frame, never record them
+    if(dst_cb->IsFrameLocal()) return true;
+
     auto src_cb = GetCtrlBlk(src.data.obj);
 
-    if(src_cb->isInNursery && !dst_cb->isInNursery)
+    //Insertion barrier: a heap object stored while marking may be
+    //moved out of a slot not scanned yet, shade it
+    if(isMarking && !src_cb->IsInNursery() && !src_cb->IsFrameLocal())
+        Shade(src_cb);
+
+    if(src_cb->IsInNursery() && !dst_cb->IsInNursery())
     {
         //Backward cross reference from heap to nursery
-        backwardRefs.insert(inst + idx);
+        RememberSlot(dst_cb, inst + idx);
     }
 
     return true;
 }
 
+//Names come from the type table, only when asked for
+static std::string TypeName(ManagedObjectCtrlBlock* cb)
+{
+    auto ty = (TypeTable*)cb->vptr;
+    return ty == nullptr ? "???" : ty->name;
+}
+
 std::string GarbageCollector::PrintAllocStat()
 {
     std::string msg;
     int newCnt = 0;
     for (auto blk : m1->blks)
     {
-        newCnt += blk->objectCnt;
+        //Copies are not counted per block, walk them
+        auto base = (BytePtr)blk + MBCtrlBlkSize;
+        for (std::size_t currSize = 0; currSize < blk->usedBytes; newCnt++)
+            currSize += MOCtrlBlkSize + ((ManagedObjectCtrlBlock*)(base + currSize))->ObjectSize();
     }
 
     msg += "============New Alloc============\n";
@@ -357,35 +1260,105 @@ std::string GarbageCollector::PrintAllocStat()
         while (currSize < blk->usedBytes)
         {
             auto objCB = (ManagedObjectCtrlBlock*)(base + currSize);
-            currSize += MOCtrlBlkSize + objCB->objectSize;
-            //auto ty = ((TypeTable*)objCB->vptr);
-            //msg += " [" + (ty == nullptr ? "???" : ty->name) + "]";
-            msg += " [" + std::to_string(idx++) + "]";
-            msg += " : " + std::to_string(objCB->objectSize) + " bytes" + "\n";
+            currSize += MOCtrlBlkSize + objCB->ObjectSize();
+            msg += " [" + std::to_string(idx++) + "] " + TypeName(objCB);
+            msg += " : " + std::to_string(objCB->ObjectSize()) + " bytes" + "\n";
         }
     }
     msg += "=================================\n";
 
     msg += "===========Heap Alloc============\n";
     msg += " size:  " + std::to_string(allocMajorHeap) + " bytes" + "\n";
-    msg += " count: " + std::to_string(heap.NodeCount()) + "\n";
+    msg += " count: " + std::to_string(heap.ObjectCount()) + "\n";
+    msg += " pages: " + std::to_string(heap.mappedBytes) + " bytes" + "\n";
     msg += "---------------------------------\n";
 
-    auto n = heap.GetFirstNode();
     idx = 0;
-    while (n!= nullptr)
+    heap.ForEachObject([&](ManagedObjectCtrlBlock* objCB)
     {
-        auto objCB = GetCtrlBlkFromNode(n);
-        //auto ty = ((TypeTable*)objCB->vptr);
-        //msg += " [" + (ty == nullptr ? "???" : ty->name) + "]";
-        msg += " [" + std::to_string(idx++) + "]";
-        msg += " : " + std::to_string(objCB->objectSize) + " bytes" + "\n";
-        n = MajorHeap::GetNextNode(n);
-    }
+        msg += " [" + std::to_string(idx++) + "] " + TypeName(objCB);
+        msg += " : " + std::to_string(objCB->ObjectSize()) + " bytes" + "\n";
+    });
 
     //msg += "---------------------------------\n";
     msg += "=================================\n";
 
+    msg += markSliceStats.Print("Mark Slices");
+    msg += finalPauseStats.Print("Final Pauses");
+    msg += sweepSliceStats.Print("Sweep Slices");
+    msg += compactStats.Print("Compactions");
+    msg += " moved: " + std::to_string(compactMovedBytes) + " bytes\n";
+    msg += " freed: " + std::to_string(compactFreedBytes) + " bytes\n";
+
     return msg;
 }
 
+std::string PauseStats::Print(const std::string& title) const
+{
+    std::string msg;
+    msg += "=========" + title + "=========\n";
+    msg += " count: " + std::to_string(count) + "\n";
+    if (count == 0) return msg;
+    msg += " avg:   " + std::to_string(totalUs / count) + " us\n";
+    msg += " max:   " + std::to_string(maxUs) + " us\n";
+    msg += "---------------------------------\n";
+    for (int b = 0; b < BucketCnt; b++)
+    {
+        if (buckets[b] == 0) continue;
+        msg += " < " + std::to_string(1ull << b) + " us : " + std::to_string(buckets[b]) + "\n";
+    }
+    return msg;
+}
+
+void GCWorkerPool::Resize(std::size_t cnt)
+{
+    Stop();
+    stop = false;
+    for (std::size_t i = 1; i < cnt; i++)
+        threads.emplace_back(&GCWorkerPool::Loop, this, i, round);
+}
+
+void GCWorkerPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    startCv.notify_all();
+    for (auto& t : threads) t.join();
+    threads.clear();
+}
+
+void GCWorkerPool::Run(const std::function<void(std::size_t)>& fn)
+{
+    if (threads.empty())
+    {
+        fn(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        task = &fn;
+        running = threads.size();
+        round++;
+    }
+    startCv.notify_all();
+    fn(0);
+    std::unique_lock<std::mutex> guard(lock);
+    doneCv.wait(guard, [this] { return running == 0; });
+}
+
+void GCWorkerPool::Loop(std::size_t idx, std::size_t seen)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;)
+    {
+        startCv.wait(guard, [&] { return stop || round != seen; });
+        if (stop) return;
+        seen = round;
+        guard.unlock();
+        (*task)(idx);
+        guard.lock();
+        if (--running == 0) doneCv.notify_one();
+    }
+}
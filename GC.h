@@ -1,25 +1,54 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <queue>
-#include <stack>
+#include <random>
+#include <stdexcept>
 #include <string>
-#include <unordered_set>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
 
 using BytePtr = std::uint8_t*;
 
 #define PtrSize (sizeof(void*))
-#define NHeaderSize (sizeof(NodeHeader))
 #define MBCtrlBlkSize (sizeof(ManagedMemCtrlBlock))
 #define MOCtrlBlkSize (sizeof(ManagedObjectCtrlBlock))
 
 #define GetCtrlBlk(obj) ((ManagedObjectCtrlBlock*)((BytePtr)obj - MOCtrlBlkSize))
 #define GetPayload(cb) ((BytePtr)cb + MOCtrlBlkSize)
 
-#define GetCtrlBlkFromNode(n) ((ManagedObjectCtrlBlock*)((BytePtr)n + PtrSize))
+//Hints that the cache line at ptr is read soon
+inline void PrefetchLine(const void* ptr)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    _mm_prefetch((const char*)ptr, _MM_HINT_T0);
+#else
+    __builtin_prefetch(ptr);
+#endif
+}
+
+//Heap pages carry one card byte per 512 bytes, set when a slot in
+//that range may point into the nursery
+#define CardShift 9
+
+//Every payload starts on a 16 byte boundary, so packed host
+//types can use aligned SIMD loads
+#define ObjAlignment 16
+#define AlignObjSize(size) (((size) + ObjAlignment - 1) & ~(std::size_t)(ObjAlignment - 1))
 
 
 class Interpreter;
@@ -27,103 +56,185 @@ class GarbageCollector;
 class ValueType;
 
 
-struct ManagedObjectCtrlBlock
+//Move and destroy logic shared by every object of one kind, so the
+//header only keeps the kind
+struct ObjectDescriptor
 {
-    std::uint32_t objectSize;
-    std::string debugInfo;
-
-    //GC Flags:
-    bool isVisited;
-    bool isForward;
-    bool isRaw;
-    bool isInNursery;
-    char generation;
+    //Moves size payload bytes from src to dst, leaving src destroyed.
+    //nullptr copies the bytes
+    void(*move)(BytePtr src, BytePtr dst, std::size_t size);
+    //Releases what the payload holds, nullptr if nothing
+    void(*dtor)(BytePtr payload);
+};
 
+/* Every object starts with this 16 byte header:
+ * +-------------------+
+ * | vptr              |  type table, or where the object went
+ * +-------------------+
+ * | header            |  flags | kind | generation | hash | size
+ * +-------------------+     5      6       4         21     28 bits
+ * The size counts 16 byte granules, payloads are aligned to them.
+ */
+struct alignas(ObjAlignment) ManagedObjectCtrlBlock
+{
     /**
      * \brief points to object typetable, or
      * forwarded position after GC
      */
     void* vptr;
+    //Atomic for the parallel collector, workers race to mark and copy,
+    //and the background marker reads it while the interpreter hashes
+    std::atomic<std::uint64_t> header;
+
+    //GC Flags. Visited marks nursery and frame local objects, which
+    //value means marked flips with each full marking, see TryMark
+    static constexpr std::uint64_t Visited = 1, Forward = 2,
+        //Claimed by the worker copying it, others wait for Forward
+        Copying = 4, InNursery = 8, FrameLocal = 16;
+
+    static constexpr int KindShift = 5, GenShift = 11, HashShift = 15, SizeShift = 36;
+    static constexpr std::uint64_t KindMask = 63ull << KindShift, GenMask = 15ull << GenShift,
+        HashMask = 0x1FFFFFull << HashShift;
+    static constexpr int MaxGeneration = 15;
+
+    /* Kinds index descriptors. Raw objects hold ValueType slots, blobs
+     * any other bytes, neither needs more than a copy to move. Typed
+     * objects are raw ones laid out after the fields of their type
+     * table, whose refMap tells the GC which slots to look at. Leaf
+     * objects are typed ones without reference slots, never scanned.
+     * Host types register a kind of their own, see KindOf, up to
+     * MaxKinds in all
+     */
+    static constexpr std::uint8_t RawKind = 0, TypedKind = 1, LeafKind = 2, BlobKind = 3, MaxKinds = 64;
+    static inline ObjectDescriptor descriptors[MaxKinds] = {};
+    static inline std::atomic<std::uint32_t> kindCnt{ 4 };
 
-    //Manage functions
-    void(*move)(BytePtr src, BytePtr dst, std::size_t size);
-    void(*dtor)(BytePtr ptr);
+    //Throws length_error once the kind field is used up, in release
+    //builds too, a wrapped kind would corrupt the generation bits
+    static std::uint8_t RegisterKind(ObjectDescriptor desc)
+    {
+        auto kind = kindCnt.fetch_add(1);
+        if (kind >= MaxKinds)
+        {
+            kindCnt.store(MaxKinds);
+            throw std::length_error("Too many host object kinds, at most "
+                + std::to_string(MaxKinds - BlobKind - 1));
+        }
+        descriptors[kind] = desc;
+        return (std::uint8_t)kind;
+    }
+
+    template<typename T>
+    static std::uint8_t KindOf()
+    {
+        //Objects of trivially destructible types are never listed as
+        //finalizable, see HasDtor
+        void(*dtor)(BytePtr payload) = nullptr;
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            dtor = [](BytePtr payload) { ((T*)payload)->~T(); };
+        static const auto kind = RegisterKind({
+            [](BytePtr src, BytePtr dst, std::size_t size) {
+                new(dst)T(std::move(*(T*)src));
+                ((T*)src)->~T();
+            },
+            dtor });
+        return kind;
+    }
+
+    std::uint64_t Bits() const { return header.load(std::memory_order_relaxed); }
+    std::size_t ObjectSize() const { return (std::size_t)(Bits() >> SizeShift) * ObjAlignment; }
+    std::size_t TotalBytes() const { return MOCtrlBlkSize + ObjectSize(); }
+    std::uint8_t Kind() const { return (Bits() & KindMask) >> KindShift; }
+    int Generation() const { return (Bits() & GenMask) >> GenShift; }
+    //Address independent hash, 0 until first asked. Moves keep it
+    std::uint32_t IdentityHash() const { return (Bits() & HashMask) >> HashShift; }
+
+    //Payload is ValueType slots
+    bool IsRaw() const { return Kind() <= LeafKind; }
+    //Needs scanning by the GC
+    bool MayHoldRefs() const { return Kind() < LeafKind; }
+    //Destroy does something, the object is listed as finalizable
+    bool HasDtor() const { return descriptors[Kind()].dtor != nullptr; }
+    bool IsInNursery() const { return Bits() & InNursery; }
+    bool IsFrameLocal() const { return Bits() & FrameLocal; }
+    //Pairs with the release in MoveTo, the copy is complete once seen
+    bool IsForward() const { return header.load(std::memory_order_acquire) & Forward; }
+
+    //For objects nobody else sees yet
+    void SetKind(std::uint8_t kind) { header.store((Bits() & ~KindMask) | (std::uint64_t)kind << KindShift, std::memory_order_relaxed); }
+    void SetGeneration(int gen)
+    {
+        gen = std::min(gen, MaxGeneration);
+        header.store((Bits() & ~GenMask) | (std::uint64_t)gen << GenShift, std::memory_order_relaxed);
+    }
 
-    std::size_t TotalBytes() const {return MOCtrlBlkSize + objectSize;}
+    //False if flag was set already
+    bool TrySet(std::uint64_t flag)
+    {
+        if (Bits() & flag) return false;
+        return !(header.fetch_or(flag, std::memory_order_relaxed) & flag);
+    }
+    void Clear(std::uint64_t flag) { header.fetch_and(~flag, std::memory_order_relaxed); }
+    //Gives Visited the value other than unmarked, false if it had it
+    bool TryMark(std::uint64_t unmarked)
+    {
+        if ((Bits() & Visited) != unmarked) return false;
+        if (unmarked == 0) return !(header.fetch_or(Visited, std::memory_order_relaxed) & Visited);
+        return header.fetch_and(~Visited, std::memory_order_relaxed) & Visited;
+    }
+    void SetIdentityHash(std::uint32_t hash) { header.fetch_or((std::uint64_t)hash << HashShift & HashMask, std::memory_order_relaxed); }
+
+    //Runs the kind's dtor, host resources may hang off the payload
+    void Destroy()
+    {
+        auto dtor = descriptors[Kind()].dtor;
+        if (dtor != nullptr) dtor((BytePtr)this + MOCtrlBlkSize);
+    }
 
-    ~ManagedObjectCtrlBlock()
+    //Moves the payload to newInst, just emplaced by the caller, along
+    //with the type, kind and hash, then forwards this one to it
+    void MoveTo(ManagedObjectCtrlBlock* newInst)
     {
-        dtor((BytePtr)this);
+        auto bits = Bits();
+        auto move = descriptors[(bits & KindMask) >> KindShift].move;
+        auto src = (BytePtr)this + MOCtrlBlkSize, dst = (BytePtr)newInst + MOCtrlBlkSize;
+        if (move != nullptr) move(src, dst, ObjectSize());
+        else memcpy(dst, src, ObjectSize());
+        newInst->vptr = vptr;
+        newInst->header.store(newInst->Bits() | (bits & (KindMask | HashMask)), std::memory_order_relaxed);
+        //            forwarding_set (old, new);
+        vptr = dst;
+        header.fetch_or(Forward, std::memory_order_release);
     }
 
     /*********************************************************************/
     /*                          Object allocation                        */
     /*********************************************************************/
 
-    //Must have at least enough space for ctrlblk
-    static ManagedObjectCtrlBlock* EmplaceRaw(void* ptr, int objSize)
-    {
-        auto ctrl = new(ptr)ManagedObjectCtrlBlock();
-        ctrl->isVisited = false;
-        ctrl->isForward = false;
-        ctrl->isRaw = true;
-        ctrl->generation = 0;
-        ctrl->objectSize = objSize;
-        ctrl->dtor = [](BytePtr ptr) {};
-        ctrl->move = [](BytePtr src, BytePtr dst, std::size_t size)
-        {
-            memcpy(dst + MOCtrlBlkSize, src + MOCtrlBlkSize, size);
-            auto newInst = (ManagedObjectCtrlBlock*)dst;
-            auto cb = (ManagedObjectCtrlBlock*)src;
-            newInst->vptr = cb->vptr;
-            newInst->isRaw = cb->isRaw;
-            newInst->debugInfo = cb->debugInfo;
-            //newInst->generation = cb->generation + 1;
-            //(cb->move)((BytePtr)cb, (BytePtr)newInst, cb->objectSize);
-            cb->~ManagedObjectCtrlBlock();
-            //            forwarding_set (old, new);
-            cb->vptr = ((BytePtr)newInst) + MOCtrlBlkSize;
-            cb->isForward = true;
-        };
-
+    //Must have at least enough space for ctrlblk. flags: InNursery or
+    //FrameLocal
+    static ManagedObjectCtrlBlock* EmplaceRaw(void* ptr, std::size_t objSize, std::uint64_t flags = 0, std::uint8_t kind = RawKind)
+    {
+        assert(objSize % ObjAlignment == 0);
+        auto ctrl = (ManagedObjectCtrlBlock*)ptr;
+        ctrl->vptr = nullptr;
+        new(&ctrl->header)std::atomic<std::uint64_t>(
+            (std::uint64_t)(objSize / ObjAlignment) << SizeShift | (std::uint64_t)kind << KindShift | flags);
         return ctrl;
     }
 
     template<typename T, typename ...ArgTypes>
-    static ManagedObjectCtrlBlock* EmplaceType(void* ptr, ArgTypes... args)
+    static ManagedObjectCtrlBlock* EmplaceType(void* ptr, std::uint64_t flags, ArgTypes... args)
     {
         auto payload = (BytePtr)ptr + MOCtrlBlkSize;
         /*T* obj = */new(payload)T(args...);
-
-        auto ctrl = new(ptr)ManagedObjectCtrlBlock();
-        ctrl->isVisited = false;
-        ctrl->isForward = false;
-        ctrl->isRaw = false;
-        ctrl->generation = 0;
-        ctrl->objectSize = sizeof(T);
-        ctrl->dtor = [](BytePtr ptr) {((T*)((BytePtr)ptr + MOCtrlBlkSize))->~T(); };
-        ctrl->move = [](BytePtr src, BytePtr dst, std::size_t size)
-        {
-            new(dst + MOCtrlBlkSize)T(std::move(*((T*)(src + MOCtrlBlkSize))));
-            auto newInst = (ManagedObjectCtrlBlock*)dst;
-            auto cb = (ManagedObjectCtrlBlock*)src;
-            newInst->vptr = cb->vptr;
-            newInst->isRaw = cb->isRaw;
-            newInst->debugInfo = cb->debugInfo;
-            //newInst->generation = cb->generation + 1;
-            //(cb->move)((BytePtr)cb, (BytePtr)newInst, cb->objectSize);
-            cb->~ManagedObjectCtrlBlock();
-            //            forwarding_set (old, new);
-            cb->vptr = ((BytePtr)newInst) + MOCtrlBlkSize;
-            cb->isForward = true;
-        };
-
-        return ctrl;
+        return EmplaceRaw(ptr, AlignObjSize(sizeof(T)), flags, KindOf<T>());
     }
 
 };
+static_assert(sizeof(ManagedObjectCtrlBlock) == 16, "header is two words");
 
-struct ManagedMemCtrlBlock
+struct alignas(ObjAlignment) ManagedMemCtrlBlock
 {
     std::size_t totalBytes, usedBytes, objectCnt;
     std::size_t Available() const{return totalBytes - usedBytes;}
@@ -205,23 +316,26 @@ class ManagedNursery
 public:
 
     std::size_t blockSizeInBytes = 4 << 20; //Default 4MB chunks
+    //Flags of the objects allocated here, see GarbageCollector::unmarkedFlag
+    std::uint64_t newFlags = ManagedObjectCtrlBlock::InNursery;
+    //Objects with a dtor, the only ones a minor GC looks at among the
+    //dead. The rest of the blocks is reused untouched
+    std::vector<ManagedObjectCtrlBlock*> finalizable;
 
     ManagedObjectCtrlBlock* AllocateRaw(std::size_t size)
     {
         auto totalSize = size +MOCtrlBlkSize;
         auto space = AllocateFromManaged(totalSize);
-        auto cb = ManagedObjectCtrlBlock::EmplaceRaw(space, size);
-        cb->isInNursery = true;
-        return cb;
+        return ManagedObjectCtrlBlock::EmplaceRaw(space, size, newFlags);
     }
 
     template<typename T, typename ...ArgTypes>
     ManagedObjectCtrlBlock* Allocate(ArgTypes... args)
     {
-        auto totalSize = sizeof(T) + MOCtrlBlkSize;
+        auto totalSize = AlignObjSize(sizeof(T)) + MOCtrlBlkSize;
         auto space = AllocateFromManaged(totalSize);
-        auto cb = ManagedObjectCtrlBlock::EmplaceType<T, ArgTypes...>(space, args...);
-        cb->isInNursery = true;
+        auto cb = ManagedObjectCtrlBlock::EmplaceType<T, ArgTypes...>(space, newFlags, args...);
+        if (cb->HasDtor()) finalizable.push_back(cb);
         return cb;
     }
 
@@ -234,99 +348,616 @@ public:
     }
 };
 
-/* Long lived object heap
- * +-------------------+
- * | Next ptr          |
- * +-------------------+
- * | Object ctrl block |
- * +-------------------+
- * | payload           |
- *   ...
+/* Storage for allocations sunk into call frames by the translator.
+ * Frames are strictly LIFO, so this is a chunked bump stack. Objects
+ * placed here are never moved or freed by the GC, they die with the frame.
  */
-struct NodeHeader {
-    NodeHeader* next;
-};
-class MajorHeap
+class FrameLocalArena
 {
-    NodeHeader* front, *back;
-    NodeHeader headerNode;
-    int nodeCnt = 0;
-
-    void* AllocateOnHeap(std::size_t size)
+    struct Chunk
     {
-        std::size_t totalSize = MOCtrlBlkSize + NHeaderSize + size;
-        auto node = (NodeHeader*)malloc(totalSize);
-        //auto nextNodePtr = node;
-        node->next = nullptr;
+        BytePtr mem;
+        std::size_t size, used;
+    };
 
-        //Add to chain
-        back->next = node;
-        back = node;
-        nodeCnt ++;
-        return (BytePtr)node + NHeaderSize;
-    }
+    std::vector<Chunk> chunks;
+    std::size_t currChunk = 0;
 
 public:
-    int NodeCount() const {return nodeCnt;}
+    std::size_t chunkSizeInBytes = 64 << 10; //Default 64KB chunks
 
-    MajorHeap()
+    BytePtr Push(std::size_t size)
     {
-        headerNode.next = nullptr;
-        front = back = &headerNode;
+        if(!chunks.empty())
+        {
+            auto& c = chunks[currChunk];
+            if(c.size - c.used >= size)
+            {
+                auto ptr = c.mem + c.used;
+                c.used += size;
+                return ptr;
+            }
+            //Current one is full, try cached ones
+            currChunk++;
+        }
+
+        while(currChunk < chunks.size() && chunks[currChunk].size < size)
+        {
+            currChunk++;
+        }
+
+        if(currChunk >= chunks.size())
+        {
+            auto chunkSize = std::max(chunkSizeInBytes, size);
+            chunks.push_back({(BytePtr)malloc(chunkSize), chunkSize, 0});
+            currChunk = chunks.size() - 1;
+        }
+
+        auto& c = chunks[currChunk];
+        auto ptr = c.mem + c.used;
+        c.used += size;
+        return ptr;
     }
 
-    ~MajorHeap()
+    //Must be called in reverse order of Push
+    void Pop(std::size_t size)
     {
-        auto currNode = GetFirstNode();
-        //void* prevNode = *front;
-        while (currNode != nullptr)
+        auto& c = chunks[currChunk];
+        assert(c.used >= size);
+        c.used -= size;
+        //Frames below us live in previous non-empty chunk
+        while(currChunk > 0 && chunks[currChunk].used == 0)
         {
-            auto cb = (ManagedObjectCtrlBlock*)((BytePtr)currNode + NHeaderSize);
-            cb->~ManagedObjectCtrlBlock();
+            currChunk--;
+        }
+    }
 
+    void Reset()
+    {
+        for(auto& c : chunks)
+        {
+            c.used = 0;
+        }
+        currChunk = 0;
+    }
 
-            auto nextNode = GetNextNode(currNode);
-            free(currNode);
-            currNode = nextNode;
+    ~FrameLocalArena()
+    {
+        for(auto& c : chunks)
+        {
+            free(c.mem);
         }
     }
+};
+
+/* Long lived object heap, built from 64KB pages aligned to their size.
+ * Each page serves one size class of cells holding a ctrl block and its
+ * payload, so the page of an object is its address with the low bits
+ * cleared. Objects past the largest class get a page of their own.
+ * +-------------------+
+ * | HeapPage          |  bitmaps of allocated and marked cells, cards
+ * +-------------------+
+ * | cell              |  ctrl block + payload
+ * +-------------------+
+ * | cell              |
+ *   ...
+ * Cells are handed out lowest free first, found by their alloc bits,
+ * so neither allocation nor sweeping reads a dead cell. Pages left
+ * empty go back to a small pool, the rest are unmapped.
+ *
+ * Sweeping is lazy. At the end of marking StartSweep only rewrites the
+ * bitmaps: alloc bits keep the marked cells, so dead objects are gone
+ * for every walk right away, and mark bits keep the dead ones, not to
+ * be reused yet. A mark bit on a cell that is not allocated never
+ * comes from marking, which only marks allocated cells, so these
+ * survive a new marking started before the page is swept, and the next
+ * StartSweep adds to them. Pages are swept when their class runs out
+ * of cells, or in slices between mutator steps (SweepPages). Only the
+ * objects listed in finalizable have dtors, the dead ones among them
+ * are destroyed before the first page is swept.
+ */
+struct alignas(ObjAlignment) HeapPage
+{
+    static constexpr std::size_t Size = 64 << 10;
+    //Bitmaps are indexed by 16 byte granule, a cell starts on one
+    static constexpr std::size_t Granules = Size / ObjAlignment;
+
+    //Mapped bytes, Size except for large pages
+    std::size_t bytes;
+    //0 for large pages
+    std::uint32_t cellSize;
+    //No cell is free below freeIdx, and none was allocated at or past
+    //bumpIdx, walks stop there
+    std::uint32_t sizeClass, cellCnt, freeIdx, bumpIdx, liveCnt;
+    //Queued in GarbageCollector::dirtyPages
+    bool isRemembered;
+    //One per 512 bytes from the page start, large pages keep them
+    //after the object
+    std::uint8_t* cards;
+    //Atomic for the background marker, which reads allocBits and sets
+    //markBits while the interpreter allocates
+    std::atomic<std::uint64_t> allocBits[Granules / 64];
+    std::atomic<std::uint64_t> markBits[Granules / 64];
+    std::uint8_t smallCards[Size >> CardShift];
+
+    static HeapPage* Of(const void* cb) { return (HeapPage*)((std::uintptr_t)cb & ~(std::uintptr_t)(Size - 1)); }
+    BytePtr Cells() { return (BytePtr)this + AlignObjSize(sizeof(HeapPage)); }
+    std::size_t CardCnt() const { return bytes >> CardShift; }
+    //Of swept pages, dead cells are not free before
+    bool HasFreeCell() const { return cellSize != 0 && liveCnt < cellCnt; }
+    //Lowest free cell, HasFreeCell must hold
+    BytePtr TakeFreeCell()
+    {
+        while (TestBit(allocBits, Granule(Cells() + freeIdx * cellSize))) freeIdx++;
+        bumpIdx = std::max(bumpIdx, freeIdx + 1);
+        return Cells() + freeIdx++ * cellSize;
+    }
+
+    std::size_t Granule(const void* cb) const { return ((BytePtr)cb - (BytePtr)this) / ObjAlignment; }
+    static bool TestBit(const std::atomic<std::uint64_t>* bits, std::size_t i)
+    {
+        return (bits[i / 64].load(std::memory_order_acquire) >> (i % 64)) & 1;
+    }
+    //Only the interpreter thread sets alloc bits
+    static void SetBit(std::atomic<std::uint64_t>* bits, std::size_t i)
+    {
+        auto& word = bits[i / 64];
+        word.store(word.load(std::memory_order_relaxed) | 1ull << (i % 64), std::memory_order_release);
+    }
+    static void ClearBit(std::atomic<std::uint64_t>* bits, std::size_t i)
+    {
+        auto& word = bits[i / 64];
+        word.store(word.load(std::memory_order_relaxed) & ~(1ull << (i % 64)), std::memory_order_relaxed);
+    }
+    static void ClearBits(std::atomic<std::uint64_t>* bits)
+    {
+        for (std::size_t w = 0; w < Granules / 64; w++) bits[w].store(0, std::memory_order_relaxed);
+    }
+};
+
+class MajorHeap
+{
+    /* Size classes step by 16 bytes up to 256, then by a quarter of the
+     * power of two below, so cells waste at most 25%
+     */
+    static constexpr std::size_t MaxCellSize = 8 << 10;
+    static constexpr std::size_t ClassCnt = 40;
+    static constexpr std::size_t PoolPages = 16;
+
+    std::uint32_t classSizes[ClassCnt];
+    std::uint8_t classOfGranules[MaxCellSize / ObjAlignment + 1];
+    std::size_t classCnt = 0;
+
+    //Every page in use, small and large
+    std::vector<HeapPage*> pages;
+    //Pages of each class that have free cells
+    std::vector<HeapPage*> availPages[ClassCnt];
+    //Pages with dead objects left to destroy, by class, large pages
+    //last. Not in availPages until swept
+    std::vector<HeapPage*> unsweptPages[ClassCnt + 1];
+    std::size_t unsweptCnt = 0;
+    //Pages left empty by the sweep are taken out of pages once it is
+    //done, then released in slices
+    bool isReleasePending = false;
+    std::vector<HeapPage*> emptyPages;
+    std::vector<HeapPage*> pagePool;
+    //Dead objects of finalizable, destroyed before any cell is reused
+    std::vector<ManagedObjectCtrlBlock*> dying;
+    int objectCnt = 0;
+    //Types of the objects planned to move, in page order
+    std::vector<void*> movedTypes;
+
+    HeapPage* NewPage(std::size_t sizeClass);
+    HeapPage* NewLargePage(std::size_t cellSize);
+    void ReleasePage(HeapPage* page);
+    //Frees the dead cells of page, once the dying are destroyed
+    void SweepPage(HeapPage* page);
+    //Sweeps the next unswept page of class c, false if there is none
+    bool SweepNext(std::size_t c);
+
+    void* AllocateOnHeap(std::size_t size);
+
+public:
+    //Pages mapped from the OS, for stats
+    std::size_t mappedBytes = 0;
+    //New objects get their mark bit before their alloc bit, so the
+    //background marker never scans one still being built
+    bool allocateMarked = false;
+    //Objects with a dtor, the only ones a sweep looks at among the dead
+    std::vector<ManagedObjectCtrlBlock*> finalizable;
+
+    MajorHeap();
+    ~MajorHeap();
+
+    int ObjectCount() const {return objectCnt;}
 
     ManagedObjectCtrlBlock* AllocateRaw(std::size_t size)
     {
         auto totalSize = size + MOCtrlBlkSize;
         auto space = AllocateOnHeap(totalSize);
-        auto cb = ManagedObjectCtrlBlock::EmplaceRaw(space, size);
-        cb->isInNursery = false;
-        return cb;
+        return ManagedObjectCtrlBlock::EmplaceRaw(space, size);
     }
 
     template<typename T, typename ...ArgTypes>
     ManagedObjectCtrlBlock* Allocate(ArgTypes... args)
     {
-        auto totalSize = sizeof(T) + MOCtrlBlkSize;
+        auto totalSize = AlignObjSize(sizeof(T)) + MOCtrlBlkSize;
         auto space = AllocateOnHeap(totalSize);
-        auto cb = ManagedObjectCtrlBlock::EmplaceType<T, ArgTypes...>(space, args...);
-        cb->isInNursery = false;
+        auto cb = ManagedObjectCtrlBlock::EmplaceType<T, ArgTypes...>(space, 0, args...);
+        if (cb->HasDtor()) finalizable.push_back(cb);
         return cb;
     }
 
-    NodeHeader* GetHeaderNode() const {return front;}
+    //Sets the mark bit of a heap object, false if it was set already.
+    //Safe against the background marker
+    static bool Mark(ManagedObjectCtrlBlock* cb)
+    {
+        auto page = HeapPage::Of(cb);
+        auto g = page->Granule(cb);
+        auto& word = page->markBits[g / 64];
+        auto bit = 1ull << (g % 64);
+        if (word.load(std::memory_order_relaxed) & bit) return false;
+        return !(word.fetch_or(bit, std::memory_order_relaxed) & bit);
+    }
+
+    //Whether ptr may be the payload of an object allocated on one of
+    //pages, sorted. For pointers that may be torn, read by the
+    //background marker halfway through a store, or stale
+    static bool IsObject(const std::vector<HeapPage*>& pages, const void* ptr)
+    {
+        auto cb = (BytePtr)ptr - MOCtrlBlkSize;
+        auto page = HeapPage::Of(cb);
+        if (!std::binary_search(pages.begin(), pages.end(), page)) return false;
+        auto offset = cb - page->Cells();
+        if (page->cellSize == 0) { if (offset != 0) return false; }
+        else if (offset < 0 || offset % page->cellSize != 0 || offset / page->cellSize >= page->cellCnt) return false;
+        return HeapPage::TestBit(page->allocBits, page->Granule(cb));
+    }
+
+    //Drops unmarked objects and clears the marks of the rest, queues
+    //the pages to sweep and the finalizable objects to destroy.
+    //Releases nothing, pages may still be marked
+    void StartSweep();
+    //Sweeps queued pages until deadline, true once none is left
+    bool SweepPages(std::chrono::steady_clock::time_point deadline);
+    //Takes the pages left empty out of Pages() once every page is
+    //swept, false if that was done already. Not while marking, the
+    //marker may still look at them
+    bool DetachEmptyPages();
+    //Releases detached pages until deadline, true once none is left
+    bool ReleaseEmptyPages(std::chrono::steady_clock::time_point deadline);
+    //Queued pages, or empty ones to release
+    bool IsSweeping() const { return unsweptCnt != 0 || isReleasePending || !emptyPages.empty(); }
+
+    //Cleans every card, for a full rebuild
+    void ClearCards();
+
+    /* Compaction slides the raw objects of each size class towards the
+     * oldest pages of the class, keeping their order, Lisp2 style:
+     * plan where each one goes, let the collector rewrite references,
+     * then move. Host objects and blobs can be pinned and stay put,
+     * sliding skips past them. Large objects own their pages already.
+     */
+    //Small object pages, and how many sliding would empty
+    std::size_t SmallPageCount() const;
+    std::size_t ReclaimablePages() const;
+    //Forwards every object that moves to its destination, its type is
+    //kept in movedTypes meanwhile. Returns the bytes to move
+    std::size_t PlanCompaction();
+    //Moves forwarded objects and releases the pages left empty
+    void Compact();
+
+    const std::vector<HeapPage*>& Pages() const { return pages; }
+
+    template<typename Fn>
+    static void ForEachObject(HeapPage* page, Fn&& fn)
+    {
+        for (std::size_t w = 0; w < HeapPage::Granules / 64; w++)
+        {
+            for (auto bits = page->allocBits[w].load(std::memory_order_relaxed); bits != 0; bits &= bits - 1)
+            {
+                auto g = w * 64 + CountTrailingZeros(bits);
+                fn((ManagedObjectCtrlBlock*)((BytePtr)page + g * ObjAlignment));
+            }
+        }
+    }
+
+    template<typename Fn>
+    void ForEachObject(Fn&& fn) const
+    {
+        for (auto page : pages) ForEachObject(page, fn);
+    }
+
+    //Calls fn(cb, begin, end) for the slots of raw objects inside card c
+    template<typename Fn>
+    static void ForEachSlotInCard(HeapPage* page, std::size_t c, Fn&& fn)
+    {
+        auto cardBegin = (BytePtr)page + (c << CardShift);
+        auto cardEnd = cardBegin + (1 << CardShift);
+        auto cells = page->Cells();
+        std::size_t first = 0, last = 0;
+        if (page->cellSize != 0)
+        {
+            if (cardEnd <= cells) return;
+            first = cardBegin > cells ? (cardBegin - cells) / page->cellSize : 0;
+            last = std::min<std::size_t>((cardEnd - 1 - cells) / page->cellSize + 1, page->bumpIdx);
+        }
+        else last = 1;
+        for (auto i = first; i < last; i++)
+        {
+            auto cb = (ManagedObjectCtrlBlock*)(cells + i * page->cellSize);
+            if (!HeapPage::TestBit(page->allocBits, page->Granule(cb)) || !cb->MayHoldRefs()) continue;
+            auto begin = std::max(GetPayload(cb), cardBegin);
+            auto end = std::min(GetPayload(cb) + cb->ObjectSize(), cardEnd);
+            if (begin < end) fn(cb, (ValueType*)begin, (ValueType*)end);
+        }
+    }
+
+    static int CountTrailingZeros(std::uint64_t bits)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long i;
+        _BitScanForward64(&i, bits);
+        return (int)i;
+#else
+        return __builtin_ctzll(bits);
+#endif
+    }
 
-    NodeHeader* GetFirstNode() const { return GetNextNode(front); }
-    void RemoveNode(NodeHeader* thisNode, NodeHeader* prevNode)
+    static int PopCount(std::uint64_t bits)
     {
-        assert(thisNode != &headerNode);
-        SetNextNode(prevNode, thisNode->next);
-        nodeCnt--;
-        if(thisNode == back)
-            back = prevNode;
+#if defined(_MSC_VER) && !defined(__clang__)
+        return (int)__popcnt64(bits);
+#else
+        return __builtin_popcountll(bits);
+#endif
+    }
+};
+
+//Distribution of GC pauses, bucket i counts pauses shorter than 2^i us
+struct PauseStats
+{
+    static constexpr int BucketCnt = 24;
+    std::uint64_t buckets[BucketCnt] = {};
+    std::uint64_t count = 0;
+    double totalUs = 0, maxUs = 0;
 
-        free(thisNode);
+    void Record(double us)
+    {
+        int b = 0;
+        while (b < BucketCnt - 1 && us >= double(1ull << b)) b++;
+        buckets[b]++;
+        count++;
+        totalUs += us;
+        maxUs = std::max(maxUs, us);
     }
 
-    static NodeHeader* GetNextNode(NodeHeader* thisNode) { return thisNode->next; }
-    static void SetNextNode(NodeHeader* thisNode, NodeHeader* nextNode){
-        thisNode->next = nextNode;
+    std::string Print(const std::string& title) const;
+};
+
+//Threads of the parallel collector, parked between collections
+class GCWorkerPool
+{
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable startCv, doneCv;
+    const std::function<void(std::size_t)>* task = nullptr;
+    std::size_t round = 0, running = 0;
+    bool stop = false;
+
+    //seen: the last round run, tasks of later ones are picked up
+    void Loop(std::size_t idx, std::size_t seen);
+    void Stop();
+
+public:
+    ~GCWorkerPool() { Stop(); }
+
+    //Worker count, the calling thread included
+    std::size_t Count() const { return threads.size() + 1; }
+    void Resize(std::size_t cnt);
+    //Runs fn(i) for every worker i and waits for all of them.
+    //Worker 0 is the calling thread
+    void Run(const std::function<void(std::size_t)>& fn);
+};
+
+/* Gray sets of the parallel collector. Each worker pushes and pops a
+ * private stack, and moves half of it to its shared deque whenever
+ * that deque ran dry. Workers out of work take their own deque back,
+ * then steal half of another's. The deques are Chase-Lev: the owner
+ * works the bottom end without locks, thieves claim the top object
+ * with a CAS. Work only ever enters a deque from its owner, so once
+ * every worker is idle every deque is empty and marking is done.
+ */
+template<typename T>
+class WorkStealingQueues
+{
+    static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(std::uintptr_t) == 0);
+    static constexpr std::size_t Words = sizeof(T) / sizeof(std::uintptr_t);
+
+    //Items are kept as atomic words: a thief may read one the owner is
+    //overwriting, and keeps it only if its CAS shows that did not happen
+    struct Ring
+    {
+        std::size_t mask;
+        std::unique_ptr<std::atomic<std::uintptr_t>[]> words;
+
+        explicit Ring(std::size_t capacity)
+            :mask(capacity - 1), words(new std::atomic<std::uintptr_t>[capacity * Words]) {}
+
+        void Put(std::int64_t i, const T& item)
+        {
+            std::uintptr_t w[Words];
+            memcpy(w, &item, sizeof(T));
+            auto slot = &words[(i & mask) * Words];
+            for (std::size_t k = 0; k < Words; k++) slot[k].store(w[k], std::memory_order_relaxed);
+        }
+
+        T Get(std::int64_t i) const
+        {
+            std::uintptr_t w[Words];
+            auto slot = &words[(i & mask) * Words];
+            for (std::size_t k = 0; k < Words; k++) w[k] = slot[k].load(std::memory_order_relaxed);
+            T item;
+            memcpy(&item, w, sizeof(T));
+            return item;
+        }
+    };
+
+    enum class StealResult { Empty, Stolen, Lost };
+
+    struct alignas(64) Deque
+    {
+        std::atomic<std::int64_t> top{ 0 }, bottom{ 0 };
+        std::atomic<Ring*> ring{ nullptr };
+        //Outgrown rings are read by late thieves, freed by Reset
+        std::vector<std::unique_ptr<Ring>> rings;
+
+        //Racy, a hint for thieves
+        std::int64_t Size() const
+        {
+            return std::max<std::int64_t>(bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed), 0);
+        }
+
+        //Owner only
+        void Push(const T& item)
+        {
+            auto b = bottom.load(std::memory_order_relaxed);
+            auto t = top.load(std::memory_order_acquire);
+            auto r = ring.load(std::memory_order_relaxed);
+            if (b - t > (std::int64_t)r->mask)
+            {
+                auto grown = std::make_unique<Ring>((r->mask + 1) * 2);
+                for (auto i = t; i < b; i++) grown->Put(i, r->Get(i));
+                r = grown.get();
+                rings.push_back(std::move(grown));
+                ring.store(r, std::memory_order_release);
+            }
+            r->Put(b, item);
+            bottom.store(b + 1, std::memory_order_release);
+        }
+
+        //Owner only. Bottom is lowered before top is read, so a thief
+        //reading the old bottom reads top before the owner does: both
+        //CAS for the last item, or they take different ones
+        bool Pop(T& item)
+        {
+            auto b = bottom.load(std::memory_order_relaxed) - 1;
+            auto r = ring.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_seq_cst);
+            auto t = top.load(std::memory_order_seq_cst);
+            if (t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+            item = r->Get(b);
+            if (t < b) return true;
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+
+        StealResult Steal(T& item)
+        {
+            auto t = top.load(std::memory_order_seq_cst);
+            auto b = bottom.load(std::memory_order_seq_cst);
+            if (t >= b) return StealResult::Empty;
+            item = ring.load(std::memory_order_acquire)->Get(t);
+            return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) ?
+                StealResult::Stolen : StealResult::Lost;
+        }
+    };
+    std::unique_ptr<Deque[]> shared;
+    std::size_t cnt = 0;
+    std::atomic<std::size_t> idleCnt{ 0 };
+
+    //Moves deque idx to local, all of it for its owner and up to half,
+    //at least one, for a thief
+    bool Take(std::size_t idx, std::vector<T>& local, bool half)
+    {
+        auto& q = shared[idx];
+        if (q.Size() == 0) return false;
+        auto first = local.size();
+        T item;
+        if (!half)
+        {
+            while (q.Pop(item)) local.push_back(item);
+            //Popped newest first, the private stack pops newest last
+            std::reverse(local.begin() + first, local.end());
+            return local.size() != first;
+        }
+        for (auto n = (q.Size() + 1) / 2; (std::int64_t)(local.size() - first) < n;)
+        {
+            auto res = q.Steal(item);
+            if (res == StealResult::Empty) break;
+            if (res == StealResult::Stolen) local.push_back(item);
+        }
+        return local.size() != first;
+    }
+
+public:
+    //Kept on the private stack before sharing starts
+    static constexpr std::size_t MinShared = 16;
+
+    //Between collections only, no worker touches the deques
+    void Reset(std::size_t workerCnt)
+    {
+        if (cnt != workerCnt)
+        {
+            shared = std::make_unique<Deque[]>(workerCnt);
+            cnt = workerCnt;
+        }
+        for (std::size_t i = 0; i < cnt; i++)
+        {
+            auto& q = shared[i];
+            q.top = 0;
+            q.bottom = 0;
+            if (q.rings.empty()) q.rings.push_back(std::make_unique<Ring>(MinShared * 64));
+            //The last ring is the biggest, the rest were outgrown
+            q.rings.erase(q.rings.begin(), q.rings.end() - 1);
+            q.ring = q.rings.back().get();
+        }
+        idleCnt = 0;
+    }
+
+    //Some worker waits for work
+    bool IsStarving() const { return idleCnt.load(std::memory_order_relaxed) != 0; }
+
+    //Shares half of local if queue idx ran dry, by its owner only
+    void Publish(std::size_t idx, std::vector<T>& local)
+    {
+        if (cnt < 2 || local.size() < MinShared * 2) return;
+        auto& q = shared[idx];
+        if (q.Size() != 0) return;
+        auto n = local.size() / 2;
+        for (auto i = local.size() - n; i < local.size(); i++) q.Push(local[i]);
+        local.resize(local.size() - n);
+    }
+
+    //Refills an empty local stack. False once all work is done
+    bool Refill(std::size_t idx, std::vector<T>& local)
+    {
+        for (;;)
+        {
+            if (Take(idx, local, false)) return true;
+            for (std::size_t i = 1; i < cnt; i++)
+            {
+                if (Take((idx + i) % cnt, local, true)) return true;
+            }
+            //Wait until every worker is idle, or there is something
+            //to steal again
+            idleCnt.fetch_add(1);
+            for (;;)
+            {
+                if (idleCnt.load() == cnt) return false;
+                bool found = false;
+                for (std::size_t i = 0; i < cnt && !found; i++)
+                    found = shared[i].Size() != 0;
+                if (found) break;
+                std::this_thread::yield();
+            }
+            idleCnt.fetch_sub(1);
+        }
     }
 };
 
@@ -344,21 +975,252 @@ class GarbageCollector
         std::swap(m1, m2);
     }
 
-    void ProcessManagedFields(std::stack<std::uint8_t*>& workingSet, ValueType* begin, std::size_t cnt);
+    //Dirties the card of slot in heap object holder
+    void RememberSlot(ManagedObjectCtrlBlock* holder, const ValueType* slot)
+    {
+        auto page = HeapPage::Of(holder);
+        auto card = page->cards + (((BytePtr)slot - (BytePtr)page) >> CardShift);
+        if (*card) return;
+        *card = 1;
+        if (page->isRemembered) return;
+        page->isRemembered = true;
+        dirtyPages.push_back(page);
+    }
+
+    /* Heap objects keep marks in their page, the rest in the ctrl block.
+     * Only full marking in one pause marks those, as Visited differing
+     * from unmarkedFlag. Objects allocated outside the heap get the
+     * unmarked value, and once a marking is done the values swap: what
+     * it marked reads unmarked for the next one, what it did not is
+     * garbage that nobody reaches. So no pass clears the marks
+     */
+    std::uint64_t unmarkedFlag = 0;
+    //False if cb was marked already
+    bool MarkObject(ManagedObjectCtrlBlock* cb)
+    {
+        if (!cb->IsInNursery() && !cb->IsFrameLocal()) return MajorHeap::Mark(cb);
+        return cb->TryMark(unmarkedFlag);
+    }
+
+    /* Major GC marking state. Marking runs either in one pause
+     * (SweepMajorHeap), or in slices between mutator steps, or on a
+     * background thread:
+     *   StartMarking   shades the heap objects held by roots
+     *   MarkSlice      scans gray heap objects until a deadline, or
+     *   RunMarker      does so on the marker thread
+     *   TryFinishMarking  right after a minor GC, rescans roots and
+     *                  drains the rest until a deadline. If that is
+     *                  reached marking goes on, else sweeping starts,
+     *                  which SweepSlice finishes later
+     *   FinishMarking  does the same without deadline, running a minor
+     *                  GC unless one just did
+     * Only heap objects are traced, nursery objects move between slices.
+     * Instead every minor GC while marking shades the heap objects held
+     * by the nursery objects it copies. WriteField shades heap objects
+     * stored while marking, and objects put on the heap while marking
+     * are allocated marked and scanned as gray, so nothing reachable is
+     * missed. With the marker thread WriteField also shades the object
+     * it overwrites (snapshot at the beginning), and what the interpreter
+     * shades goes through mutatorGray and sharedGray instead.
+     */
+    struct GrayObject
+    {
+        ManagedObjectCtrlBlock* cb;
+        //First slot left to scan, big arrays are scanned in steps
+        std::size_t begin;
+    };
+    static constexpr std::size_t SlotsPerStep = 256;
+    std::vector<GrayObject> grayStack;
+    bool isMarking = false;
+    //A slice emptied the gray stack. The mutator keeps shading objects,
+    //so what it adds after that is left to FinishMarking
+    bool isGrayDrained = false;
+    //A minor GC ran while marking, and allocManaged when it was done.
+    //Nothing was allocated in the nursery since if they still match
+    bool isNurseryShaded = false;
+    int shadedAllocManaged = 0;
+    //Live heap bytes found by the current marking
+    std::atomic<int> markedBytes{ 0 };
+
+    //The marker thread runs, and owns grayStack
+    bool isConcurrent = false;
+    std::thread marker;
+    std::atomic<bool> stopMarker{ false };
+    //Pages at the start of marking, sorted. The marker only follows
+    //pointers into these, objects on newer pages are marked already
+    std::vector<HeapPage*> markPages;
+    //Shaded by the interpreter thread, handed over in FlushMarkQueue
+    std::vector<GrayObject> mutatorGray;
+    std::mutex grayLock;
+    std::condition_variable grayCv;
+    //Guarded by grayLock
+    std::vector<GrayObject> sharedGray;
+    bool isMarkerIdle = false;
+    //Stress mode, the marker sleeps at random points
+    bool isMarkerStressed = false;
+    std::minstd_rand markerRng;
+
+    //Marks cb and queues it for scanning, on the thread owning grayStack
+    void MarkGray(ManagedObjectCtrlBlock* cb)
+    {
+        if (!MarkObject(cb)) return;
+        if (!cb->IsInNursery() && !cb->IsFrameLocal()) markedBytes.fetch_add(cb->ObjectSize(), std::memory_order_relaxed);
+        if (cb->MayHoldRefs()) grayStack.push_back({ cb, 0 });
+    }
+
+    //Queues heap object cb for scanning, from the interpreter thread
+    void Shade(ManagedObjectCtrlBlock* cb)
+    {
+        if (!MajorHeap::Mark(cb)) return;
+        QueueMarked(cb);
+    }
+    void QueueMarked(ManagedObjectCtrlBlock* cb)
+    {
+        markedBytes.fetch_add(cb->ObjectSize(), std::memory_order_relaxed);
+        (isConcurrent ? mutatorGray : grayStack).push_back({ cb, 0 });
+    }
+
+    //Scans gray heap objects until deadline. checked: slots are read
+    //while the interpreter writes them, only follow valid pointers
+    bool ScanGray(std::chrono::steady_clock::time_point deadline, bool checked);
+    void StartMarker();
+    void RunMarker();
+    void StopMarker();
+    //Starts sweeping once marking is done
+    void EndMarking(const std::vector<ValueType*>& marked);
+
+    /* Stop-the-world collections run on workerCnt threads. Minor GCs
+     * first collect the slots of dirty cards, then copy from the roots
+     * and those slots. Workers claim an object by setting Copying,
+     * copy it into their own buffer in m2, and publish the forwarding
+     * address with Forward. Full marking splits the gray stack the
+     * same way. Work that touches shared state is kept per worker and
+     * applied once they are done: remembered slots, objects shaded for
+     * the major marking, counters. Promotion takes heapLock.
+     *
+     * Copied objects are scanned where they landed, Cheney style: the
+     * ranges of m2 a worker copied into are its work queue, and only
+     * promoted objects go on the gray stack. Ranges are scanned oldest
+     * first, breadth first, or newest first with hierarchicalCopy: the
+     * range being filled is scanned before the others, so children
+     * land within CopyWindowBytes of their parents. Workers gone idle
+     * get objects moved from the ranges to the gray stack to steal.
+     */
+    struct CardRange
+    {
+        ManagedObjectCtrlBlock* holder;
+        ValueType *begin, *end;
+    };
+    struct GCWorker
+    {
+        std::vector<GrayObject> gray;
+        std::vector<CardRange> cardRanges;
+        //Slot and its heap holder, one per card
+        std::vector<std::pair<ManagedObjectCtrlBlock*, ValueType*>> remembered;
+        std::vector<ManagedObjectCtrlBlock*> shaded;
+        //Local allocation buffer in m2
+        BytePtr lab = nullptr;
+        std::size_t labLeft = 0;
+        //Objects copied and not scanned yet, see ScanCopied. Ranges
+        //before firstUnscanned are done
+        std::vector<std::pair<BytePtr, BytePtr>> unscanned;
+        std::size_t firstUnscanned = 0;
+        int copiedBytes = 0, markedBytes = 0;
+    };
+    //Bytes taken from m2 by a worker at once
+    static constexpr std::size_t LabBytes = 32 << 10;
+    //Largest range hierarchicalCopy scans as one, smaller keeps a
+    //parent's children closer to it
+    static constexpr std::size_t CopyWindowBytes = 4 << 10;
+    GCWorkerPool pool;
+    std::vector<GCWorker> workers;
+    WorkStealingQueues<GrayObject> grayQueues;
+    std::mutex heapLock, nurseryLock;
+
+    void PrepareWorkers();
+    //RememberSlot once the workers are done
+    static void RememberLater(GCWorker& w, ManagedObjectCtrlBlock* holder, ValueType* slot)
+    {
+        auto& slots = w.remembered;
+        if (!slots.empty() && ((std::uintptr_t)slots.back().second >> CardShift) == ((std::uintptr_t)slot >> CardShift)) return;
+        slots.push_back({ holder, slot });
+    }
+    //Copies nursery object cb to m2 or the heap and returns the new
+    //payload, or returns where another worker copied it
+    BytePtr Evacuate(GCWorker& w, ManagedObjectCtrlBlock* cb);
+    ManagedObjectCtrlBlock* AllocateInLab(GCWorker& w, std::size_t size);
+    void ScavengeSlot(GCWorker& w, ValueType& v, ManagedObjectCtrlBlock* holder);
+    void Scavenge(GCWorker& w, std::size_t idx);
+    //Scans the next copied object of w, false once there is none
+    bool ScanCopied(GCWorker& w);
+    //Fills what is left of the buffer with a dead raw object, so the
+    //block stays walkable
+    void RetireLab(GCWorker& w);
+
+    //Scans gray objects to completion on every worker. followNursery:
+    //trace nursery objects as well and rebuild the cards
+    void DrainGrayStack(bool followNursery);
+    void DrainGray(GCWorker& w, std::size_t idx, bool followNursery);
+
+    //Slides heap objects together after a full GC, and rewrites every
+    //reference to them: roots, heap slots and nursery slots
+    void CompactHeap(const std::vector<ValueType*>& marked);
+    bool ShouldCompact() const;
+
+    //scanned: the caller traces the payload itself while marking, as
+    //minor GCs do with what they promote, instead of queuing it gray
+    ManagedObjectCtrlBlock* AllocateOnHeap(std::size_t size, bool scanned = false);
+    ManagedObjectCtrlBlock* AllocateRawBlock(std::size_t size, bool pinned = false, bool young = false);
+    //Kinds with a dtor put the new object on the finalizable list of
+    //its space
+    void SetKind(ManagedObjectCtrlBlock* cb, std::uint8_t kind);
+    //Goes to the large object space, see largeObjectBytes. Young ones
+    //only when they do not fit a nursery block
+    bool IsLargeObject(std::size_t size, bool young = false) const
+    {
+        return size + MOCtrlBlkSize >= (young ? m1->blockSizeInBytes : std::min(largeObjectBytes, m1->blockSizeInBytes));
+    }
+
+    //Bump window of TryBumpAllocate. Closed, it is an empty block that
+    //nothing fits in, so the fast path has a single compare
+    ManagedMemCtrlBlock closedBlk{};
+    ManagedMemCtrlBlock* fastBlk = &closedBlk;
+    std::size_t fastEnd = 0;
     
 
 public:
-    std::unordered_set<ValueType*> backwardRefs;
+    //Heap pages with dirty cards, each listed once
+    std::vector<HeapPage*> dirtyPages;
     //An object is considered mature after 4 GCs
     int matureGen = 4;
+    //Threads of stop-the-world collections, this one included
+    std::size_t workerCnt = 1;
+    //Compact after a full GC when that would empty more than this
+    //share of the small object pages, 0 never compacts
+    double compactRatio = 0.25;
+    //Copy order of minor GCs, children next to their parents instead of
+    //breadth first, see GCWorker
+    bool hierarchicalCopy = true;
+    /* Large object space: objects of at least this many bytes, ctrl
+     * block included, skip the nursery and are never copied. They are
+     * heap objects, on pages of their own past the largest cell size,
+     * mark-swept with the rest and scanned by minor GCs through their
+     * dirty cards only. Nursery blocks hold nothing bigger than
+     * themselves either way
+     */
+    std::size_t largeObjectBytes = 128 << 10;
 
     int allocManaged = 0, allocMajorHeap = 0;
+    std::uint32_t lastIdentityHash = 0;
 
     GarbageCollector()
         :m1(std::make_unique<ManagedNursery>())
         ,m2(std::make_unique<ManagedNursery>())
     {}
-    ~GarbageCollector(){}
+    ~GarbageCollector()
+    {
+        if (isConcurrent) StopMarker();
+    }
 
     //Only mark those in nursery
     void SweepManaged(const std::vector<ValueType*>& marked);
@@ -366,18 +1228,122 @@ public:
     //full sweep, also reconstruct backward list
     void SweepMajorHeap(const std::vector<ValueType*>& marked);
 
-    ValueType* AllocateRawObject(std::size_t fieldCnt);
+    //Incremental and concurrent major GC, see GrayObject
+    bool IsMarking() const { return isMarking; }
+    bool IsConcurrent() const { return isConcurrent; }
+    bool IsGrayDrained();
+    //FinishMarking can skip its minor GC
+    bool IsNurseryShaded() const { return isNurseryShaded && allocManaged == shadedAllocManaged; }
+    //concurrent: mark on a background thread, stressed: which sleeps
+    //at random points, to shake out races
+    void StartMarking(const std::vector<ValueType*>& marked, bool concurrent = false, bool stressed = false);
+    //Returns true once no gray object is left
+    bool MarkSlice(std::chrono::steady_clock::time_point deadline);
+    //Hands what the interpreter shaded to the marker thread. Objects
+    //allocated since are filled in by now
+    void FlushMarkQueue();
+    //Only right after a minor GC, see IsNurseryShaded. False if the
+    //deadline came first, the marker thread is restarted then
+    bool TryFinishMarking(const std::vector<ValueType*>& marked, std::chrono::steady_clock::time_point deadline);
+    void FinishMarking(const std::vector<ValueType*>& marked);
+
+    //Lazy sweeping after marking, see MajorHeap. Sweeps until deadline,
+    //true once done and the pages left empty are released as well
+    bool IsSweeping() const { return heap.IsSweeping(); }
+    bool SweepSlice(std::chrono::steady_clock::time_point deadline);
+
+    //Filled in by the interpreter, which times the pauses
+    PauseStats markSliceStats, finalPauseStats, sweepSliceStats;
+    //Marking cycles finished by FinishMarking in one pause, because the
+    //mutator outran them
+    std::size_t markOutrunCnt = 0;
+    //Time spent compacting, part of the final pauses
+    PauseStats compactStats;
+    std::size_t compactMovedBytes = 0, compactFreedBytes = 0;
+
+    //young: the caller knows the object dies soon, it is kept in the
+    //nursery past largeObjectBytes. Pointless to copy it later, and as
+    //a heap object it would keep what it refers to alive until the
+    //next full GC
+    ValueType* AllocateRawObject(std::size_t fieldCnt, std::uint8_t kind = ManagedObjectCtrlBlock::RawKind, bool young = false);
+
+    /* Allocation fast path of the interpreter: a bump of the current
+     * nursery block and one compare against the end of the window. The
+     * window is opened by the interpreter for as many bytes as may be
+     * allocated before its next GC check is due, and closed by anything
+     * that invalidates it: collections, marking and heap allocations.
+     * Nothing but the block is refilled, the slow path does that
+     */
+    void OpenFastPath(std::size_t budget)
+    {
+        if (m1->inUseBlkCnt == 0) return;
+        fastBlk = m1->blks[m1->inUseBlkCnt - 1];
+        fastEnd = std::min(fastBlk->totalBytes, fastBlk->usedBytes + budget);
+    }
+    void CloseFastPath()
+    {
+        fastBlk = &closedBlk;
+        fastEnd = 0;
+    }
+    //nullptr once the window is used up, and for large objects. Not
+    //for kinds with a dtor
+    ManagedObjectCtrlBlock* TryBumpAllocate(std::size_t size, std::uint8_t kind = ManagedObjectCtrlBlock::RawKind)
+    {
+        assert(ManagedObjectCtrlBlock::descriptors[kind].dtor == nullptr);
+        auto totalSize = size + MOCtrlBlkSize;
+        auto used = fastBlk->usedBytes;
+        if (used + totalSize > fastEnd || totalSize >= largeObjectBytes) return nullptr;
+        fastBlk->usedBytes = used + totalSize;
+        fastBlk->objectCnt++;
+        allocManaged += (int)size;
+        return ManagedObjectCtrlBlock::EmplaceRaw((BytePtr)fastBlk + MBCtrlBlkSize + used, size, m1->newFlags, kind);
+    }
+
+    //Flags of objects put in call frames, see MarkObject
+    std::uint64_t FrameLocalFlags() const { return ManagedObjectCtrlBlock::FrameLocal | unmarkedFlag; }
+
+    //Untyped payload never scanned by GC, for packed host data.
+    //Pinned blobs go to the heap directly and never move. kind: a host
+    //kind whose dtor releases what the payload holds. young: as for
+    //AllocateRawObject
+    BytePtr AllocateBlob(std::size_t size, bool pinned = false, std::uint8_t kind = ManagedObjectCtrlBlock::BlobKind, bool young = false);
 
     template<typename T, typename ...ArgTypes>
     T* AllocateObject(ArgTypes... args)
     {
+        if (IsLargeObject(AlignObjSize(sizeof(T))))
+        {
+            CloseFastPath();
+            auto blk = AllocateOnHeap(AlignObjSize(sizeof(T)));
+            new(GetPayload(blk))T(args...);
+            SetKind(blk, ManagedObjectCtrlBlock::KindOf<T>());
+            return (T*)GetPayload(blk);
+        }
         auto blk = m1->Allocate<T, ArgTypes...>(args...);
         auto payload = GetPayload(blk);
-        allocManaged += blk->objectSize;
+        allocManaged += blk->ObjectSize();
         return (T*)payload;
     }
 
-    bool WriteField(const ValueType& src, const ValueType& dst, std::size_t idx);
+    //retype: dynamically typed slots (RefArray elements) take the
+    //type of the stored value as well
+    bool WriteField(const ValueType& src, const ValueType& dst, std::size_t idx, bool retype = false);
+
+    //Stable across moves, for hashing objects by identity
+    std::uint32_t IdentityHash(void* obj)
+    {
+        auto cb = GetCtrlBlk(obj);
+        auto hash = cb->IdentityHash();
+        if (hash == 0)
+        {
+            //Weyl sequence, top 21 bits fit the header. Spread by the user
+            do lastIdentityHash += 0x9E3779B9u;
+            while ((lastIdentityHash >> 11) == 0);
+            hash = lastIdentityHash >> 11;
+            cb->SetIdentityHash(hash);
+        }
+        return hash;
+    }
 
     std::string PrintAllocStat();
 };
@@ -72,12 +72,68 @@ struct IndicesForSignature<ResultType(C::*)(ArgTypes...) const> {
 
 };
 
+//Stack slots taken by a host argument. ArgCvt of value type structs
+//declares Slots and converts with FromSlots/ToSlots instead
+template<typename T, typename Enable = void>
+struct ArgSlots
+{
+	static const std::size_t value = 1;
+};
+
 template<typename T>
-void ReturnHostVal(T result, Interpreter* intp)
+struct ArgSlots<T, std::void_t<decltype(ArgCvt<T>::Slots)>>
+{
+	static const std::size_t value = ArgCvt<T>::Slots;
+};
+
+template<>
+struct ArgSlots<void>
+{
+	static const std::size_t value = 0;
+};
+
+//Slot offsets from stack top, first arg sits on top
+template<typename... ArgTypes>
+struct ArgLayout
+{
+	static constexpr std::size_t slots[] = { ArgSlots<std::remove_reference_t<ArgTypes>>::value..., 0 };
+
+	static constexpr std::size_t Offset(std::size_t index)
+	{
+		std::size_t off = 0;
+		for (std::size_t i = 0; i < index; i++) off += slots[i];
+		return off;
+	}
+
+	static const std::size_t Total = Offset(sizeof...(ArgTypes));
+};
+
+template<typename T, typename std::enable_if<ArgSlots<T>::value == 1, int>::type = 0>
+decltype(auto) FetchHostArg(ValueType* last)
+{
+	return ArgCvt<T>::FromVal(*last);
+}
+
+template<typename T, typename std::enable_if<(ArgSlots<T>::value > 1), int>::type = 0>
+decltype(auto) FetchHostArg(ValueType* last)
+{
+	return ArgCvt<T>::FromSlots(last - ArgSlots<T>::value + 1);
+}
+
+template<typename T>
+typename std::enable_if<ArgSlots<T>::value == 1>::type
+ReturnHostVal(T result, Interpreter* intp)
 {
     intp->valueStack.back() = ArgCvt<T>::ToVal(result, intp);
 }
 
+template<typename T>
+typename std::enable_if<(ArgSlots<T>::value > 1)>::type
+ReturnHostVal(T result, Interpreter* intp)
+{
+    ArgCvt<T>::ToSlots(result, intp, &intp->valueStack.back() - ArgSlots<T>::value + 1);
+}
+
 template <typename IndicesType, typename T>
 class ArgDispatcher {};
 
@@ -88,21 +144,22 @@ struct ArgDispatcher<IndicesHolder<indices...>, ResultType(*)(ArgTypes...)>
 {
 	using FunctionPtr = ResultType(*)(ArgTypes...);
 	static const size_t ArgCount = sizeof...(ArgTypes);
+	using Layout = ArgLayout<ArgTypes...>;
 	static const bool HasReturn = true;
 	static std::vector<std::string> ArgTypeNames() { return GetArgTypeNames<ArgTypes...>(); }
 	static std::string RetTypeName() { return ArgCvt<ResultType>::GetName(); }
 	static const bool IsStatic = true;
 
 	static void Dispatch(FunctionPtr func, Interpreter* intp){
-		static const std::size_t argCnt = sizeof...(indices);
+		static const std::size_t argCnt = Layout::Total;
 		//Move into template arg expansion for safer operation on empty stack
 	    //auto* idx0 = &intp->valueStack.back();
 		ResultType result = (*func)(
-		    ArgCvt<std::remove_reference_t<ArgTypes>>::FromVal(
-		    *(&intp->valueStack.back() - indices))...
+		    FetchHostArg<std::remove_reference_t<ArgTypes>>(
+		    &intp->valueStack.back() - Layout::Offset(indices))...
 		);
 		auto stackSize = intp->valueStack.size();
-		intp->valueStack.resize(stackSize - argCnt + 1);
+		intp->valueStack.resize(stackSize - argCnt + ArgSlots<ResultType>::value);
 		ReturnHostVal<ResultType>(result, intp);
 	}
 };
@@ -115,15 +172,16 @@ struct ArgDispatcher<IndicesHolder<indices...>, void (*)(ArgTypes...)>
 	using FunctionPtr = void (*)(ArgTypes...);
 
 	static const size_t ArgCount = sizeof...(ArgTypes);
+	using Layout = ArgLayout<ArgTypes...>;
 	static const bool HasReturn = false;
 	static std::vector<std::string> ArgTypeNames() { return GetArgTypeNames<ArgTypes...>(); }
 	static const bool IsStatic = true;
 
 	static void Dispatch(FunctionPtr func, Interpreter* intp){
-		static const std::size_t argCnt = sizeof...(indices);
+		static const std::size_t argCnt = Layout::Total;
 		//auto* idx0 = &intp->valueStack.back();
-		(*func)(ArgCvt<std::remove_reference_t<ArgTypes>>::FromVal(
-			*(&intp->valueStack.back() - indices))...
+		(*func)(FetchHostArg<std::remove_reference_t<ArgTypes>>(
+			&intp->valueStack.back() - Layout::Offset(indices))...
 		);
 		auto stackSize = intp->valueStack.size();
 		intp->valueStack.resize(stackSize - argCnt);
@@ -138,17 +196,18 @@ struct ArgDispatcher<IndicesHolder<indices...>, void(C::*)(ArgTypes...)>
 {
 	using FunctionPtr = void(C::*)(ArgTypes...);
 	static const size_t ArgCount = sizeof...(ArgTypes);
+	using Layout = ArgLayout<ArgTypes...>;
 	static const bool HasReturn = false;
 	static std::vector<std::string> ArgTypeNames() { return GetArgTypeNames<ArgTypes...>(); }
 	static const bool IsStatic = false;
 
 
 	static void Dispatch(FunctionPtr func, Interpreter* intp) {
-		static const std::size_t argCnt = sizeof...(indices);
+		static const std::size_t argCnt = Layout::Total;
 		//auto* idx0 = &intp->valueStack.back();
 		C* thisPtr = (C*)intp->callStack.back().currEnv.data.obj;
-		(thisPtr->*func)(ArgCvt<std::remove_reference_t<ArgTypes>>::FromVal(
-			*(&intp->valueStack.back() - indices))...
+		(thisPtr->*func)(FetchHostArg<std::remove_reference_t<ArgTypes>>(
+			&intp->valueStack.back() - Layout::Offset(indices))...
 		);
 		auto stackSize = intp->valueStack.size();
 		intp->valueStack.resize(stackSize - argCnt);
@@ -161,6 +220,7 @@ struct ArgDispatcher<IndicesHolder<indices...>, ResultType(C::*)(ArgTypes...)>
 {
 	using FunctionPtr = ResultType(C::*)(ArgTypes...);
 	static const size_t ArgCount = sizeof...(ArgTypes);
+	using Layout = ArgLayout<ArgTypes...>;
 	static const bool HasReturn = true;
 	static std::vector<std::string> ArgTypeNames() { return GetArgTypeNames<ArgTypes...>(); }
 	static std::string RetTypeName(){ return ArgCvt<ResultType>::GetName();}
@@ -168,14 +228,14 @@ struct ArgDispatcher<IndicesHolder<indices...>, ResultType(C::*)(ArgTypes...)>
 
 	static void Dispatch(FunctionPtr func, Interpreter* intp) {
 
-		static const std::size_t argCnt = sizeof...(indices);
+		static const std::size_t argCnt = Layout::Total;
 		//auto* idx0 = &intp->valueStack.back();
 		C* thisPtr = (C*)intp->callStack.back().currEnv.data.obj;
-		ResultType result = (thisPtr->*func)(ArgCvt<std::remove_reference_t<ArgTypes>>::FromVal(
-			*(&intp->valueStack.back() - indices))...
+		ResultType result = (thisPtr->*func)(FetchHostArg<std::remove_reference_t<ArgTypes>>(
+			&intp->valueStack.back() - Layout::Offset(indices))...
 		);
 		auto stackSize = intp->valueStack.size();
-		intp->valueStack.resize(stackSize - argCnt + 1);
+		intp->valueStack.resize(stackSize - argCnt + ArgSlots<ResultType>::value);
 		ReturnHostVal<ResultType>(result, intp);
 	}
 };
@@ -90,7 +90,7 @@ void CallOpBase(Interpreter* intp, MethodBlock* fn, const ValueType& thisHndl)
     //we need this pointer and fn desc
 
     //Use the same block for arg and rets to avoid memcpy
-    int argCnt = fn->args.size();
+    int argCnt = fn->argSlots;
     //int retCnt = fn->rets.size();
     //int exchangeBlkSize = std::max(argCnt, retCnt);
 
@@ -100,9 +100,15 @@ void CallOpBase(Interpreter* intp, MethodBlock* fn, const ValueType& thisHndl)
     //auto tgtStackSize = currSP + exchangeBlkSize;
     //intp->valueStack.resize(tgtStackSize);
 
+    BytePtr locals = nullptr;
+    if (fn->localBytes > 0)
+    {
+        locals = intp->frameLocals.Push(fn->localBytes);
+    }
+
     //Don't pop to retain the closure handle for keeping object alive
     //And record stack position - 1 to automatically delete closure handle
-    intp->callStack.emplace_back(currSP, intp->ip, thisHndl, fn);
+    intp->callStack.emplace_back(currSP, intp->ip, thisHndl, fn, locals);
 
     //Copy arg value
     //+----------- <- sp
@@ -135,6 +141,8 @@ void Interpreter::Call(MethodBlock* fn, const ValueType& env)
 
     ip = dummyBody;
     status = ExecutionStatus::Running;
+    //A sunk host call re-entering, the slot is for its own result
+    sinkSlot = nullptr;
     CallOpBase(this, fn, env);
     while (ip != dummyBody)
     {
@@ -148,6 +156,166 @@ void Interpreter::Call(MethodBlock* fn, const ValueType& env)
     ip = currIP;
 }
 
+static ValueType NewHostPrimArray(Interpreter* intp,
+    const char* arrName, const char* elemName, const void* data, std::size_t length)
+{
+    auto arrTy = intp->libLoader.LookupType(arrName);
+    auto elemTy = intp->libLoader.LookupType(elemName);
+    if (arrTy == nullptr || elemTy == nullptr)
+    {
+        intp->ReportError(std::string("Array type not loaded: ") + arrName);
+        return ValueType();
+    }
+
+    auto arr = intp->NewPrimArray(arrTy, elemTy, (std::uint32_t)length);
+    memcpy(((ArrayHeader*)arr.data.obj)->Elements<std::int32_t>(), data, length * sizeof(std::int32_t));
+    return arr;
+}
+
+ValueType Interpreter::NewRefTypeObjectSlow(TypeTable* ty)
+{
+    //TODO: run scheduled GC tasks
+    NotifyGC();
+
+    if (ty == nullptr) return nullptr;
+    if (!ty->hasPrototype)
+    {
+        if (ty->IsPacked())
+        {
+            //Zero filled blob, as NewPackedObject makes them
+            ty->prototype.assign(AlignObjSize(ty->packedSize), 0);
+        }
+        else
+        {
+            ty->prototype.resize(ty->fields.size() * sizeof(ValueType));
+            std::uninitialized_copy(ty->fields.begin(), ty->fields.end(), (ValueType*)ty->prototype.data());
+        }
+        ty->objKind = ty->IsPacked() ? ManagedObjectCtrlBlock::BlobKind
+            : !ty->hasRefMap ? ManagedObjectCtrlBlock::RawKind
+            : ty->isLeaf ? ManagedObjectCtrlBlock::LeafKind : ManagedObjectCtrlBlock::TypedKind;
+        ty->hasPrototype = true;
+    }
+
+    ValueType hndl;
+    if (ty->IsPacked()) hndl = NewPackedObject(ty);
+    else
+    {
+        auto inst = gc.AllocateRawObject(ty->fields.size(), ty->objKind);
+        auto cb = GetCtrlBlk(inst);
+        cb->vptr = ty;
+        std::copy_n((const ValueType*)ty->prototype.data(), ty->fields.size(), inst);
+        hndl = ValueType(ty);
+        hndl.data.obj = inst;
+    }
+
+    OpenFastPath();
+    return hndl;
+}
+
+ValueType Interpreter::NewIntArray(const std::int32_t* data, std::size_t length)
+{
+    return NewHostPrimArray(this, "Arr|IntArray", "Num|Int", data, length);
+}
+
+ValueType Interpreter::NewFloatArray(const float* data, std::size_t length)
+{
+    return NewHostPrimArray(this, "Arr|FloatArray", "Num|Float", data, length);
+}
+
+ValueType Interpreter::NewTable(TypeTable* rowType, std::uint32_t capacity)
+{
+    auto ty = TableType();
+    if (ty == nullptr)
+    {
+        ReportError("Table library not loaded");
+        return ValueType();
+    }
+    if (rowType == nullptr || !rowType->isColumnar)
+    {
+        ReportError("Table rows need a columnar type");
+        return ValueType();
+    }
+
+    valueStack.push_back(NewRefTypeObject(ty));
+    ((ValueType*)valueStack.back().data.obj)[TableRow] = ValueType(rowType);
+    ReserveTableRows(valueStack.size() - 1, capacity);
+    auto table = valueStack.back();
+    valueStack.pop_back();
+    return table;
+}
+
+void Interpreter::ReserveTableRows(std::size_t tableIdx, std::uint32_t capacity)
+{
+    auto rowType = ((ValueType*)valueStack[tableIdx].data.obj)[TableRow].type;
+    //Both blocks are rooted on the stack until the table holds them
+    valueStack.push_back(NewPrimArray(libLoader.LookupType("Arr|IntArray"),
+        libLoader.LookupType("Num|Int"), rowType->primColumns * capacity));
+    valueStack.push_back(NewRefArray(libLoader.LookupType("Arr|RefArray"),
+        rowType->refColumns * capacity));
+
+    auto& table = valueStack[tableIdx];
+    auto fields = (ValueType*)table.data.obj;
+    auto& prims = *(valueStack.end() - 2);
+    auto& refs = valueStack.back();
+    auto count = (std::uint32_t)fields[TableCount].data.value;
+    auto oldCap = (std::uint32_t)fields[TableCapacity].data.value;
+    assert(count <= capacity);
+
+    auto newPrims = ((ArrayHeader*)prims.data.obj)->Elements<std::int32_t>();
+    for (std::uint32_t c = 0; c < rowType->primColumns && count > 0; c++)
+    {
+        auto oldPrims = ((ArrayHeader*)fields[TablePrims].data.obj)->Elements<std::int32_t>();
+        memcpy(newPrims + c * capacity, oldPrims + c * oldCap, count * sizeof(std::int32_t));
+    }
+    //Unused rows hold typed nulls, same as fresh object fields. Stores
+    //go through WriteField, a big ref block may be allocated old
+    for (std::size_t slot = 0; slot < rowType->columns.size(); slot++)
+    {
+        auto col = rowType->columns[slot];
+        if (!(col & TypeTable::ColumnRef)) continue;
+        col &= ~TypeTable::ColumnRef;
+        auto oldRefs = count > 0 ? (ValueType*)fields[TableRefs].data.obj + col * oldCap : nullptr;
+        for (std::uint32_t r = 0; r < capacity; r++)
+        {
+            gc.WriteField(r < count ? oldRefs[r] : ValueType(rowType->fields[slot]),
+                refs, col * capacity + r, true);
+        }
+    }
+
+    gc.WriteField(prims, table, TablePrims, true);
+    gc.WriteField(refs, table, TableRefs, true);
+    fields[TableCapacity].data.value = capacity;
+    valueStack.erase(valueStack.end() - 2, valueStack.end());
+}
+
+bool Interpreter::LocateTableCell(const ValueType& table, std::int32_t row,
+    std::uint32_t slot, TypeTable* owner, std::uint32_t& cell)
+{
+    if (table.IsNull() || table.type != TableType())
+    {
+        ReportError("Table expected");
+        return false;
+    }
+    auto fields = (ValueType*)table.data.obj;
+    auto rowType = fields[TableRow].type;
+    //Derived row types lay their parents' fields out first
+    auto ty = rowType;
+    while (ty != nullptr && ty != owner) ty = ty->parentType;
+    if (ty == nullptr)
+    {
+        ReportError("Table of " + rowType->name + " has no rows of " + owner->name);
+        return false;
+    }
+    if (row < 0 || row >= fields[TableCount].data.value)
+    {
+        ReportError("Table row out of range: " + std::to_string(row));
+        return false;
+    }
+    auto col = rowType->columns[slot] & ~TypeTable::ColumnRef;
+    cell = col * (std::uint32_t)fields[TableCapacity].data.value + row;
+    return true;
+}
+
 void Interpreter::Op_RET(Interpreter* intp)
 {
     if (intp->callStack.empty())
@@ -160,7 +328,7 @@ void Interpreter::Op_RET(Interpreter* intp)
     auto& frame = intp->callStack.back();
 
     MethodBlock* fn = frame.currentFn;
-    int retCnt = fn->rets.size();
+    int retCnt = fn->retSlots;
 
     //int dst = frame.sp;
     //int src = intp->valueStack.size() - retCnt;
@@ -168,6 +336,13 @@ void Interpreter::Op_RET(Interpreter* intp)
     int stackTgtSize = frame.sp + retCnt;
     intp->valueStack.resize(stackTgtSize);
 
+    //Sunk objects die with the frame
+    if (frame.locals != nullptr)
+    {
+        intp->frameLocals.Pop(fn->localBytes);
+    }
+    intp->sinkSlot = nullptr;
+
     //if (src < dst)
     //{
     //    //stack count error! the function pop too much!
@@ -259,13 +434,48 @@ void Interpreter::Op_NEW(Interpreter* intp)
         auto newHndl = intp->NewRefTypeObject(ty);
         intp->valueStack.push_back(newHndl);
 
-    }else
+    }else if(ty->fields.empty())
     {
         intp->valueStack.emplace_back(ty);
+    }else
+    {
+        //Value type struct, one slot per field
+        for(auto fdType : ty->fields)
+        {
+            intp->valueStack.emplace_back(fdType);
+        }
     }
     //Add closure reference to stack
 }
 
+void Interpreter::_op_newlocal(Interpreter* intp)
+{
+    auto ty = (TypeTable*)(intp->ip++)->inst;
+    auto offset = (intp->ip++)->u;
+    auto slot = intp->callStack.back().locals + offset;
+    intp->valueStack.push_back(intp->NewFrameLocalObject(ty, slot));
+}
+
+void Interpreter::_op_sinknext(Interpreter* intp)
+{
+    auto ty = (TypeTable*)(intp->ip++)->inst;
+    auto offset = (intp->ip++)->u;
+    intp->sinkSlot = intp->callStack.back().locals + offset;
+    intp->sinkType = ty;
+}
+
+void Interpreter::_op_sinkembed(Interpreter* intp)
+{
+    auto ty = (TypeTable*)(intp->ip++)->inst;
+    auto offset = (intp->ip++)->u;
+    auto fn = (InstFn)(intp->ip++)->inst;
+    intp->sinkSlot = intp->callStack.back().locals + offset;
+    intp->sinkType = ty;
+    (*fn)(intp);
+    //Unused if fn allocated nothing, and must not reach a later one
+    intp->sinkSlot = nullptr;
+}
+
 void Interpreter::_op_ldfn(Interpreter* intp)
 {
     ENSURE_ARG_NUM(intp, 1);
@@ -381,6 +591,248 @@ void Interpreter::_op_stmem(Interpreter* intp)
 
 }
 
+void Interpreter::_op_ldmemn(Interpreter* intp)
+{
+    ENSURE_ARG_NUM(intp, 1);
+
+    auto memIdx = (intp->ip++)->u;
+    auto width = (intp->ip++)->u;
+    auto thisObj = intp->valueStack.back();
+
+    if (!thisObj.type->IsReferenceType())
+    {
+        intp->ReportError("Accessing member from non-reference type");
+        return;
+    }
+
+    auto thisInst = (ValueType*)thisObj.data.obj;
+
+    if(thisInst == nullptr)
+    {
+        intp->ReportError("Accessing member from null reference");
+        return;
+    }
+
+    intp->valueStack.pop_back();
+    intp->valueStack.insert(
+        intp->valueStack.end(),
+        thisInst + memIdx,
+        thisInst + memIdx + width
+    );
+}
+
+void Interpreter::_op_stmemn(Interpreter* intp)
+{
+    auto memIdx = (intp->ip++)->u;
+    auto width = (intp->ip++)->u;
+    ENSURE_ARG_NUM(intp, width + 1);
+    auto& thisObj = intp->valueStack.back();
+    auto vals = intp->valueStack.end() - 1 - width;
+
+    for(std::uint32_t i = 0; i < width; i++)
+    {
+        if(!intp->gc.WriteField(vals[i], thisObj, memIdx + i))
+        {
+            intp->ReportError("Writing to invalid member:"
+                + thisObj.type->name + "." + std::to_string(memIdx + i)); return;
+        }
+    }
+
+    intp->valueStack.erase(vals, intp->valueStack.end());
+}
+
+void Interpreter::_op_ldlane(Interpreter* intp)
+{
+    ENSURE_ARG_NUM(intp, 1);
+
+    auto lane = (intp->ip++)->u;
+    auto& thisObj = intp->valueStack.back();
+
+    auto payload = (std::int32_t*)thisObj.data.obj;
+    if (payload == nullptr || !thisObj.type->IsReferenceType())
+    {
+        intp->ReportError("Accessing member from null reference");
+        return;
+    }
+
+    ValueType val(thisObj.type->fields[lane]);
+    val.data.value = payload[lane];
+    thisObj = val;
+}
+
+void Interpreter::_op_stlane(Interpreter* intp)
+{
+    ENSURE_ARG_NUM(intp, 2);
+
+    auto lane = (intp->ip++)->u;
+    auto& thisObj = intp->valueStack.back();
+    auto& val = *(intp->valueStack.end() - 2);
+
+    auto payload = (std::int32_t*)thisObj.data.obj;
+    if (payload == nullptr || !thisObj.type->IsReferenceType())
+    {
+        intp->ReportError("Writing to invalid member:"
+            + thisObj.type->name + "." + std::to_string(lane)); return;
+    }
+
+    //Lanes only hold plain 32bit values, no write barrier needed
+    payload[lane] = val.data.value;
+
+    intp->valueStack.pop_back();
+    intp->valueStack.pop_back();
+}
+
+void Interpreter::_op_ldcol(Interpreter* intp)
+{
+    ENSURE_ARG_NUM(intp, 2);
+
+    auto slot = (intp->ip++)->u;
+    auto owner = (TypeTable*)(intp->ip++)->inst;
+    auto last = intp->valueStack.end() - 1;
+    auto& table = *(last - 1);
+
+    std::uint32_t cell;
+    if (!intp->LocateTableCell(table, last->data.value, slot, owner, cell)) return;
+
+    auto fields = (ValueType*)table.data.obj;
+    auto rowType = fields[TableRow].type;
+    ValueType val;
+    if (rowType->columns[slot] & TypeTable::ColumnRef)
+    {
+        val = ((ValueType*)fields[TableRefs].data.obj)[cell];
+    }
+    else
+    {
+        val = ValueType(rowType->fields[slot]);
+        val.data.value = ((ArrayHeader*)fields[TablePrims].data.obj)->Elements<std::int32_t>()[cell];
+    }
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = val;
+}
+
+void Interpreter::_op_stcol(Interpreter* intp)
+{
+    ENSURE_ARG_NUM(intp, 3);
+
+    auto slot = (intp->ip++)->u;
+    auto owner = (TypeTable*)(intp->ip++)->inst;
+    auto last = intp->valueStack.end() - 1;
+    auto& table = *(last - 1);
+    auto& val = *(last - 2);
+
+    std::uint32_t cell;
+    if (!intp->LocateTableCell(table, last->data.value, slot, owner, cell)) return;
+
+    auto fields = (ValueType*)table.data.obj;
+    if (fields[TableRow].type->columns[slot] & TypeTable::ColumnRef)
+    {
+        intp->gc.WriteField(val, fields[TableRefs], cell, true);
+    }
+    else
+    {
+        //Plain 32bit values, no write barrier needed
+        ((ArrayHeader*)fields[TablePrims].data.obj)->Elements<std::int32_t>()[cell] = val.data.value;
+    }
+    intp->valueStack.erase(last - 2, intp->valueStack.end());
+}
+
+//Resolve array operand, reports and returns false on mismatch
+static bool CheckArrayIndex(Interpreter* intp, ValueType& arr, std::int32_t idx)
+{
+    if (arr.IsNull() || !arr.type->isArray)
+    {
+        intp->ReportError("Array expected");
+        return false;
+    }
+    if ((std::uint32_t)idx >= Interpreter::ArrayLength(arr))
+    {
+        intp->ReportError("Array index out of range: " + std::to_string(idx));
+        return false;
+    }
+    return true;
+}
+
+void Interpreter::Op_LDLEN(Interpreter* intp)
+{
+    ENSURE_ARG_NUM(intp, 1);
+    auto& arr = intp->valueStack.back();
+    if (arr.IsNull() || !arr.type->isArray)
+    {
+        intp->ReportError("Array expected");
+        return;
+    }
+
+    ValueType len(&_intpObjInfo);
+    len.data.value = ArrayLength(arr);
+    arr = len;
+}
+
+void Interpreter::Op_LDELEM(Interpreter* intp)
+{
+    ENSURE_ARG_NUM(intp, 2);
+    auto& arr = *(intp->valueStack.end() - 2);
+    auto idx = intp->valueStack.back().data.value;
+    if (!CheckArrayIndex(intp, arr, idx)) return;
+
+    if (GetCtrlBlk(arr.data.obj)->IsRaw())
+    {
+        arr = ((ValueType*)arr.data.obj)[idx];
+    }
+    else
+    {
+        auto header = (ArrayHeader*)arr.data.obj;
+        ValueType val(header->elemType);
+        val.data.value = header->Elements<std::int32_t>()[idx];
+        arr = val;
+    }
+    intp->valueStack.pop_back();
+}
+
+void Interpreter::Op_STELEM(Interpreter* intp)
+{
+    ENSURE_ARG_NUM(intp, 3);
+    auto& val = *(intp->valueStack.end() - 3);
+    auto& arr = *(intp->valueStack.end() - 2);
+    auto idx = intp->valueStack.back().data.value;
+    if (!CheckArrayIndex(intp, arr, idx)) return;
+
+    if (GetCtrlBlk(arr.data.obj)->IsRaw())
+    {
+        //Elements keep the type of the stored value
+        intp->gc.WriteField(val, arr, idx, true);
+    }
+    else
+    {
+        //32bit payload, nothing to trace
+        auto header = (ArrayHeader*)arr.data.obj;
+        if (!IsElementOf(val, header))
+        {
+            intp->ReportError("Array element type mismatch: "
+                + (val.type ? val.type->name : "null") + " != " + header->elemType->name);
+            return;
+        }
+        header->Elements<std::int32_t>()[idx] = val.data.value;
+    }
+    intp->valueStack.erase(intp->valueStack.end() - 3, intp->valueStack.end());
+}
+
+void Interpreter::Op_LDSTR(Interpreter* intp)
+{
+    auto text = (const std::string*)(intp->ip++)->inst;
+    auto& cache = *(intp->ip++);
+    //Interned payloads are pinned, so the first run patches them in
+    if (cache.inst == nullptr)
+    {
+        auto str = intp->InternStr(*text);
+        if (str.type == nullptr) return;
+        cache.inst = str.data.obj;
+    }
+
+    ValueType str(intp->StrType());
+    str.data.obj = cache.inst;
+    intp->valueStack.push_back(str);
+}
+
 void Interpreter::Op_POP(Interpreter* intp)
 {
     ENSURE_ARG_NUM(intp, 1);
@@ -441,6 +893,50 @@ void Interpreter::_op_ststatic(Interpreter* intp)
 
 }
 
+void Interpreter::_op_ldstaticn(Interpreter* intp)
+{
+    auto ty = (TypeTable*)(intp->ip++)->inst;
+    auto idx = (intp->ip++)->u;
+    auto width = (intp->ip++)->u;
+    auto thisEnv = intp->FindStaticFields(ty);
+
+    if (idx + width > ty->staticFields.size())
+    {
+        intp->ReportError("Env value address out of range");
+        return;
+    }
+
+    auto inst = (ValueType*)(thisEnv.data.obj);
+    intp->valueStack.insert(intp->valueStack.end(), inst + idx, inst + idx + width);
+}
+
+void Interpreter::_op_ststaticn(Interpreter* intp)
+{
+    auto ty = (TypeTable*)(intp->ip++)->inst;
+    auto idx = (intp->ip++)->u;
+    auto width = (intp->ip++)->u;
+    ENSURE_ARG_NUM(intp, width);
+    auto thisEnv = intp->FindStaticFields(ty);
+
+    if (idx + width > ty->staticFields.size())
+    {
+        intp->ReportError("Env value address: " + std::to_string(idx) + " out of range");
+        return;
+    }
+
+    auto vals = intp->valueStack.end() - width;
+    for(std::uint32_t i = 0; i < width; i++)
+    {
+        if(!intp->gc.WriteField(vals[i], thisEnv, idx + i))
+        {
+            intp->ReportError("Writing to invalid static field:"
+                + thisEnv.type->name + "." + std::to_string(idx + i)); return;
+        }
+    }
+
+    intp->valueStack.erase(vals, intp->valueStack.end());
+}
+
 void Interpreter::Op_LDI(Interpreter* intp)
 {
     std::uint32_t addr = (intp->ip++)->u;
@@ -910,4 +1406,9 @@ const InstFn Interpreter::opcodeEntry[] = {
     & Op_JA,& Op_JAI,
     & Op_JNA,& Op_JNAI,
 
+    //ldlen, ldelem, stelem
+    &Op_LDLEN, &Op_LDELEM, &Op_STELEM,
+
+    //ldstr
+    &Op_LDSTR,
 };
@@ -7,8 +7,12 @@
 #include <functional>
 #include <queue>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <chrono>
+#if __has_include(<span>)
+    #include <span>
+#endif
 
 //#include "Utils.h"
 #include <iostream>
@@ -39,7 +43,9 @@ public:
 
     bool IsRef() const
     {
-        return type != nullptr && type->IsReferenceType() && data.obj != nullptr;
+        //Tagged payloads (inline strings) are not pointers
+        return type != nullptr && type->IsReferenceType() && data.obj != nullptr
+            && !((std::uintptr_t)data.obj & 1);
     }
     bool IsNull() const {
         return type == nullptr ||
@@ -262,17 +268,21 @@ struct CallStackFrame
     IL* ip;
     ValueType currEnv;
     MethodBlock* currentFn;
+    //Slots for allocations sunk into this frame
+    BytePtr locals;
 
     CallStackFrame(
         int sp, 
         IL* ip, 
         const ValueType& env,
-        MethodBlock* fn
+        MethodBlock* fn,
+        BytePtr locals = nullptr
     ):
         sp(sp), 
         ip(ip), 
         currEnv(env),
-        currentFn(fn)
+        currentFn(fn),
+        locals(locals)
         {}
 
     CallStackFrame(const CallStackFrame& other) = default;
@@ -280,8 +290,71 @@ struct CallStackFrame
 };
 
 
+/* Primitive arrays are unscanned blobs:
+ * +-------------------+
+ * | ArrayHeader       |
+ * +-------------------+
+ * | 32bit elements    |
+ *   ...
+ * RefArray is a raw object holding one ValueType per element.
+ */
+struct alignas(16) ArrayHeader
+{
+    TypeTable* elemType;
+    std::uint32_t length;
+
+    template<typename T>
+    T* Elements() { return (T*)(this + 1); }
+};
+
+/* Str values up to StrInlineMax bytes live in the ValueType itself.
+ * Heap payloads are 16 byte aligned, so the low bit of data.obj tags
+ * them: byte 0 holds (length << 1) | 1 and the bytes follow (little
+ * endian). Longer strings are unscanned blobs:
+ * +-------------------+
+ * | StrHeader         |
+ * +-------------------+
+ * | bytes             |  or the host pointer for External
+ *   ...
+ */
+struct alignas(16) StrHeader
+{
+    enum : std::uint32_t
+    {
+        Interned = 1,   //Pinned and unique, equal only to itself
+        External = 2,   //Bytes owned by host
+    };
+    std::uint32_t length;
+    //0 until first asked
+    std::uint32_t hash;
+    std::uint32_t flags;
+
+    const char* Chars() const
+    {
+        return (flags & External) ? *(const char* const*)(this + 1) : (const char*)(this + 1);
+    }
+};
+
+constexpr std::size_t StrInlineMax = sizeof(void*) - 1;
+
+/* Table|Table is a raw object of these field slots. Columns are stored
+ * column major with a stride of capacity, so column c of row r is
+ * element c * capacity + r of the prims blob (IntArray) or the refs
+ * RefArray, depending on TypeTable::columns of the row type.
+ */
+enum TableField : std::uint32_t
+{
+    TableCount = 0,
+    TableCapacity,
+    TablePrims,
+    TableRefs,
+    TableRow,       //Null value typed as the row type
+};
+
 class Interpreter
 {
+    //Translator emits the internal allocation sinking ops
+    friend class LibraryLoader;
 
     static TypeObjInfo _typeObjInfo;
     static ClosureObjInfo _closureObjInfo;
@@ -316,6 +389,19 @@ public:
     ExternalRefReg extRefs;
     std::unordered_map<TypeTable*, ValueType> staticPool;
 
+    //Frame slots of allocations the translator proved non escaping
+    FrameLocalArena frameLocals;
+    //Set by sinknext, consumed by the next allocation of sinkType
+    BytePtr sinkSlot = nullptr;
+    TypeTable* sinkType = nullptr;
+
+    //Str|Str, resolved on first use
+    TypeTable* strType = nullptr;
+    //Interned strings longer than StrInlineMax, keys view the pinned payload
+    std::unordered_map<std::string_view, ValueType> internedStrs;
+    //Table|Table, resolved on first use
+    TypeTable* tableType = nullptr;
+
     IL* ip;
 
     int gcManagedFreq = 2, gcMajorHeapFreq = 2, gcMatureGen = 2;
@@ -325,6 +411,7 @@ public:
         //gcCurrTick++;
         //if(gcCurrTick % gcTick == 0)
         {
+            gc.CloseFastPath();
             GC_SweepManaged();
             GC_SweepHeap();
         }
@@ -337,7 +424,7 @@ public:
         for(auto& kv : staticPool)
         {
             auto cb = GetCtrlBlk(kv.second.data.obj);
-            if(cb->isInNursery | fullSweep)
+            if(cb->IsInNursery() | fullSweep)
                 roots.push_back(&kv.second);
         }
 
@@ -346,7 +433,7 @@ public:
         {
             if(!v.IsRef()) continue;
             auto cb = GetCtrlBlk(v.data.obj);
-            if (cb->isInNursery | fullSweep)
+            if (cb->IsInNursery() | fullSweep)
                 roots.push_back(&v);
         }
 
@@ -357,7 +444,7 @@ public:
             auto& v = s.currEnv;
             if (!v.IsRef()) continue;
             auto cb = GetCtrlBlk(v.data.obj);
-            if (cb->isInNursery | fullSweep)
+            if (cb->IsInNursery() | fullSweep)
                 roots.push_back(&v);
         }
 
@@ -367,22 +454,33 @@ public:
             auto& v = e->handle;
             if (!v.IsRef()) continue;
             auto cb = GetCtrlBlk(v.data.obj);
-            if (cb->isInNursery | fullSweep)
+            if (cb->IsInNursery() | fullSweep)
                 roots.push_back(&v);
         }
 
+        //Interned strings are pinned on heap and never die
+        if (fullSweep)
+        {
+            for (auto& kv : internedStrs)
+                roots.push_back(&kv.second);
+        }
+
         return roots;
     }
 
     std::chrono::steady_clock::time_point prevPrtTime = std::chrono::steady_clock::now();
 
     int gcManTh = 256;//1024*1024;
+    //Least nursery allocation between minor GCs, or one with few
+    //survivors is collected every few objects
+    int gcManMinTh = 1024 * 1024;
     void GC_SweepManaged()
     {
         if(gc.allocManaged < gcManTh) return;
         //Mark roots
         auto roots = FindRoot(false);
         gc.SweepManaged(roots);
+        gcSliceDue = true;
 
         //auto curTime = std::chrono::steady_clock::now();
         //auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(curTime - prevPrtTime);
@@ -390,17 +488,95 @@ public:
         //std::cout << "[ +"<< delta.count() << "ms ]>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>" << std::endl;
         //std::cout << "New object space delta:" << gcManTh - gc.allocManaged << "bytes" << std::endl;
 
-        gcManTh = gc.allocManaged * gcManagedFreq;
+        gcManTh = std::max(gc.allocManaged * gcManagedFreq, gcManMinTh);
         //std::cout<< "NewObj threshold:" << gcManTh << "bytes" <<std::endl;
         //std::cout << gc.PrintAllocStat();
     }
 
     int gcHeapTh = 1024;//1024 * 1024 * 4;
+    /* Longest major GC pause wanted, in microseconds. Marking runs in
+     * slices of this length between mutator steps, and so do its tries
+     * to finish, which rescan the roots. 0 marks everything in a single
+     * pause. Two pauses are not bounded: finishing at once when the
+     * mutator outruns marking and the heap doubles past gcHeapTh, see
+     * GarbageCollector::markOutrunCnt, and compaction when due
+     */
+    int gcPauseTargetUs = 1000;
+    //Mark and sweep slices are paced by allocation: one is due after
+    //every minor GC and every gcSliceBytes allocated in between
+    int gcSliceBytes = 256 << 10;
+    bool gcSliceDue = false;
+    int sliceManaged = 0, sliceMajorHeap = 0;
+    bool IsSliceDue() const
+    {
+        return gcSliceDue || gc.allocManaged - sliceManaged + gc.allocMajorHeap - sliceMajorHeap >= gcSliceBytes;
+    }
+    void SliceTaken()
+    {
+        gcSliceDue = false;
+        sliceManaged = gc.allocManaged;
+        sliceMajorHeap = gc.allocMajorHeap;
+    }
+    //Mark on a background thread instead of in slices. The stress mode
+    //delays the marker at random to shake out races
+    bool gcConcurrentMark = false, gcMarkStress = false;
+    //Longest lazy sweeping slice, dead heap objects are destroyed in
+    //slices after marking instead of inside its last pause
+    int gcSweepSliceUs = 500;
     void GC_SweepHeap()
     {
+        using Clock = std::chrono::steady_clock;
+        if (gc.IsMarking())
+        {
+            auto begin = Clock::now();
+            //The mutator outran marking, the rest is done in one pause
+            if (gc.allocMajorHeap >= gcHeapTh * 2)
+            {
+                gc.FinishMarking(FindRoot(true));
+                gc.finalPauseStats.Record(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+                gc.markOutrunCnt++;
+                gcHeapTh = gc.allocMajorHeap * gcMajorHeapFreq;
+                return;
+            }
+            if (!IsSliceDue()) return;
+            SliceTaken();
+            auto deadline = begin + std::chrono::microseconds(gcPauseTargetUs);
+            //Try to finish right after a minor GC, which shaded what the
+            //nursery holds already
+            if (gc.IsGrayDrained() && gc.IsNurseryShaded())
+            {
+                if (gc.TryFinishMarking(FindRoot(true), deadline))
+                {
+                    gc.finalPauseStats.Record(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+                    gcHeapTh = gc.allocMajorHeap * gcMajorHeapFreq;
+                    return;
+                }
+            }
+            else if (gc.IsConcurrent()) return;
+            else gc.MarkSlice(deadline);
+            gc.markSliceStats.Record(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+            return;
+        }
+        if (gc.IsSweeping() && IsSliceDue())
+        {
+            SliceTaken();
+            auto begin = Clock::now();
+            gc.SweepSlice(begin + std::chrono::microseconds(gcSweepSliceUs));
+            gc.sweepSliceStats.Record(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+        }
         if (gc.allocMajorHeap < gcHeapTh) return;
+        if (gcPauseTargetUs > 0 || gcConcurrentMark)
+        {
+            auto begin = Clock::now();
+            gc.StartMarking(FindRoot(true), gcConcurrentMark, gcMarkStress);
+            gc.markSliceStats.Record(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+            SliceTaken();
+            return;
+        }
+        auto begin = Clock::now();
         auto roots = FindRoot(true);
         gc.SweepMajorHeap(roots);
+        gc.finalPauseStats.Record(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
 
         //auto curTime = std::chrono::steady_clock::now();
         //auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(curTime - prevPrtTime);
@@ -414,30 +590,316 @@ public:
         //std::cout << gc.PrintAllocStat();
     }
 
+    ValueType NewFrameLocalObject(TypeTable* ty, BytePtr slot)
+    {
+        if (ty->IsPacked())
+        {
+            auto cb = ManagedObjectCtrlBlock::EmplaceRaw(slot, AlignObjSize(ty->packedSize),
+                gc.FrameLocalFlags(), ManagedObjectCtrlBlock::BlobKind);
+            cb->vptr = ty;
+            ValueType hndl(ty);
+            hndl.data.obj = GetPayload(cb);
+            memset(hndl.data.obj, 0, cb->ObjectSize());
+            return hndl;
+        }
+
+        int fieldCnt = ty->fields.size();
+        auto cb = ManagedObjectCtrlBlock::EmplaceRaw(slot, sizeof(ValueType) * fieldCnt, gc.FrameLocalFlags());
+        cb->vptr = ty;
+        auto inst = (ValueType*)GetPayload(cb);
+        ValueType hndl(ty);
+        hndl.data.obj = inst;
+
+        for (int i = 0; i < fieldCnt; i++)
+        {
+            new (inst + i)ValueType(ty->fields[i]);
+        }
+        return hndl;
+    }
+
     ValueType NewRefTypeObject(TypeTable* ty)
     {
         assert(ty->IsReferenceType());
-        //TODO: run scheduled GC tasks
-        NotifyGC();
+        if (sinkSlot != nullptr)
+        {
+            auto slot = sinkSlot;
+            sinkSlot = nullptr;
+            if (ty == sinkType)
+                return NewFrameLocalObject(ty, slot);
+        }
 
-        if (ty == nullptr) return nullptr;
-        int fieldCnt = ty->fields.size();
+        //Bump the nursery and copy the prototype, no GC check is due
+        //while the fast path is open, see OpenFastPath
+        if (ty->hasPrototype)
+        {
+            auto size = ty->prototype.size();
+            if (auto cb = gc.TryBumpAllocate(size, ty->objKind))
+            {
+                cb->vptr = ty;
+                auto inst = GetPayload(cb);
+                memcpy(inst, ty->prototype.data(), size);
+                ValueType hndl(ty);
+                hndl.data.obj = inst;
+                return hndl;
+            }
+        }
+        return NewRefTypeObjectSlow(ty);
+    }
+    //GC check, block refill and the first instance of a type
+    ValueType NewRefTypeObjectSlow(TypeTable* ty);
 
-        auto inst = gc.AllocateRawObject(fieldCnt);
-        auto cb = GetCtrlBlk(inst);
+    //Opens the allocation fast path up to where NotifyGC would collect
+    //or take a mark or sweep slice next. Nursery bytes are the only
+    //ones allocations bring closer
+    void OpenFastPath()
+    {
+        auto marking = gc.IsMarking(), sweeping = gc.IsSweeping();
+        if (gc.allocMajorHeap >= (marking ? gcHeapTh * 2 : gcHeapTh) || gc.allocManaged >= gcManTh) return;
+        auto budget = gcManTh - gc.allocManaged;
+        if (marking || sweeping)
+        {
+            if (IsSliceDue()) return;
+            budget = std::min(budget, sliceManaged + sliceMajorHeap + gcSliceBytes - gc.allocManaged - gc.allocMajorHeap);
+        }
+        gc.OpenFastPath(budget);
+    }
+
+
+    //Zero filled blob, caller has already notified GC
+    ValueType NewPackedObject(TypeTable* ty)
+    {
+        auto payload = gc.AllocateBlob(ty->packedSize);
+        auto cb = GetCtrlBlk(payload);
         cb->vptr = ty;
-        cb->debugInfo = "Instance of " + ty->name;
+        memset(payload, 0, cb->ObjectSize());
         ValueType hndl(ty);
+        hndl.data.obj = payload;
+        return hndl;
+    }
+
+    //Zero filled array of 32bit elements. young: short lived, see
+    //GarbageCollector::AllocateRawObject
+    ValueType NewPrimArray(TypeTable* arrType, TypeTable* elemType, std::uint32_t length, bool young = false)
+    {
+        NotifyGC();
+        auto payload = gc.AllocateBlob(sizeof(ArrayHeader) + sizeof(std::int32_t) * length, false,
+            ManagedObjectCtrlBlock::BlobKind, young);
+        auto cb = GetCtrlBlk(payload);
+        cb->vptr = arrType;
+        memset(payload, 0, cb->ObjectSize());
+        auto header = (ArrayHeader*)payload;
+        header->elemType = elemType;
+        header->length = length;
+        ValueType hndl(arrType);
+        hndl.data.obj = payload;
+        return hndl;
+    }
+
+    //Array of null values, elements take any type
+    ValueType NewRefArray(TypeTable* arrType, std::uint32_t length, bool young = false)
+    {
+        NotifyGC();
+        auto inst = gc.AllocateRawObject(length, ManagedObjectCtrlBlock::RawKind, young);
+        auto cb = GetCtrlBlk(inst);
+        cb->vptr = arrType;
+        for (std::uint32_t i = 0; i < length; i++)
+        {
+            new (inst + i)ValueType();
+        }
+        ValueType hndl(arrType);
         hndl.data.obj = inst;
+        return hndl;
+    }
+
+    static std::uint32_t ArrayLength(const ValueType& arr)
+    {
+        auto cb = GetCtrlBlk(arr.data.obj);
+        return cb->IsRaw() ?
+            cb->ObjectSize() / sizeof(ValueType) : ((ArrayHeader*)arr.data.obj)->length;
+    }
+
+    //Whether val may be stored in a primitive array: a value of its
+    //element type, or an untyped engine immediate (PUSHIMM, LDLEN)
+    static bool IsElementOf(const ValueType& val, const ArrayHeader* header)
+    {
+        return val.type == header->elemType || val.type == &_intpObjInfo;
+    }
+
+    //Host side construction, needs the Arr library. Elements are copied once
+    ValueType NewIntArray(const std::int32_t* data, std::size_t length);
+    ValueType NewFloatArray(const float* data, std::size_t length);
+#ifdef __cpp_lib_span
+    ValueType NewIntArray(std::span<const std::int32_t> data) { return NewIntArray(data.data(), data.size()); }
+    ValueType NewFloatArray(std::span<const float> data) { return NewFloatArray(data.data(), data.size()); }
+#endif
+
+    TypeTable* StrType()
+    {
+        if (strType == nullptr) strType = libLoader.LookupType("Str|Str");
+        return strType;
+    }
+
+    TypeTable* TableType()
+    {
+        if (tableType == nullptr) tableType = libLoader.LookupType("Table|Table");
+        return tableType;
+    }
 
-        for (std::size_t i = 0; i < ty->fields.size(); i++)
+    //Empty table of a columnar row type, needs the Table library
+    ValueType NewTable(TypeTable* rowType, std::uint32_t capacity = 0);
+    //Regrows the columns of the table at valueStack[tableIdx], keeping
+    //its rows. Capacity must hold them
+    void ReserveTableRows(std::size_t tableIdx, std::uint32_t capacity);
+    //Element index of (row, slot) in its column block, reports bad
+    //tables, rows and row types
+    bool LocateTableCell(const ValueType& table, std::int32_t row,
+        std::uint32_t slot, TypeTable* owner, std::uint32_t& cell);
+
+    static bool IsInlineStr(const ValueType& s) { return (std::uintptr_t)s.data.obj & 1; }
+
+    //Views the value itself for inline strings, so it's only
+    //valid while s stays where it is
+    static std::string_view StrView(const ValueType& s)
+    {
+        if (IsInlineStr(s))
         {
-            auto typeInfo = ty->fields[i];
-            new (inst + i)ValueType(typeInfo);
+            auto bytes = (const char*)&s.data;
+            return std::string_view(bytes + 1, (std::uint8_t)bytes[0] >> 1);
         }
+        if (s.data.obj == nullptr) return std::string_view();
+        auto header = (const StrHeader*)s.data.obj;
+        return std::string_view(header->Chars(), header->length);
+    }
+
+    //Writable bytes of a string from NewStrBuffer
+    static char* StrBytes(ValueType& s)
+    {
+        if (IsInlineStr(s)) return (char*)&s.data + 1;
+        return (char*)((StrHeader*)s.data.obj + 1);
+    }
+
+    static std::uint32_t HashBytes(std::string_view s)
+    {
+        //FNV-1a, 0 is kept for "not computed"
+        std::uint32_t h = 2166136261u;
+        for (auto c : s) h = (h ^ (std::uint8_t)c) * 16777619u;
+        return h == 0 ? 1 : h;
+    }
+
+    static std::uint32_t StrHash(const ValueType& s)
+    {
+        if (IsInlineStr(s) || s.data.obj == nullptr) return HashBytes(StrView(s));
+        auto header = (StrHeader*)s.data.obj;
+        if (header->hash == 0) header->hash = HashBytes(StrView(s));
+        return header->hash;
+    }
+
+    static bool StrEqual(const ValueType& a, const ValueType& b)
+    {
+        if (a.data.obj == b.data.obj) return true;
+        //Short strings are always inline, so inline never equals heap
+        if (!a.IsRef() || !b.IsRef()) return false;
+        auto ha = (StrHeader*)a.data.obj;
+        auto hb = (StrHeader*)b.data.obj;
+        if (ha->flags & hb->flags & StrHeader::Interned) return false;
+        if (ha->length != hb->length) return false;
+        if (ha->hash != 0 && hb->hash != 0 && ha->hash != hb->hash) return false;
+        return memcmp(ha->Chars(), hb->Chars(), ha->length) == 0;
+    }
+
+    //Uninitialized string of length bytes, fill through StrBytes before
+    //anything else allocates
+    ValueType NewStrBuffer(std::size_t length, bool pinned = false)
+    {
+        ValueType hndl;
+        if (!pinned && TryNewStrBuffer(length, hndl)) return hndl;
+        auto ty = StrType();
+        if (ty == nullptr)
+        {
+            ReportError("Str library not loaded");
+            return ValueType();
+        }
+        hndl = ValueType(ty);
+        if (length <= StrInlineMax)
+        {
+            ((std::uint8_t*)&hndl.data)[0] = (std::uint8_t)(length << 1 | 1);
+            return hndl;
+        }
+
+        NotifyGC();
+        InitStrBuffer(hndl, gc.AllocateBlob(sizeof(StrHeader) + length, pinned), length);
+        OpenFastPath();
         return hndl;
     }
 
+    //NewStrBuffer through the nursery bump of NewRefTypeObject only, false
+    //where it would check for a GC. Nothing moves when it succeeds, so
+    //hosts building many strings keep their pointers into managed objects
+    bool TryNewStrBuffer(std::size_t length, ValueType& str)
+    {
+        auto ty = StrType();
+        if (ty == nullptr) return false;
+        if (length <= StrInlineMax)
+        {
+            str = ValueType(ty);
+            ((std::uint8_t*)&str.data)[0] = (std::uint8_t)(length << 1 | 1);
+            return true;
+        }
+        auto cb = gc.TryBumpAllocate(AlignObjSize(sizeof(StrHeader) + length), ManagedObjectCtrlBlock::BlobKind);
+        if (cb == nullptr) return false;
+        str = ValueType(ty);
+        InitStrBuffer(str, GetPayload(cb), length);
+        return true;
+    }
+
+    static void InitStrBuffer(ValueType& str, BytePtr payload, std::size_t length)
+    {
+        GetCtrlBlk(payload)->vptr = str.type;
+        auto header = (StrHeader*)payload;
+        header->length = (std::uint32_t)length;
+        header->hash = 0;
+        header->flags = 0;
+        str.data.obj = payload;
+    }
+
+    //Copies s, which must not point into the managed heap
+    ValueType NewStr(std::string_view s)
+    {
+        auto str = NewStrBuffer(s.size());
+        if (str.type != nullptr) memcpy(StrBytes(str), s.data(), s.size());
+        return str;
+    }
+
+    //Keeps a pointer to s instead of copying it, host keeps the bytes
+    //alive for as long as scripts may hold the value
+    ValueType NewStrView(std::string_view s)
+    {
+        if (s.size() <= StrInlineMax) return NewStr(s);
+        auto str = NewStrBuffer(sizeof(const char*));
+        if (str.type == nullptr) return str;
+        auto header = (StrHeader*)str.data.obj;
+        header->length = (std::uint32_t)s.size();
+        header->flags = StrHeader::External;
+        *(const char**)(header + 1) = s.data();
+        return str;
+    }
+
+    //Same contents give the same value, so equality is a pointer compare
+    ValueType InternStr(std::string_view s)
+    {
+        if (s.size() <= StrInlineMax) return NewStr(s);
+        auto iter = internedStrs.find(s);
+        if (iter != internedStrs.end()) return iter->second;
+
+        auto str = NewStrBuffer(s.size(), true);
+        if (str.type == nullptr) return str;
+        memcpy(StrBytes(str), s.data(), s.size());
+        auto header = (StrHeader*)str.data.obj;
+        header->flags = StrHeader::Interned;
+        header->hash = HashBytes(s);
+        internedStrs.emplace(StrView(str), str);
+        return str;
+    }
 
     template<typename T, typename ...ArgTypes>
     T* NewExtTypeObject(ArgTypes... args)
@@ -462,7 +924,6 @@ public:
         auto inst = gc.AllocateRawObject(staticFields.size());
         auto cb = GetCtrlBlk(inst);
         cb->vptr = typeInfo;
-        cb->debugInfo = "StaticFields of "+typeInfo->name;
         ValueType staticFieldEnv(typeInfo);
         staticFieldEnv.data.obj = inst;
 
@@ -583,6 +1044,8 @@ public:
         valueStack.push_back(*fn.closureObjRef.get());
         ip = dummyBody;
         status = ExecutionStatus::Running;
+        //A sunk host call re-entering, the slot is for its own result
+        sinkSlot = nullptr;
         while(ip!= dummyBody + 1)
         {
             if(status != ExecutionStatus::Running) break;
@@ -599,6 +1062,10 @@ public:
 
     LibraryLoader::_StatReg CompileProgram()
     {
+        //Types are rebuilt
+        strType = nullptr;
+        tableType = nullptr;
+        internedStrs.clear();
         return libLoader.Compile();
     }
 
@@ -613,10 +1080,15 @@ public:
         staticPool.clear();
         //remaining call stack frames
         callStack.clear();
+        frameLocals.Reset();
+        sinkSlot = nullptr;
     }
         
     void ClearLib()
     {
+        strType = nullptr;
+        tableType = nullptr;
+        internedStrs.clear();
         libLoader.ClearCompiled();
         libLoader.libs.clear();
     }
@@ -679,6 +1151,15 @@ private:
     //(Type/Obj)->Obj
     static void Op_NEW(Interpreter* intp);
 
+    //Internal, emitted for sunk allocations
+    //(),imm.type,imm.offset->Obj   construct object in frame slot
+    static void _op_newlocal(Interpreter* intp);
+    //(),imm.type,imm.offset->0     next allocation of type goes to frame slot
+    static void _op_sinknext(Interpreter* intp);
+    //(args),imm.type,imm.offset,imm.fn->(rets)   sinknext fused with an
+    //embedded host call, which has no RET to clear the slot
+    static void _op_sinkembed(Interpreter* intp);
+
     
 
     //(Type/Obj),imm.funcInfo->Closure
@@ -695,6 +1176,27 @@ private:
     //(Obj(cls), Obj(val)),imm->-1
     static void _op_stmem(Interpreter* intp);
 
+    //Internal, emitted for value type struct fields
+    //(Obj),imm.idx,imm.width->width-1      load all slots of the field
+    static void _op_ldmemn(Interpreter* intp);
+    //(Obj(cls), Obj(val)[width]),imm.idx,imm.width->-(width+1)
+    static void _op_stmemn(Interpreter* intp);
+
+    //Internal, emitted for fields of packed host types
+    //(Obj),imm.lane->Obj
+    static void _op_ldlane(Interpreter* intp);
+    //(Obj(cls), Obj(val)),imm.lane->-2
+    static void _op_stlane(Interpreter* intp);
+    //Internal, emitted for fields of columnar types
+    //(Table, u32),imm.slot,imm.type->Obj
+    static void _op_ldcol(Interpreter* intp);
+    //(Obj(val), Table, u32),imm.slot,imm.type->-3
+    static void _op_stcol(Interpreter* intp);
+    //(),imm.type,imm.idx,imm.width->width
+    static void _op_ldstaticn(Interpreter* intp);
+    //(Obj(val)[width]),imm.type,imm.idx,imm.width->-width
+    static void _op_ststaticn(Interpreter* intp);
+
     // addr    Init a syscall into c++ land
     static void NOP(Interpreter* intp)
     {
@@ -726,6 +1228,14 @@ private:
     static void Op_LDI(Interpreter* intp);
     // (Obj),imm-> 0  Store to address 64, val stays put
     static void Op_STI(Interpreter* intp);
+    // (Arr)->u32          Array length
+    static void Op_LDLEN(Interpreter* intp);
+    // (Arr, u32)->Obj     Load element, bounds checked
+    static void Op_LDELEM(Interpreter* intp);
+    // (Obj, Arr, u32)->-3 Store element, bounds checked
+    static void Op_STELEM(Interpreter* intp);
+    // <text, cache>->Str  Interned literal, cache is patched on first run
+    static void Op_LDSTR(Interpreter* intp);
     // (u32)->Obj         Load from local + addr
     static void _op_ldarg(Interpreter* intp);
     // (u32, Obj)-> -1   Store to local + addr, val stays put
@@ -2,6 +2,8 @@
 
 #include "Interpreter.h"
 
+#include <set>
+
 const std::string LibraryLoader::hostWrapperLibName = "HostTypes";
 
 
@@ -235,7 +237,7 @@ std::tuple<TypeTable*, int> LibraryLoader::_ResolveFnName(const std::string& nam
     return { nullptr,-1 };
 }
 
-int LibraryLoader::_ResolveMemberName(const std::string& name, const std::string& thisLib)
+int LibraryLoader::_ResolveMemberName(const std::string& name, const std::string& thisLib, int* width)
 {
     //libName|typeName|memberName or typeName|memberName
     auto parts = SplitFullName(name);
@@ -252,22 +254,16 @@ int LibraryLoader::_ResolveMemberName(const std::string& name, const std::string
         libName = thisLib;
     }
 
-    auto typeInfo = FindClassByName(typeName, libName);
-    if (typeInfo == nullptr)
-        return -1;
-
-    auto fieldName = parts.back();
-    for (std::size_t i = 0; i < typeInfo->fields.size(); i++)
-    {
-        auto& m = typeInfo->fields[i];
-        if (m.name == fieldName)
-            return i;
-    }
+    //Field slots are laid out parents first, use the compiled layout
+    auto fullName = libName + "|" + typeName + "|" + parts.back();
+    auto idx = LookupFieldIndex(fullName);
+    if (idx >= 0 && width != nullptr)
+        *width = LookupFieldWidth(fullName);
 
-    return -1;
+    return idx;
 }
 
-std::tuple<TypeTable*, int> LibraryLoader::_ResolveStaticMemberName(const std::string& name, const std::string& thisLib)
+std::tuple<TypeTable*, int> LibraryLoader::_ResolveStaticMemberName(const std::string& name, const std::string& thisLib, int* width)
 {
     //libName|typeName|memberName or typeName|memberName
     auto parts = SplitFullName(name);
@@ -284,23 +280,409 @@ std::tuple<TypeTable*, int> LibraryLoader::_ResolveStaticMemberName(const std::s
         libName = thisLib;
     }
 
-    
-
     auto table = FindTypeByName(typeName, libName);
     if (table == nullptr)
         return { nullptr,-1 };
-    auto typeInfo = tlut[table];
-    if (typeInfo == nullptr)
+    auto fullName = libName + "|" + typeName + "|" + parts.back();
+    auto idx = LookupStaticFieldIndex(fullName);
+    if (idx < 0)
         return { nullptr,-1 };
-    auto fieldName = parts.back();
-    for (std::size_t i = 0; i < typeInfo->staticFields.size(); i++)
+    if (width != nullptr)
+        *width = LookupFieldWidth(fullName, true);
+
+    return { table,idx };
+}
+
+//Type part of libName|typeName|memberName or typeName|memberName
+static std::string MemberOwnerName(const std::string& name)
+{
+    auto pos = name.rfind('|');
+    return pos == std::string::npos ? "" : name.substr(0, pos);
+}
+
+TypeTable* LibraryLoader::ResolveColumnarOwner(const std::string& name, std::vector<std::string>& libs)
+{
+    auto owner = ResolveTypeName(MemberOwnerName(name), libs);
+    return (owner != nullptr && owner->isColumnar) ? owner : nullptr;
+}
+
+//Only objects made of value types can live in a frame,
+//the GC never needs to look inside them
+static bool IsSinkableType(TypeTable* ty)
+{
+    if (ty == nullptr || !ty->IsReferenceType() || ty->isArray) return false;
+    for (auto f : ty->fields)
     {
-        auto& m = typeInfo->staticFields[i];
-        if (m.name == fieldName)
-            return { table,i };
+        if (f == nullptr || f->IsReferenceType()) return false;
     }
+    return true;
+}
 
-    return { nullptr,-1 };
+static std::size_t SinkSlotSize(TypeTable* ty)
+{
+    std::size_t size = MOCtrlBlkSize + (ty->IsPacked() ?
+        AlignObjSize(ty->packedSize) : sizeof(ValueType) * ty->fields.size());
+    //Keep every slot aligned like a heap allocation
+    return (size + 15) & ~(std::size_t)15;
+}
+
+LibraryLoader::SinkPlan LibraryLoader::AnalyzeEscape(
+    MethodInfoBase* fnInfo,
+    const std::vector<Instruction>& bytecode,
+    std::vector<std::string>& libs,
+    LibraryLoader::_StatReg& reg)
+{
+    SinkPlan plan;
+    int lineCnt = bytecode.size();
+    plan.slotOffset.assign(lineCnt, -1);
+    if (!enableAllocSinking || lineCnt == 0) return plan;
+
+    auto FindMethod = [&](const std::string& name)->MethodInfoBase*
+    {
+        auto res = ResolveFnName(name, libs);
+        auto table = std::get<0>(res);
+        auto idx = std::get<1>(res);
+        if (table == nullptr || idx < 0) return nullptr;
+        auto info = tlut[table];
+        if (info == nullptr || idx >= (int)info->methods.size()) return nullptr;
+        return info->methods[idx].get();
+    };
+
+    //Allocation sites: newobj and constant host methods returning
+    //a sinkable reference type
+    std::vector<TypeTable*> siteType(lineCnt, nullptr);
+    bool hasSite = false;
+    for (int i = 0; i < lineCnt; i++)
+    {
+        auto& line = bytecode[i];
+        TypeTable* ty = nullptr;
+        switch (line.opcode)
+        {
+        case OpCode::newobj:
+            ty = ResolveTypeName(std::get<std::string>(line.oprand), libs);
+            break;
+        case OpCode::callstatic:
+        case OpCode::d_embed:
+        {
+            auto fn = FindMethod(std::get<std::string>(line.oprand));
+            if (fn == nullptr || fn->cls == nullptr) break;
+            if (!fn->isConstant || !fn->isEmbeddable || fn->rets.size() != 1) break;
+            ty = _ResolveTypeName(fn->rets[0].type, fn->cls->GetLibName());
+        }
+            break;
+        default:break;
+        }
+        if (IsSinkableType(ty))
+        {
+            siteType[i] = ty;
+            hasSite = true;
+        }
+    }
+    if (!hasSite) return plan;
+
+    //Abstract stack: each slot holds the sites it may refer to
+    using AbsVal = std::set<int>;
+    using AbsStack = std::vector<AbsVal>;
+
+    std::vector<bool> escaped(lineCnt, false), reached(lineCnt, false);
+    std::vector<AbsStack> states(lineCnt);
+    std::vector<int> worklist;
+
+    auto Escape = [&](const AbsVal& v) { for (auto s : v) escaped[s] = true; };
+
+    auto Merge = [&](int tgt, const AbsStack& st)->bool
+    {
+        if (tgt < 0 || tgt >= lineCnt) return false;
+        if (!reached[tgt])
+        {
+            reached[tgt] = true;
+            states[tgt] = st;
+            worklist.push_back(tgt);
+            return true;
+        }
+        auto& dst = states[tgt];
+        //Stack heights must agree on every path
+        if (dst.size() != st.size()) return false;
+        bool changed = false;
+        for (std::size_t k = 0; k < st.size(); k++)
+        {
+            for (auto s : st[k]) changed |= dst[k].insert(s).second;
+        }
+        if (changed) worklist.push_back(tgt);
+        return true;
+    };
+
+    int retCnt = mlut[fnInfo]->retSlots;
+    bool ok = Merge(0, AbsStack(mlut[fnInfo]->argSlots));
+    std::string failReason;
+
+    while (ok && !worklist.empty())
+    {
+        int i = worklist.back();
+        worklist.pop_back();
+        auto st = states[i];
+        auto& line = bytecode[i];
+
+        //Previous instance of this site still alive, can't reuse its slot
+        if (siteType[i] != nullptr)
+        {
+            for (auto& v : st)
+            {
+                if (v.count(i)) escaped[i] = true;
+            }
+        }
+
+        bool fallThrough = true;
+        int jumpTgt = -1;
+        auto StackAddr = [&](std::int32_t fromTop)->int
+        {
+            int addr = (int)st.size() - 1 - fromTop;
+            return (fromTop < 0 || addr < 0) ? -1 : addr;
+        };
+
+        switch (line.opcode)
+        {
+        case OpCode::NOP:
+        case OpCode::copy:
+            break;
+        case OpCode::HLT:
+            //Host may inspect the stack after halting
+            for (auto& v : st) Escape(v);
+            fallThrough = false;
+            break;
+        case OpCode::RET:
+            for (int k = 0; k < retCnt && k < (int)st.size(); k++) Escape(st[k]);
+            fallThrough = false;
+            break;
+        case OpCode::callstatic:
+        case OpCode::callmem:
+        case OpCode::d_embed:
+        {
+            auto fn = FindMethod(std::get<std::string>(line.oprand));
+            if (fn == nullptr) { ok = false; failReason = "unresolved call"; break; }
+            bool isMem = line.opcode == OpCode::callmem;
+            auto fnBlk = mlut[fn];
+            std::size_t argCnt = fnBlk->argSlots + (isMem ? 1 : 0);
+            if (st.size() < argCnt) { ok = false; failReason = "stack underflow"; break; }
+            //Constant host methods don't keep their arguments,
+            //anything else is an unknown call
+            bool isPure = !isMem && fn->isConstant && fn->isEmbeddable;
+            for (std::size_t k = st.size() - argCnt; !isPure && k < st.size(); k++)
+            {
+                Escape(st[k]);
+            }
+            st.resize(st.size() - argCnt);
+            st.resize(st.size() + fnBlk->retSlots);
+            if (siteType[i] != nullptr) st.back().insert(i);
+        }
+            break;
+        case OpCode::call:
+        case OpCode::ldloc:
+        case OpCode::stloc:
+        case OpCode::ld:
+        case OpCode::st:
+        case OpCode::JUMP:
+        case OpCode::JZ:
+        case OpCode::JNZ:
+        case OpCode::JB:
+        case OpCode::JNB:
+        case OpCode::JA:
+        case OpCode::JNA:
+            ok = false;
+            failReason = "computed address or jump";
+            break;
+        case OpCode::ldfn:
+            //Object becomes closure environment
+            if (st.empty()) { ok = false; break; }
+            Escape(st.back());
+            st.back().clear();
+            break;
+        case OpCode::newobj:
+        {
+            //Value type structs land on the stack flattened
+            auto ty = ResolveTypeName(std::get<std::string>(line.oprand), libs);
+            st.resize(st.size() + (ty == nullptr ? 1 : ty->SlotCount()));
+            if (siteType[i] != nullptr) st.back().insert(i);
+        }
+            break;
+        case OpCode::ldstatic:
+        {
+            int width = 1;
+            ResolveStaticMemberName(std::get<std::string>(line.oprand), libs, &width);
+            st.resize(st.size() + width);
+        }
+            break;
+        case OpCode::ldstaticfn:
+        case OpCode::ldthis:
+        case OpCode::PUSHIMM:
+            st.emplace_back();
+            break;
+        case OpCode::cast:
+            if (st.empty()) ok = false;
+            break;
+        case OpCode::typecmp:
+            if (st.empty()) ok = false;
+            else st.emplace_back();
+            break;
+        case OpCode::isnull:
+            if (st.empty()) ok = false;
+            else st.back().clear();
+            break;
+        case OpCode::ldmem:
+        {
+            int width = 1;
+            ResolveMemberName(std::get<std::string>(line.oprand), libs, &width);
+            //Columnar fields take (table, row)
+            int objSlots = ResolveColumnarOwner(std::get<std::string>(line.oprand), libs) ? 2 : 1;
+            if ((int)st.size() < objSlots) { ok = false; break; }
+            st.resize(st.size() - objSlots);
+            st.resize(st.size() + width);
+        }
+            break;
+        case OpCode::stmem:
+        {
+            //(val..., obj), val is stored into obj
+            int width = 1;
+            ResolveMemberName(std::get<std::string>(line.oprand), libs, &width);
+            int objSlots = ResolveColumnarOwner(std::get<std::string>(line.oprand), libs) ? 2 : 1;
+            if ((int)st.size() < width + objSlots) { ok = false; break; }
+            st.resize(st.size() - objSlots + 1);
+            for (int k = 0; k <= width; k++)
+            {
+                if (k > 0) Escape(st.back());
+                st.pop_back();
+            }
+        }
+            break;
+        case OpCode::ststatic:
+        {
+            int width = 1;
+            ResolveStaticMemberName(std::get<std::string>(line.oprand), libs, &width);
+            if ((int)st.size() < width) { ok = false; break; }
+            for (int k = 0; k < width; k++)
+            {
+                Escape(st.back());
+                st.pop_back();
+            }
+        }
+            break;
+        case OpCode::PUSH:
+        {
+            auto n = std::get<std::int32_t>(line.oprand);
+            if (n < 0) ok = false;
+            else st.resize(st.size() + n);
+        }
+            break;
+        case OpCode::POP:
+            if (st.empty()) ok = false;
+            else st.pop_back();
+            break;
+        case OpCode::POPI:
+        {
+            auto n = std::get<std::int32_t>(line.oprand);
+            if (n < 0 || (std::size_t)n > st.size()) ok = false;
+            else st.resize(st.size() - n);
+        }
+            break;
+        case OpCode::ldarg:
+        {
+            auto addr = std::get<std::int32_t>(line.oprand);
+            if (addr < 0 || addr >= (int)st.size()) { ok = false; break; }
+            AbsVal v = st[addr];
+            st.push_back(std::move(v));
+        }
+            break;
+        case OpCode::starg:
+        {
+            auto addr = std::get<std::int32_t>(line.oprand);
+            if (st.empty() || addr < 0 || addr >= (int)st.size()) { ok = false; break; }
+            st[addr] = st.back();
+            st.pop_back();
+        }
+            break;
+        case OpCode::ldi:
+        {
+            auto addr = StackAddr(std::get<std::int32_t>(line.oprand));
+            if (addr < 0) { ok = false; break; }
+            AbsVal v = st[addr];
+            st.push_back(std::move(v));
+        }
+            break;
+        case OpCode::sti:
+        {
+            auto addr = StackAddr(std::get<std::int32_t>(line.oprand));
+            if (addr < 0) { ok = false; break; }
+            st[addr] = st.back();
+            st.pop_back();
+        }
+            break;
+        case OpCode::ldstr:
+            st.emplace_back();
+            break;
+        case OpCode::ldlen:
+            if (st.empty()) { ok = false; break; }
+            st.back().clear();
+            break;
+        case OpCode::ldelem:
+            if (st.size() < 2) { ok = false; break; }
+            st.pop_back();
+            st.back().clear();
+            break;
+        case OpCode::stelem:
+            if (st.size() < 3) { ok = false; break; }
+            //Stored value outlives the frame
+            Escape(*(st.end() - 3));
+            st.resize(st.size() - 3);
+            break;
+        case OpCode::JMPI:
+            fallThrough = false;
+            jumpTgt = i + std::get<std::int32_t>(line.oprand);
+            break;
+        case OpCode::JZI:
+        case OpCode::JNZI:
+        case OpCode::JBI:
+        case OpCode::JNBI:
+        case OpCode::JAI:
+        case OpCode::JNAI:
+            if (st.empty()) { ok = false; break; }
+            st.pop_back();
+            jumpTgt = i + std::get<std::int32_t>(line.oprand);
+            break;
+        default:
+            ok = false;
+            failReason = "unknown opcode";
+            break;
+        }
+
+        if (!ok) break;
+        if (jumpTgt >= 0 || line.opcode == OpCode::JMPI)
+        {
+            ok = Merge(jumpTgt, st);
+        }
+        if (ok && fallThrough && i + 1 < lineCnt)
+        {
+            ok = Merge(i + 1, st);
+        }
+        if (!ok && failReason.empty()) failReason = "inconsistent stack";
+    }
+
+    auto fnName = fnInfo->GetThisType() + "|" + fnInfo->name;
+    if (!ok)
+    {
+        reg.Log("Allocation sinking skipped for " + fnName + ": " + failReason);
+        return plan;
+    }
+
+    for (int i = 0; i < lineCnt; i++)
+    {
+        if (siteType[i] == nullptr || !reached[i] || escaped[i]) continue;
+        plan.slotOffset[i] = plan.localBytes;
+        plan.localBytes += SinkSlotSize(siteType[i]);
+        reg.Log("Sunk allocation: " + fnName + " line " + std::to_string(i)
+            + " (" + siteType[i]->name + ")");
+    }
+
+    return plan;
 }
 
 std::vector<IL> LibraryLoader::TranslateFn(
@@ -316,6 +698,57 @@ std::vector<IL> LibraryLoader::TranslateFn(
             std::vector<IL> translated;
             auto hltFn = (void*)Interpreter::opcodeEntry[0];
 
+            auto sinkPlan = AnalyzeEscape(fnInfo, bytecode, libs, reg);
+            auto& sinkSlot = sinkPlan.slotOffset;
+            if (auto fnBlk = mlut[fnInfo])
+            {
+                fnBlk->localBytes = sinkPlan.localBytes;
+                fnBlk->sunkSites.clear();
+                for (std::size_t i = 0; i < sinkSlot.size(); i++)
+                {
+                    if (sinkSlot[i] >= 0) fnBlk->sunkSites.push_back(i);
+                }
+            }
+
+            //Direct the next allocation into the frame slot of line i.
+            //embedded: the host function of an embedded call, emitted
+            //fused so the slot is cleared after it, same length
+            auto EmitSinkNext = [&](std::vector<IL>& out, std::size_t i, const IL* embedded = nullptr)
+            {
+                auto fn = std::get<std::string>(bytecode[i].oprand);
+                auto callee = ResolveFnName(fn, libs);
+                auto info = tlut[std::get<0>(callee)];
+                auto ret = info->methods[std::get<1>(callee)]->rets[0].type;
+                IL instIL, tyIL, slotIL;
+                instIL.inst = embedded ? (void*)&Interpreter::_op_sinkembed : (void*)&Interpreter::_op_sinknext;
+                tyIL.inst = _ResolveTypeName(ret, info->GetLibName());
+                slotIL.i = sinkSlot[i];
+                out.push_back(std::move(instIL));
+                out.push_back(std::move(tyIL));
+                out.push_back(std::move(slotIL));
+                if (embedded) out.push_back(*embedded);
+            };
+
+            //Slot count of the field accessed by line i
+            auto FieldWidth = [&](std::size_t i)->int
+            {
+                int width = 1;
+                auto& line = bytecode[i];
+                switch (line.opcode)
+                {
+                case OpCode::ldmem:
+                case OpCode::stmem:
+                    ResolveMemberName(std::get<std::string>(line.oprand), libs, &width);
+                    break;
+                case OpCode::ldstatic:
+                case OpCode::ststatic:
+                    ResolveStaticMemberName(std::get<std::string>(line.oprand), libs, &width);
+                    break;
+                default:break;
+                }
+                return width;
+            };
+
             //Build line numbers using opcode length
             std::vector<int> lineNum(bytecode.size());
             int currLine = 0;
@@ -324,6 +757,19 @@ std::vector<IL> LibraryLoader::TranslateFn(
                 auto& line = bytecode[i];
                 std::uint8_t opFnID = (std::uint8_t)line.opcode;
                 int opLen = OpLength[opFnID];
+                //Sunk allocations: newobj carries the slot offset,
+                //calls are prefixed with sinknext <type, offset>,
+                //embedded ones fused into sinkembed <type, offset, fn>
+                if (sinkSlot[i] >= 0)
+                {
+                    opLen += line.opcode == OpCode::newobj ? 1 : 3;
+                }
+                //Wide field access carries the width,
+                //columnar access the row type
+                if (FieldWidth(i) > 1) opLen += 1;
+                if ((line.opcode == OpCode::ldmem || line.opcode == OpCode::stmem)
+                    && ResolveColumnarOwner(std::get<std::string>(line.oprand), libs))
+                    opLen += 1;
                 lineNum[i] = currLine;
                 currLine += opLen;
             }
@@ -424,6 +870,16 @@ std::vector<IL> LibraryLoader::TranslateFn(
                         IL immIL, instIL;
                         immIL.inst = tyInfo;
                         instIL.inst = opFn;
+                        if (sinkSlot[i] >= 0)
+                        {
+                            IL slotIL;
+                            slotIL.i = sinkSlot[i];
+                            instIL.inst = (void*)&Interpreter::_op_newlocal;
+                            translated.push_back(std::move(instIL));
+                            translated.push_back(std::move(immIL));
+                            translated.push_back(std::move(slotIL));
+                            break;
+                        }
                         translated.push_back(std::move(instIL));
                         translated.push_back(std::move(immIL));
                     }
@@ -433,7 +889,8 @@ std::vector<IL> LibraryLoader::TranslateFn(
                 case OpCode::stmem:
                     {
                     auto& fdName = std::get<std::string>(line.oprand);
-                    auto idx = ResolveMemberName(fdName, libs);
+                    int width = 1;
+                    auto idx = ResolveMemberName(fdName, libs, &width);
 
                     if (idx < 0)
                     {
@@ -443,8 +900,43 @@ std::vector<IL> LibraryLoader::TranslateFn(
                     IL immIL, instIL;
                     immIL.i = idx;
                     instIL.inst = opFn;
+                    if (width > 1)
+                    {
+                        instIL.inst = line.opcode == OpCode::ldmem ?
+                            (void*)&Interpreter::_op_ldmemn : (void*)&Interpreter::_op_stmemn;
+                    }
+                    //Packed host types keep fields as native lanes
+                    auto owner = ResolveTypeName(MemberOwnerName(fdName), libs);
+                    if (owner != nullptr && owner->IsPacked())
+                    {
+                        instIL.inst = line.opcode == OpCode::ldmem ?
+                            (void*)&Interpreter::_op_ldlane : (void*)&Interpreter::_op_stlane;
+                    }
+                    //Table rows, the row type is checked against the table
+                    if (owner != nullptr && owner->isColumnar)
+                    {
+                        if (width > 1)
+                        {
+                            reg.RegisterIfError("Columnar field spans several slots: " + fdName);
+                            return std::vector<IL>();
+                        }
+                        IL ownerIL;
+                        instIL.inst = line.opcode == OpCode::ldmem ?
+                            (void*)&Interpreter::_op_ldcol : (void*)&Interpreter::_op_stcol;
+                        ownerIL.inst = owner;
+                        translated.push_back(std::move(instIL));
+                        translated.push_back(std::move(immIL));
+                        translated.push_back(std::move(ownerIL));
+                        break;
+                    }
                     translated.push_back(std::move(instIL));
                     translated.push_back(std::move(immIL));
+                    if (width > 1)
+                    {
+                        IL widthIL;
+                        widthIL.i = width;
+                        translated.push_back(std::move(widthIL));
+                    }
                     }
                 break;
                 //2 immediate args: type, field
@@ -452,7 +944,8 @@ std::vector<IL> LibraryLoader::TranslateFn(
                 case OpCode::ststatic:
                 {
                     auto& fdName = std::get<std::string>(line.oprand);
-                    auto res = ResolveStaticMemberName(fdName, libs);
+                    int width = 1;
+                    auto res = ResolveStaticMemberName(fdName, libs, &width);
                     auto table = std::get<0>(res);
                     auto idx = std::get<1>(res);
 
@@ -465,9 +958,20 @@ std::vector<IL> LibraryLoader::TranslateFn(
                     immIL.inst = table;
                     imm2IL.i = idx;
                     instIL.inst = opFn;
+                    if (width > 1)
+                    {
+                        instIL.inst = line.opcode == OpCode::ldstatic ?
+                            (void*)&Interpreter::_op_ldstaticn : (void*)&Interpreter::_op_ststaticn;
+                    }
                     translated.push_back(std::move(instIL)); //Op
                     translated.push_back(std::move(immIL));  //Type
                     translated.push_back(std::move(imm2IL)); //Idx
+                    if (width > 1)
+                    {
+                        IL widthIL;
+                        widthIL.i = width;
+                        translated.push_back(std::move(widthIL)); //Width
+                    }
                 }
                     break;
 
@@ -484,6 +988,7 @@ std::vector<IL> LibraryLoader::TranslateFn(
                         reg.RegisterIfError("Function not found: " + name);
                         return std::vector<IL>();
                     }
+                    if (sinkSlot[i] >= 0) EmitSinkNext(translated, i);
                     IL immIL, imm2IL, instIL;
                     immIL.inst = table;
                     imm2IL.i = idx;
@@ -494,6 +999,22 @@ std::vector<IL> LibraryLoader::TranslateFn(
                     }
                     break;
 
+                //Literal text is kept by the loader, payload cache
+                //is filled on first run
+                case OpCode::ldstr:
+                    {
+                        strLiterals.push_back(std::make_unique<std::string>(
+                            std::get<std::string>(line.oprand)));
+                        IL instIL, textIL, cacheIL;
+                        instIL.inst = opFn;
+                        textIL.inst = strLiterals.back().get();
+                        cacheIL.inst = nullptr;
+                        translated.push_back(std::move(instIL));
+                        translated.push_back(std::move(textIL));
+                        translated.push_back(std::move(cacheIL));
+                    }
+                    break;
+
                 //Compiler directives:
                 case OpCode::d_embed:
                 {
@@ -515,7 +1036,8 @@ std::vector<IL> LibraryLoader::TranslateFn(
                         return std::vector<IL>();
                     }
                     //IL immIL = fnBlk->body[0];
-                    translated.push_back(fnBlk->body[0]);
+                    if (sinkSlot[i] >= 0) EmitSinkNext(translated, i, &fnBlk->body[0]);
+                    else translated.push_back(fnBlk->body[0]);
                 }
                     break;
 
@@ -57,6 +57,11 @@ class MethodInfoBase
 public:
     std::string name;
     bool isStatic;
+    //Constant methods neither keep nor return their arguments. A
+    //reference type result may be sunk into the caller's frame: the
+    //first object of its type the call allocates goes there, so it
+    //must be the result. The slot is dropped when the call returns,
+    //used or not
     bool isConstant;
     bool isEmbeddable;
     std::vector<FieldInfo> rets, args;
@@ -160,6 +165,10 @@ public:
     std::string parent;
     bool isReferenceType;
     bool isImplicitConstructable;
+    //Host data layout, see TypeTable::packedSize
+    std::uint32_t packedSize = 0;
+    bool isArray = false;
+    bool isColumnar = false;
     //todo: interface maps..
     //std::vector<std::string> ifaces;
     std::vector<std::shared_ptr<MethodInfoBase>> methods;
@@ -214,6 +223,13 @@ public:
         return Method(method);
     }
     ClassInfo* RefType(bool isRefType = true){isReferenceType = isRefType; return this;}
+    //Instances hold bytes of native data, fields map to 32bit lanes
+    ClassInfo* Packed(std::uint32_t bytes){packedSize = bytes; isReferenceType = true; return this;}
+    //Instances are created by host and accessed with ldlen/ldelem/stelem
+    ClassInfo* ArrayType(){isArray = true; isReferenceType = true; return this;}
+    //Rows live in a Table|Table, one column per field slot. ldmem/stmem
+    //on its fields take (table, row) in place of the object
+    ClassInfo* Columnar(){isColumnar = true; isReferenceType = true; return this;}
     std::string GetLibName() const;
 };
 
@@ -264,10 +280,61 @@ public:
     TypeTable* parentType;
     bool isReferenceType;
     bool isImplicitConstructable;
+    //Non zero for packed host types: instances are blobs of this size
+    //and field i is the 32bit lane at byte offset 4*i
+    std::uint32_t packedSize = 0;
+    //Array instances, see ArrayHeader
+    bool isArray = false;
+    //Row types of tables, see ClassInfo::Columnar
+    bool isColumnar = false;
+    //Storage column of each field slot, ColumnRef set for reference
+    //columns. Only built for columnar types
+    static constexpr std::uint32_t ColumnRef = 0x80000000u;
+    std::vector<std::uint32_t> columns;
+    std::uint32_t primColumns = 0, refColumns = 0;
     virtual bool IsReferenceType()const{return isReferenceType;}
+    bool IsPacked()const{return packedSize != 0;}
     //Interface map
     std::vector<MethodBlock*> methodTable;
+    //Value type struct fields are flattened, one leaf type per slot
     std::vector<TypeTable*> fields, staticFields;
+    //Bit i set when field slot i is a reference, the GC skips the other
+    //slots of instances. None if a field type is unknown, or for types
+    //made by the engine, their instances are scanned slot by slot
+    std::vector<std::uint64_t> refMap;
+    bool hasRefMap = false, isLeaf = false;
+    //Fresh instance image: ValueType slots typed after fields, zeroes
+    //for packed types. Built on first allocation, copied by NewRefTypeObject
+    std::vector<std::uint8_t> prototype;
+    bool hasPrototype = false;
+    //GC kind of instances, see ManagedObjectCtrlBlock::RawKind
+    std::uint8_t objKind = 0;
+
+    //Slots taken by a value of this type on the stack or inside a field,
+    //value type structs are stored inline, one slot per leaf field
+    int SlotCount() const
+    {
+        return (IsReferenceType() || fields.empty()) ? 1 : (int)fields.size();
+    }
+
+    void BuildRefMap()
+    {
+        refMap.assign((fields.size() + 63) / 64, 0);
+        isLeaf = true;
+        for (std::size_t i = 0; i < fields.size(); i++)
+        {
+            if (fields[i] == nullptr)
+            {
+                refMap.clear();
+                isLeaf = false;
+                return;
+            }
+            if (!fields[i]->IsReferenceType()) continue;
+            refMap[i / 64] |= 1ull << (i % 64);
+            isLeaf = false;
+        }
+        hasRefMap = true;
+    }
 
     virtual ~TypeTable(){}
 };
@@ -280,6 +347,14 @@ public:
     bool isEmbeddable;
     std::vector<TypeTable*> args, rets;
     std::vector<IL> body;
+
+    //Stack slots taken by args and rets, value type structs are flattened
+    int argSlots = 0, retSlots = 0;
+
+    //Frame local storage reserved on call, holds sunk allocations
+    std::size_t localBytes = 0;
+    //Bytecode lines whose allocation was sunk into the frame
+    std::vector<int> sunkSites;
 };
 
 
@@ -296,6 +371,8 @@ public:
     std::vector<std::shared_ptr<LibraryInfo>> libs;
     std::vector<LibBlock> compiledLibs;
     std::vector<std::unique_ptr<MethodBlock>> compiledMethods;
+    //Text of ldstr literals, compiled code points into it
+    std::vector<std::unique_ptr<std::string>> strLiterals;
     LibBlock hostWrapper;
 
     class _StatReg
@@ -355,12 +432,13 @@ public:
 
     //Function table for types
 
-    int _ResolveMemberName(const std::string& name, const std::string& thisLib);
-    int ResolveMemberName(const std::string& name, std::vector<std::string>& libs)
+    //Returns first slot of the field, width receives slot count
+    int _ResolveMemberName(const std::string& name, const std::string& thisLib, int* width = nullptr);
+    int ResolveMemberName(const std::string& name, std::vector<std::string>& libs, int* width = nullptr)
     {
         for (auto& lib : libs)
         {
-            auto res = _ResolveMemberName(name, lib);
+            auto res = _ResolveMemberName(name, lib, width);
             if (res >= 0)
             {
                 return res;
@@ -370,13 +448,16 @@ public:
         return -1;
     }
 
+    //Owner of a field if it's a columnar type, see ClassInfo::Columnar
+    TypeTable* ResolveColumnarOwner(const std::string& name, std::vector<std::string>& libs);
 
-    std::tuple<TypeTable*, int> _ResolveStaticMemberName(const std::string& name, const std::string& thisLib);
-    std::tuple<TypeTable*, int> ResolveStaticMemberName(const std::string& name, std::vector<std::string>& libs)
+
+    std::tuple<TypeTable*, int> _ResolveStaticMemberName(const std::string& name, const std::string& thisLib, int* width = nullptr);
+    std::tuple<TypeTable*, int> ResolveStaticMemberName(const std::string& name, std::vector<std::string>& libs, int* width = nullptr)
     {
         for (auto& lib : libs)
         {
-            auto res = _ResolveStaticMemberName(name, lib);
+            auto res = _ResolveStaticMemberName(name, lib, width);
             if (std::get<0>(res) != nullptr)
             {
                 return res;
@@ -387,6 +468,24 @@ public:
     }
 
 
+    //Replace non escaping allocations with frame local slots
+    bool enableAllocSinking = true;
+
+    struct SinkPlan
+    {
+        //Slot offset for each bytecode line, -1 if not sunk
+        std::vector<int> slotOffset;
+        std::size_t localBytes = 0;
+    };
+
+    /**
+     * \brief Intra-method escape analysis. Objects from newobj and constant
+     * host methods that never reach a field, a static, a return value or an
+     * unknown call get a slot in the frame instead of the heap.
+     */
+    SinkPlan AnalyzeEscape(MethodInfoBase* fnInfo, const std::vector<Instruction>& bytecode,
+                           std::vector<std::string>& libs, _StatReg& reg);
+
     std::vector<IL> TranslateFn(MethodInfoBase* fnInfo,
                                 std::vector<std::string>& libs, LibraryLoader::_StatReg& reg);
 
@@ -398,6 +497,8 @@ public:
     std::unordered_map<std::string, TypeTable*> typeMap;
     std::unordered_map<std::string, MethodBlock*> methodMap;
     std::unordered_map<std::string, int> fieldMap, staticFieldMap;
+    //Slot count of value type struct fields, absent means 1
+    std::unordered_map<std::string, int> fieldWidthMap, staticFieldWidthMap;
 
     void ClearCompiled()
     {
@@ -407,9 +508,11 @@ public:
         //Maps
         typeMap.clear(); methodMap.clear();
         fieldMap.clear(); staticFieldMap.clear();
+        fieldWidthMap.clear(); staticFieldWidthMap.clear();
 
         //Compiled bins
         compiledMethods.clear();
+        strLiterals.clear();
         compiledLibs.clear();
     }
 
@@ -427,6 +530,9 @@ public:
                 table->name = type->name;
                 table->isReferenceType = type->isReferenceType;
                 table->isImplicitConstructable = type->isImplicitConstructable;
+                table->packedSize = type->packedSize;
+                table->isArray = type->isArray;
+                table->isColumnar = type->isColumnar;
                 block.types.emplace_back(table);
 
                 auto typeName = lib->name + "|" + type->name;
@@ -443,6 +549,8 @@ public:
                     fnBlk->isEmbeddable = fn->isEmbeddable;
                     fnBlk->args.resize(fn->args.size());
                     fnBlk->rets.resize(fn->rets.size());
+                    fnBlk->argSlots = fn->args.size();
+                    fnBlk->retSlots = fn->rets.size();
 
                     mlut[fn.get()] = fnBlk;
 
@@ -499,17 +607,88 @@ public:
         return fdIter->second;
     }
 
+    int LookupFieldWidth(const std::string& name, bool isStatic = false) const
+    {
+        auto& widths = isStatic ? staticFieldWidthMap : fieldWidthMap;
+        auto fdIter = widths.find(name);
+        if (fdIter == widths.end())
+        {
+            return 1;
+        }
+
+        return fdIter->second;
+    }
+
+    //Value types declaring fields are stored flattened into their holder
+    bool IsValueStruct(TypeTable* ty)
+    {
+        for (; ty != nullptr && !ty->IsReferenceType(); ty = ty->parentType)
+        {
+            auto info = tlut[ty];
+            if (info != nullptr && !info->fields.empty()) return true;
+        }
+        return false;
+    }
+
+    //Append slots of a field, expanding value type structs in place.
+    //Nested members are registered as "field.member"
+    void FlattenField(
+        TypeTable* fieldType,
+        const std::string& name,
+        std::vector<TypeTable*>& slots,
+        std::unordered_map<std::string, int>& lut,
+        std::unordered_map<std::string, int>& widthLut,
+        _StatReg& sreg,
+        int depth
+    )
+    {
+        int idx = slots.size();
+        lut[name] = idx;
+        if (!IsValueStruct(fieldType))
+        {
+            slots.push_back(fieldType);
+            return;
+        }
+
+        if (depth > 16)
+        {
+            sreg.RegisterIfError("Recursive value type:" + fieldType->name);
+            return;
+        }
+
+        //Parent tree first, same as reference type layout
+        std::vector<TypeTable*> chain;
+        for (auto ty = fieldType; ty != nullptr; ty = ty->parentType)
+        {
+            chain.insert(chain.begin(), ty);
+        }
+        for (auto ty : chain)
+        {
+            auto info = tlut[ty];
+            if (info == nullptr) continue;
+            for (auto& member : info->fields)
+            {
+                auto memberType = _ResolveTypeName(member.type, info->GetLibName());
+                if (memberType == nullptr) sreg.RegisterIfError("Unknown type:" + member.type);
+                FlattenField(memberType, name + "." + member.name, slots, lut, widthLut, sreg, depth + 1);
+            }
+        }
+        widthLut[name] = slots.size() - idx;
+    }
+
     void PopulateFields(
         TypeTable* src,
         TypeTable* dst,
         const std::string& thisLib,
         _StatReg& sreg,
         std::unordered_map<std::string, int>& fieldLut,
-        std::unordered_map<std::string, int>& sfieldLut
+        std::unordered_map<std::string, int>& sfieldLut,
+        std::unordered_map<std::string, int>& widthLut,
+        std::unordered_map<std::string, int>& swidthLut
     )
     {
         if (src->parentType != nullptr){
-            PopulateFields(src->parentType, dst, thisLib, sreg, fieldLut, sfieldLut);
+            PopulateFields(src->parentType, dst, thisLib, sreg, fieldLut, sfieldLut, widthLut, swidthLut);
         }
 
         auto info = tlut[src];
@@ -520,9 +699,7 @@ public:
             auto& typeName = field.type;
             auto typTabl = _ResolveTypeName(typeName, thisLib);
             if(typTabl == nullptr) sreg.RegisterIfError("Unknown type:" + typeName);
-            int idx = dst->fields.size();
-            fieldLut[field.name] = idx;
-            dst->fields.push_back(typTabl);
+            FlattenField(typTabl, field.name, dst->fields, fieldLut, widthLut, sreg, 0);
         }
         //And static fields
         for (auto& field : info->staticFields)
@@ -530,10 +707,20 @@ public:
             auto& typeName = field.type;
             auto typTabl = _ResolveTypeName(typeName, thisLib);
             if (typTabl == nullptr) sreg.RegisterIfError("Unknown type:" + typeName);
-            int idx = dst->fields.size();
-            sfieldLut[field.name] = idx;
-            dst->staticFields.push_back(typTabl);
+            FlattenField(typTabl, field.name, dst->staticFields, sfieldLut, swidthLut, sreg, 0);
+        }
+    }
+
+    int SlotsOf(const std::vector<FieldInfo>& list, const std::string& thisLib, std::vector<TypeTable*>& types)
+    {
+        int slots = 0;
+        types.resize(list.size());
+        for (std::size_t i = 0; i < list.size(); i++)
+        {
+            types[i] = _ResolveTypeName(list[i].type, thisLib);
+            slots += types[i] == nullptr ? 1 : types[i]->SlotCount();
         }
+        return slots;
     }
 
     void PopulateMethodTable(
@@ -576,6 +763,19 @@ public:
     _StatReg CompileRegistered()
     {
         _StatReg sreg;
+        //Resolve parents first, layouts of value type
+        //structs may be needed before their own turn
+        for(decltype(libs.size()) il = 0; il < libs.size(); il++)
+        {
+            auto& origLib = libs[il];
+            auto& cmpLib = compiledLibs[il];
+            for(decltype(origLib->types.size()) it = 0; it < origLib->types.size(); it++)
+            {
+                auto parentType = _ResolveTypeName(origLib->types[it]->parent, origLib->name);
+                cmpLib.types[it]->parentType = parentType;
+            }
+        }
+
         //Populate tables
         for(decltype(libs.size()) il = 0; il < libs.size(); il++)
         {
@@ -591,14 +791,23 @@ public:
                 auto typeName = origLib->name + "|" + origType->name;
                 sreg.Log("Registering class:" + origType->name);
 
-                //parent info
-                auto parentType = _ResolveTypeName(origType->parent, origLib->name);
-                cmpType->parentType = parentType;
-
                 ////Populate fields
-                std::unordered_map<std::string, int> fieldIdx, sfieldIdx;
+                std::unordered_map<std::string, int> fieldIdx, sfieldIdx, fieldWidth, sfieldWidth;
 
-                PopulateFields(cmpType.get(), cmpType.get(), origLib->name, sreg, fieldIdx, sfieldIdx);
+                PopulateFields(cmpType.get(), cmpType.get(), origLib->name, sreg,
+                               fieldIdx, sfieldIdx, fieldWidth, sfieldWidth);
+                cmpType->BuildRefMap();
+
+                //Plain 32bit values share one column block, references another
+                if (cmpType->isColumnar)
+                {
+                    for (auto fdType : cmpType->fields)
+                    {
+                        bool isRef = fdType == nullptr || fdType->IsReferenceType();
+                        cmpType->columns.push_back(isRef ?
+                            (cmpType->refColumns++ | TypeTable::ColumnRef) : cmpType->primColumns++);
+                    }
+                }
 
                 //Populate tables
                 for (auto& kv : fieldIdx)
@@ -615,6 +824,16 @@ public:
                     staticFieldMap[fdName] = fdIdx;
                 }
 
+                for (auto& kv : fieldWidth)
+                {
+                    fieldWidthMap[typeName + "|" + kv.first] = kv.second;
+                }
+
+                for (auto& kv : sfieldWidth)
+                {
+                    staticFieldWidthMap[typeName + "|" + kv.first] = kv.second;
+                }
+
                 std::unordered_map<std::string, int> methodTableIdx;
                 //And functions
                 PopulateMethodTable(cmpType.get(), cmpType.get(), origLib->name, methodTableIdx);
@@ -630,6 +849,20 @@ public:
             }
         }
 
+        //Frame layouts, all field layouts are known by now
+        for (auto& lib : libs)
+        {
+            for (auto& type : lib->types)
+            {
+                for (auto& fn : type->methods)
+                {
+                    MethodBlock* fnBlk = mlut[fn.get()];
+                    fnBlk->argSlots = SlotsOf(fn->args, lib->name, fnBlk->args);
+                    fnBlk->retSlots = SlotsOf(fn->rets, lib->name, fnBlk->rets);
+                }
+            }
+        }
+
         //Compile functions
         for (auto& lib : libs)
         {
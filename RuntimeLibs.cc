@@ -2,6 +2,10 @@
 
 #include "Interpreter.h"
 #include <cmath>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <charconv>
 
 /* ValueType.data:
 *       std::int32_t value;
@@ -283,127 +287,183 @@ std::shared_ptr<LibraryInfo> RuntimeLibs::Num()
 }
 
 
-template<int _Dim>
-void VecLen(Interpreter* intp)
+//Packed vector payload, every Vec type uses 4 lanes and keeps
+//the lanes past its dimension at zero
+struct alignas(16) PackedVec
 {
-    auto x = (ValueType*)intp->valueStack.back().data.obj;
-    auto fltType = x[0].type;
+    float v[4];
+};
 
-    float len = 0;
-    for(int i = 0; i < _Dim; i++)
-    {
-        len += FLOAT(x[i]) * FLOAT(x[i]);
+#define VEC(vt) (*(PackedVec*)(vt).data.obj)
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define VEC_USE_SSE
+#include <xmmintrin.h>
+
+static inline __m128 VecLaneMask(int dim)
+{
+    alignas(16) static const std::uint32_t masks[5][4] = {
+        {0, 0, 0, 0},
+        {~0u, 0, 0, 0},
+        {~0u, ~0u, 0, 0},
+        {~0u, ~0u, ~0u, 0},
+        {~0u, ~0u, ~0u, ~0u},
+    };
+    return _mm_load_ps((const float*)masks[dim]);
+}
+
+#define VecArithKernel(name, op) \
+    static inline void VecKernel_##name(PackedVec& r, const PackedVec& a, const PackedVec& b, int dim) { \
+        auto res = _mm_##name##_ps(_mm_load_ps(a.v), _mm_load_ps(b.v)); \
+        _mm_store_ps(r.v, _mm_and_ps(res, VecLaneMask(dim))); \
     }
 
-    len = std::sqrt(len);
-    intp->valueStack.back() = ValueType(fltType);
-    intp->valueStack.back().data.fval = len;
+static inline void VecKernel_neg(PackedVec& r, const PackedVec& a, int /*dim*/)
+{
+    _mm_store_ps(r.v, _mm_sub_ps(_mm_setzero_ps(), _mm_load_ps(a.v)));
 }
 
+static inline float VecDot(const PackedVec& a, const PackedVec& b)
+{
+    auto m = _mm_mul_ps(_mm_load_ps(a.v), _mm_load_ps(b.v));
+    auto s = _mm_add_ps(m, _mm_movehl_ps(m, m));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(s);
+}
 
-template<int _Dim>
-void VecLen2(Interpreter* intp)
+static inline void VecScale(PackedVec& r, const PackedVec& a, float s)
 {
-    auto x = (ValueType*)intp->valueStack.back().data.obj;
-    auto fltType = x[0].type;
+    _mm_store_ps(r.v, _mm_mul_ps(_mm_load_ps(a.v), _mm_set1_ps(s)));
+}
 
-    float len = 0;
-    for (int i = 0; i < _Dim; i++)
-    {
-        len += FLOAT(x[i]) * FLOAT(x[i]);
+static inline void VecKernel_cross(PackedVec& r, const PackedVec& a, const PackedVec& b, int /*dim*/)
+{
+    auto va = _mm_load_ps(a.v);
+    auto vb = _mm_load_ps(b.v);
+    //a.yzx * b.zxy - a.zxy * b.yzx, w stays 0
+    auto a_yzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+    auto b_yzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+    auto c = _mm_sub_ps(_mm_mul_ps(va, b_yzx), _mm_mul_ps(a_yzx, vb));
+    _mm_store_ps(r.v, _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+#else
+
+#define VecArithKernel(name, op) \
+    static inline void VecKernel_##name(PackedVec& r, const PackedVec& a, const PackedVec& b, int dim) { \
+        for (int i = 0; i < dim; i++) r.v[i] = a.v[i] op b.v[i]; \
     }
 
-    intp->valueStack.back() = ValueType(fltType);
-    intp->valueStack.back().data.fval = len;
+static inline void VecKernel_neg(PackedVec& r, const PackedVec& a, int dim)
+{
+    for (int i = 0; i < dim; i++) r.v[i] = -a.v[i];
+}
+
+static inline float VecDot(const PackedVec& a, const PackedVec& b)
+{
+    return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2] + a.v[3] * b.v[3];
+}
+
+static inline void VecScale(PackedVec& r, const PackedVec& a, float s)
+{
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] * s;
+}
+
+static inline void VecKernel_cross(PackedVec& r, const PackedVec& a, const PackedVec& b, int /*dim*/)
+{
+    r.v[0] = a.v[1] * b.v[2] - a.v[2] * b.v[1];
+    r.v[1] = a.v[2] * b.v[0] - a.v[0] * b.v[2];
+    r.v[2] = a.v[0] * b.v[1] - a.v[1] * b.v[0];
+}
+
+#endif
+
+FOREACH_ARITH(VecArithKernel)
+
+//No vector form for these, run them lane by lane
+#define VecUnaryFnKernel(name) \
+    static inline void VecKernel_##name(PackedVec& r, const PackedVec& a, int dim) { \
+        for (int i = 0; i < dim; i++) r.v[i] = name(a.v[i]); \
+    }
+
+FOREACH_TRIG(VecUnaryFnKernel)
+FOREACH_COMMON(VecUnaryFnKernel)
+
+static inline void VecKernel_normalize(PackedVec& r, const PackedVec& a, int /*dim*/)
+{
+    float len2 = VecDot(a, a);
+    if (len2 > 0)
+    {
+        VecScale(r, a, 1.0f / std::sqrt(len2));
+    }
 }
 
-#define VecBinaryMethodWrapper(name, body) \
+
+//Operands are read after allocating the result, GC may move them
+#define VecBinaryMethodWrapper(name, dim, kernel) \
 void name(Interpreter* intp){ \
-    auto last = intp->valueStack.end() - 1;\
-    auto x = (ValueType*)(*(last - 1)).data.obj;\
-    auto y = (ValueType*)(*(last)).data.obj;\
-    /*auto fltType = x[0].type;*/\
-    auto vecType = last->type;\
+    auto vecType = intp->valueStack.back().type;\
     auto newVec = intp->NewRefTypeObject(vecType);\
-    auto r = (ValueType*)newVec.data.obj; \
-    body \
+    auto last = intp->valueStack.end() - 1;\
+    kernel(VEC(newVec), VEC(*(last - 1)), VEC(*last), dim); \
     intp->valueStack.pop_back(); \
     intp->valueStack.back() = newVec; \
 }
 
-#define VecUnaryMethodWrapper(name, body) \
+#define VecUnaryMethodWrapper(name, dim, kernel) \
 void name(Interpreter* intp){ \
-    auto x = (ValueType*)intp->valueStack.back().data.obj;\
-    /*auto fltType = x[0].type;*/\
     auto vecType = intp->valueStack.back().type;\
     auto newVec = intp->NewRefTypeObject(vecType);\
-    auto r = (ValueType*)newVec.data.obj; \
-    body \
+    kernel(VEC(newVec), VEC(intp->valueStack.back()), dim); \
     intp->valueStack.back() = newVec; \
 }
 
-#define VecBinaryOPExpr(op, a, b) (a) op (b)
-#define VecBinaryFnExpr(op, a, b) op((a), (b))
-#define VecUnaryOPExpr(op, a) op (a)
-#define VecUnaryFnExpr(op, a) op((a))
-
-#define Vec2BinaryBody(expr, op) \
-    FLOAT(r[0]) = expr(op, FLOAT(x[0]), FLOAT(y[0]) ); \
-    FLOAT(r[1]) = expr(op, FLOAT(x[1]), FLOAT(y[1]) );
-
-#define Vec2UnaryBody(expr, op) \
-    FLOAT(r[0]) = expr(op, FLOAT(x[0]) ); \
-    FLOAT(r[1]) = expr(op, FLOAT(x[1]) );
-
-#define Vec3BinaryBody(expr, op) \
-    FLOAT(r[0]) = expr(op, FLOAT(x[0]), FLOAT(y[0]) ); \
-    FLOAT(r[1]) = expr(op, FLOAT(x[1]), FLOAT(y[1]) ); \
-    FLOAT(r[2]) = expr(op, FLOAT(x[2]), FLOAT(y[2]) );
-
-#define Vec3UnaryBody(expr, op) \
-    FLOAT(r[0]) = expr(op, FLOAT(x[0]) ); \
-    FLOAT(r[1]) = expr(op, FLOAT(x[1]) ); \
-    FLOAT(r[2]) = expr(op, FLOAT(x[2]) ); 
-
-#define Vec4BinaryBody(expr, op) \
-    FLOAT(r[0]) = expr(op, FLOAT(x[0]), FLOAT(y[0]) ); \
-    FLOAT(r[1]) = expr(op, FLOAT(x[1]), FLOAT(y[1]) ); \
-    FLOAT(r[2]) = expr(op, FLOAT(x[2]), FLOAT(y[2]) ); \
-    FLOAT(r[3]) = expr(op, FLOAT(x[3]), FLOAT(y[3]) );
-
-#define Vec4UnaryBody(expr, op) \
-    FLOAT(r[0]) = expr(op, FLOAT(x[0]) ); \
-    FLOAT(r[1]) = expr(op, FLOAT(x[1]) ); \
-    FLOAT(r[2]) = expr(op, FLOAT(x[2]) ); \
-    FLOAT(r[3]) = expr(op, FLOAT(x[3]) );
+//Result goes into the type of x lanes
+#define VecScalarMethodWrapper(name, expr) \
+void name(Interpreter* intp){ \
+    auto last = intp->valueStack.end() - 1;\
+    auto fltType = last->type->fields[0];\
+    float res = (expr);\
+    *last = ValueType(fltType);\
+    FLOAT(*last) = res;\
+}
 
 #define VecMethodName(dim, type, name) _FVEC##dim##_##type##_##name
 #define VecBinMethodName(dim, name) VecMethodName(dim, BIN, name)
 #define VecUnMethodName(dim, name) VecMethodName(dim, UN, name)
 
-#define VecBinaryMethod(name, expr, op) \
-    VecBinaryMethodWrapper(VecBinMethodName(2,name), Vec2BinaryBody(expr, op))\
-    VecBinaryMethodWrapper(VecBinMethodName(3,name), Vec3BinaryBody(expr, op))\
-    VecBinaryMethodWrapper(VecBinMethodName(4,name), Vec4BinaryBody(expr, op))
+#define VecBinaryMethod(name, ...) \
+    VecBinaryMethodWrapper(VecBinMethodName(2,name), 2, VecKernel_##name)\
+    VecBinaryMethodWrapper(VecBinMethodName(3,name), 3, VecKernel_##name)\
+    VecBinaryMethodWrapper(VecBinMethodName(4,name), 4, VecKernel_##name)
 
-#define VecUnaryMethod(name, expr, op) \
-    VecUnaryMethodWrapper(VecUnMethodName(2,name), Vec2UnaryBody(expr, op))\
-    VecUnaryMethodWrapper(VecUnMethodName(3,name), Vec3UnaryBody(expr, op))\
-    VecUnaryMethodWrapper(VecUnMethodName(4,name), Vec4UnaryBody(expr, op))
+#define VecUnaryMethod(name, ...) \
+    VecUnaryMethodWrapper(VecUnMethodName(2,name), 2, VecKernel_##name)\
+    VecUnaryMethodWrapper(VecUnMethodName(3,name), 3, VecKernel_##name)\
+    VecUnaryMethodWrapper(VecUnMethodName(4,name), 4, VecKernel_##name)
 
-#define VecBinaryOP(name, op) VecBinaryMethod(name, VecBinaryOPExpr, op)
-#define VecUnaryOP(name, op) VecUnaryMethod(name, VecUnaryOPExpr, op)
+FOREACH_ARITH(VecBinaryMethod)
+VecUnaryMethod(neg)
+VecUnaryMethod(normalize)
 
+FOREACH_TRIG(VecUnaryMethod)
+FOREACH_COMMON(VecUnaryMethod)
 
-#define VecBinaryFn(name) VecBinaryMethod(name, VecBinaryFnExpr, name)
-#define VecUnaryFn(name) VecUnaryMethod(name, VecUnaryFnExpr, name)
+VecBinaryMethodWrapper(VecBinMethodName(3, cross), 3, VecKernel_cross)
 
+//Lanes past the dimension are zero, so these don't depend on it
+VecScalarMethodWrapper(VecLen, std::sqrt(VecDot(VEC(*last), VEC(*last))))
+VecScalarMethodWrapper(VecLen2, VecDot(VEC(*last), VEC(*last)))
 
-FOREACH_ARITH(VecBinaryOP)
-VecUnaryOP(neg, -)
-
-FOREACH_TRIG(VecUnaryFn)
-FOREACH_COMMON(VecUnaryFn)
+void VecDotProduct(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto fltType = last->type->fields[0];
+    float res = VecDot(VEC(*(last - 1)), VEC(*last));
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = ValueType(fltType);
+    FLOAT(intp->valueStack.back()) = res;
+}
 
 #define VecBinWrapper(dim, name, ...) \
     ->Method((new HostMethod(#name, &VecBinMethodName(dim, name))) \
@@ -428,58 +488,3368 @@ FOREACH_COMMON(VecUnaryFn)
 #define VecMethodInfos(dim) \
     FOREACH_ARITH(Vec##dim##BinWrapper)\
     Vec##dim##UnWrapper(neg)\
+    Vec##dim##UnWrapper(normalize)\
     FOREACH_TRIG(Vec##dim##UnWrapper)\
-    FOREACH_COMMON(Vec##dim##UnWrapper)
+    FOREACH_COMMON(Vec##dim##UnWrapper)\
+    ->Method((new HostMethod("length", &VecLen)) \
+        ->Static()->Constant()\
+        ->Arg("x", "Vec|Vec"#dim) \
+        ->Return("res", "Num|Float"))\
+    ->Method((new HostMethod("length2", &VecLen2)) \
+        ->Static()->Constant()\
+        ->Arg("x", "Vec|Vec"#dim) \
+        ->Return("res", "Num|Float"))\
+    ->Method((new HostMethod("dot", &VecDotProduct)) \
+        ->Static()->Constant()\
+        ->Arg("a", "Vec|Vec"#dim) \
+        ->Arg("b", "Vec|Vec"#dim) \
+        ->Return("res", "Num|Float"))
 
 std::shared_ptr<LibraryInfo> RuntimeLibs::Vec()
 {
     static std::shared_ptr<LibraryInfo> vecLib ( (new LibraryInfo("Vec"))
         ->Class((new ClassInfo("Vec2"))
-            ->RefType(true)
+            ->Packed(sizeof(PackedVec))
             ->Field(FieldInfo("x", "Num|Float"))
             ->Field(FieldInfo("y", "Num|Float"))
             VecMethodInfos(2)
-            ->Method((new HostMethod("length", &VecLen<2>)) \
-                ->Static()->Constant()\
-                ->Arg("x", "Vec|Vec2") \
-                ->Return("res", "Num|Float"))
-            ->Method((new HostMethod("length2", &VecLen2<2>)) \
-                ->Static()->Constant()\
-                ->Arg("x", "Vec|Vec2") \
-                ->Return("res", "Num|Float"))
         )
         ->Class((new ClassInfo("Vec3"))
-            ->RefType(true)
+            ->Packed(sizeof(PackedVec))
             ->Field(FieldInfo("x", "Num|Float"))
             ->Field(FieldInfo("y", "Num|Float"))
             ->Field(FieldInfo("z", "Num|Float"))
             VecMethodInfos(3)
-            ->Method((new HostMethod("length", &VecLen<3>)) \
-                ->Static()->Constant()\
-                ->Arg("x", "Vec|Vec3") \
-                ->Return("res", "Num|Float"))
-            ->Method((new HostMethod("length2", &VecLen2<3>)) \
-                ->Static()->Constant()\
-                ->Arg("x", "Vec|Vec3") \
-                ->Return("res", "Num|Float"))
+            Vec3BinWrapper(cross)
         )
         ->Class((new ClassInfo("Vec4"))
-            ->RefType(true)
+            ->Packed(sizeof(PackedVec))
             ->Field(FieldInfo("x", "Num|Float"))
             ->Field(FieldInfo("y", "Num|Float"))
             ->Field(FieldInfo("z", "Num|Float"))
             ->Field(FieldInfo("w", "Num|Float"))
             VecMethodInfos(4)
-            ->Method((new HostMethod("length", &VecLen<4>)) \
-                ->Static()->Constant()\
-                ->Arg("x", "Vec|Vec4") \
-                ->Return("res", "Num|Float"))
-            ->Method((new HostMethod("length2", &VecLen2<4>)) \
-                ->Static()->Constant()\
-                ->Arg("x", "Vec|Vec4") \
-                ->Return("res", "Num|Float"))
         )
         );
 
     return vecLib;
 }
+
+
+//Column major, Mat3 columns are 3 floats wide with no padding
+struct alignas(16) PackedMat3
+{
+    float m[12];
+};
+
+struct alignas(16) PackedMat4
+{
+    float m[16];
+};
+
+#define MAT3(vt) (*(PackedMat3*)(vt).data.obj)
+#define MAT4(vt) (*(PackedMat4*)(vt).data.obj)
+#define QUAT(vt) VEC(vt)
+
+static const float identity4[16] = {
+    1, 0, 0, 0,
+    0, 1, 0, 0,
+    0, 0, 1, 0,
+    0, 0, 0, 1,
+};
+
+static const float identity3[9] = {
+    1, 0, 0,
+    0, 1, 0,
+    0, 0, 1,
+};
+
+#ifdef VEC_USE_SSE
+
+//r = m * v, v has 4 lanes
+static inline __m128 Mat4MulLanes(const __m128* c, __m128 v)
+{
+    auto r = _mm_mul_ps(c[0], _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+    r = _mm_add_ps(r, _mm_mul_ps(c[1], _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+    r = _mm_add_ps(r, _mm_mul_ps(c[2], _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+    r = _mm_add_ps(r, _mm_mul_ps(c[3], _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+    return r;
+}
+
+static inline void Mat4LoadCols(const PackedMat4& m, __m128* c)
+{
+    for (int i = 0; i < 4; i++) c[i] = _mm_load_ps(m.m + 4 * i);
+}
+
+static inline void Mat4MulVec(PackedVec& r, const PackedMat4& m, const PackedVec& v)
+{
+    __m128 c[4];
+    Mat4LoadCols(m, c);
+    _mm_store_ps(r.v, Mat4MulLanes(c, _mm_load_ps(v.v)));
+}
+
+static inline void Mat4Mul(PackedMat4& r, const PackedMat4& a, const PackedMat4& b)
+{
+    __m128 c[4];
+    Mat4LoadCols(a, c);
+    for (int i = 0; i < 4; i++)
+    {
+        _mm_store_ps(r.m + 4 * i, Mat4MulLanes(c, _mm_load_ps(b.m + 4 * i)));
+    }
+}
+
+static inline void Mat4Transpose(PackedMat4& r, const PackedMat4& a)
+{
+    __m128 c[4];
+    Mat4LoadCols(a, c);
+    _MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+    for (int i = 0; i < 4; i++) _mm_store_ps(r.m + 4 * i, c[i]);
+}
+
+//Mat3 columns start at 3 float strides, the 4th lane read is masked off
+static inline void Mat3LoadCols(const PackedMat3& m, __m128* c)
+{
+    auto mask = VecLaneMask(3);
+    for (int i = 0; i < 3; i++) c[i] = _mm_and_ps(_mm_loadu_ps(m.m + 3 * i), mask);
+    c[3] = _mm_setzero_ps();
+}
+
+static inline void Mat3MulVec(PackedVec& r, const PackedMat3& m, const PackedVec& v)
+{
+    __m128 c[4];
+    Mat3LoadCols(m, c);
+    _mm_store_ps(r.v, Mat4MulLanes(c, _mm_load_ps(v.v)));
+}
+
+static inline void Mat3Mul(PackedMat3& r, const PackedMat3& a, const PackedMat3& b)
+{
+    __m128 c[4], bc[4];
+    Mat3LoadCols(a, c);
+    Mat3LoadCols(b, bc);
+    alignas(16) float col[4];
+    for (int i = 0; i < 3; i++)
+    {
+        _mm_store_ps(col, Mat4MulLanes(c, bc[i]));
+        memcpy(r.m + 3 * i, col, 3 * sizeof(float));
+    }
+}
+
+static inline void QuatMul(PackedVec& r, const PackedVec& a, const PackedVec& b)
+{
+    //(a.w*b.xyz + b.w*a.xyz + a.xyz x b.xyz, a.w*b.w - a.xyz . b.xyz)
+    auto va = _mm_load_ps(a.v);
+    auto vb = _mm_load_ps(b.v);
+    auto aw = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 3, 3, 3));
+    auto bw = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 3, 3));
+    auto a_yzx = _mm_shuffle_ps(va, va, _MM_SHUFFLE(3, 0, 2, 1));
+    auto b_yzx = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 0, 2, 1));
+    auto c = _mm_sub_ps(_mm_mul_ps(va, b_yzx), _mm_mul_ps(a_yzx, vb));
+    c = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+    auto xyz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(aw, vb), _mm_mul_ps(bw, va)), c);
+    alignas(16) float res[4];
+    _mm_store_ps(res, xyz);
+    float dot3 = a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+    res[3] = a.v[3] * b.v[3] - dot3;
+    _mm_store_ps(r.v, _mm_load_ps(res));
+}
+
+#else
+
+static inline void Mat4MulVec(PackedVec& r, const PackedMat4& m, const PackedVec& v)
+{
+    PackedVec res = {};
+    for (int col = 0; col < 4; col++)
+        for (int row = 0; row < 4; row++)
+            res.v[row] += m.m[4 * col + row] * v.v[col];
+    r = res;
+}
+
+static inline void Mat4Mul(PackedMat4& r, const PackedMat4& a, const PackedMat4& b)
+{
+    PackedMat4 res = {};
+    for (int col = 0; col < 4; col++)
+        for (int k = 0; k < 4; k++)
+            for (int row = 0; row < 4; row++)
+                res.m[4 * col + row] += a.m[4 * k + row] * b.m[4 * col + k];
+    r = res;
+}
+
+static inline void Mat4Transpose(PackedMat4& r, const PackedMat4& a)
+{
+    PackedMat4 res;
+    for (int col = 0; col < 4; col++)
+        for (int row = 0; row < 4; row++)
+            res.m[4 * col + row] = a.m[4 * row + col];
+    r = res;
+}
+
+static inline void Mat3MulVec(PackedVec& r, const PackedMat3& m, const PackedVec& v)
+{
+    PackedVec res = {};
+    for (int col = 0; col < 3; col++)
+        for (int row = 0; row < 3; row++)
+            res.v[row] += m.m[3 * col + row] * v.v[col];
+    r = res;
+}
+
+static inline void Mat3Mul(PackedMat3& r, const PackedMat3& a, const PackedMat3& b)
+{
+    PackedMat3 res = {};
+    for (int col = 0; col < 3; col++)
+        for (int k = 0; k < 3; k++)
+            for (int row = 0; row < 3; row++)
+                res.m[3 * col + row] += a.m[3 * k + row] * b.m[3 * col + k];
+    r = res;
+}
+
+static inline void QuatMul(PackedVec& r, const PackedVec& a, const PackedVec& b)
+{
+    PackedVec res;
+    res.v[0] = a.v[3] * b.v[0] + a.v[0] * b.v[3] + a.v[1] * b.v[2] - a.v[2] * b.v[1];
+    res.v[1] = a.v[3] * b.v[1] - a.v[0] * b.v[2] + a.v[1] * b.v[3] + a.v[2] * b.v[0];
+    res.v[2] = a.v[3] * b.v[2] + a.v[0] * b.v[1] - a.v[1] * b.v[0] + a.v[2] * b.v[3];
+    res.v[3] = a.v[3] * b.v[3] - a.v[0] * b.v[0] - a.v[1] * b.v[1] - a.v[2] * b.v[2];
+    r = res;
+}
+
+#endif
+
+static inline void Mat3Transpose(PackedMat3& r, const PackedMat3& a)
+{
+    PackedMat3 res = {};
+    for (int col = 0; col < 3; col++)
+        for (int row = 0; row < 3; row++)
+            res.m[3 * col + row] = a.m[3 * row + col];
+    r = res;
+}
+
+//Singular matrices give all zeros
+static inline void Mat3Inverse(PackedMat3& r, const PackedMat3& a)
+{
+    auto m = a.m;
+    PackedMat3 res = {};
+    res.m[0] = m[4] * m[8] - m[7] * m[5];
+    res.m[1] = m[7] * m[2] - m[1] * m[8];
+    res.m[2] = m[1] * m[5] - m[4] * m[2];
+    res.m[3] = m[6] * m[5] - m[3] * m[8];
+    res.m[4] = m[0] * m[8] - m[6] * m[2];
+    res.m[5] = m[3] * m[2] - m[0] * m[5];
+    res.m[6] = m[3] * m[7] - m[6] * m[4];
+    res.m[7] = m[6] * m[1] - m[0] * m[7];
+    res.m[8] = m[0] * m[4] - m[3] * m[1];
+    float det = m[0] * res.m[0] + m[3] * res.m[1] + m[6] * res.m[2];
+    float invDet = det == 0 ? 0 : 1.0f / det;
+    for (int i = 0; i < 9; i++) res.m[i] *= invDet;
+    r = res;
+}
+
+//Cofactor expansion, singular matrices give all zeros
+static inline void Mat4Inverse(PackedMat4& r, const PackedMat4& a)
+{
+    auto m = a.m;
+    PackedMat4 inv;
+    inv.m[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15]
+        + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+    inv.m[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15]
+        - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+    inv.m[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15]
+        + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+    inv.m[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14]
+        - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+    inv.m[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15]
+        - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+    inv.m[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15]
+        + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+    inv.m[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15]
+        - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+    inv.m[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14]
+        + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+    inv.m[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15]
+        + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+    inv.m[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15]
+        - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+    inv.m[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15]
+        + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+    inv.m[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14]
+        - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+    inv.m[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11]
+        - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+    inv.m[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11]
+        + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+    inv.m[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11]
+        - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+    inv.m[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10]
+        + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+    float det = m[0] * inv.m[0] + m[1] * inv.m[4] + m[2] * inv.m[8] + m[3] * inv.m[12];
+    float invDet = det == 0 ? 0 : 1.0f / det;
+    for (int i = 0; i < 16; i++) r.m[i] = inv.m[i] * invDet;
+}
+
+//Rotation part of a unit quaternion, written as 3 columns of stride 4
+static inline void QuatToCols(const PackedVec& q, float* cols)
+{
+    float x = q.v[0], y = q.v[1], z = q.v[2], w = q.v[3];
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z;
+    float wx = w * x, wy = w * y, wz = w * z;
+
+    cols[0] = 1 - 2 * (yy + zz); cols[1] = 2 * (xy + wz);     cols[2] = 2 * (xz - wy);
+    cols[4] = 2 * (xy - wz);     cols[5] = 1 - 2 * (xx + zz); cols[6] = 2 * (yz + wx);
+    cols[8] = 2 * (xz + wy);     cols[9] = 2 * (yz - wx);     cols[10] = 1 - 2 * (xx + yy);
+}
+
+//T * R * S
+static inline void Mat4ComposeTRS(PackedMat4& r, const PackedVec& t, const PackedVec& q, const PackedVec& s)
+{
+    PackedMat4 res = {};
+    QuatToCols(q, res.m);
+    for (int col = 0; col < 3; col++)
+        for (int row = 0; row < 3; row++)
+            res.m[4 * col + row] *= s.v[col];
+    res.m[12] = t.v[0];
+    res.m[13] = t.v[1];
+    res.m[14] = t.v[2];
+    res.m[15] = 1;
+    r = res;
+}
+
+static inline void QuatRotate(PackedVec& r, const PackedVec& q, const PackedVec& v)
+{
+    //v' = v + 2w(q x v) + 2q x (q x v)
+    PackedVec t, u, res;
+    VecKernel_cross(t, q, v, 3);
+    VecScale(t, t, 2);
+    VecKernel_cross(u, q, t, 3);
+    for (int i = 0; i < 3; i++) res.v[i] = v.v[i] + q.v[3] * t.v[i] + u.v[i];
+    res.v[3] = 0;
+    r = res;
+}
+
+
+//Result allocated first, operands are read after GC may have moved them.
+//Binary results take the type of the last operand
+#define MatBinaryMethod(name, body) \
+void name(Interpreter* intp){ \
+    auto res = intp->NewRefTypeObject(intp->valueStack.back().type);\
+    auto last = intp->valueStack.end() - 1;\
+    auto& a = *(last - 1);\
+    auto& b = *last;\
+    auto& r = res;\
+    body;\
+    intp->valueStack.pop_back(); \
+    intp->valueStack.back() = res; \
+}
+
+#define MatUnaryMethod(name, body) \
+void name(Interpreter* intp){ \
+    auto res = intp->NewRefTypeObject(intp->valueStack.back().type);\
+    auto& a = intp->valueStack.back();\
+    auto& r = res;\
+    body;\
+    intp->valueStack.back() = res; \
+}
+
+#define MatNullaryMethod(name, typeName, body) \
+void name(Interpreter* intp){ \
+    auto res = intp->NewRefTypeObject(intp->libLoader.LookupType(typeName));\
+    auto& r = res;\
+    body;\
+    intp->valueStack.push_back(res); \
+}
+
+MatBinaryMethod(_MAT4_mul, Mat4Mul(MAT4(r), MAT4(a), MAT4(b)))
+MatBinaryMethod(_MAT4_mul_vec, Mat4MulVec(VEC(r), MAT4(a), VEC(b)))
+MatBinaryMethod(_MAT4_transform_point,
+    PackedVec p = VEC(b); p.v[3] = 1; Mat4MulVec(VEC(r), MAT4(a), p); VEC(r).v[3] = 0)
+MatBinaryMethod(_MAT4_transform_dir,
+    Mat4MulVec(VEC(r), MAT4(a), VEC(b)); VEC(r).v[3] = 0)
+MatUnaryMethod(_MAT4_transpose, Mat4Transpose(MAT4(r), MAT4(a)))
+MatUnaryMethod(_MAT4_inverse, Mat4Inverse(MAT4(r), MAT4(a)))
+MatNullaryMethod(_MAT4_identity, "Mat|Mat4", memcpy(MAT4(r).m, identity4, sizeof(identity4)))
+
+MatBinaryMethod(_MAT3_mul, Mat3Mul(MAT3(r), MAT3(a), MAT3(b)))
+MatBinaryMethod(_MAT3_mul_vec, Mat3MulVec(VEC(r), MAT3(a), VEC(b)))
+MatUnaryMethod(_MAT3_transpose, Mat3Transpose(MAT3(r), MAT3(a)))
+MatUnaryMethod(_MAT3_inverse, Mat3Inverse(MAT3(r), MAT3(a)))
+MatNullaryMethod(_MAT3_identity, "Mat|Mat3", memcpy(MAT3(r).m, identity3, sizeof(identity3)))
+
+MatBinaryMethod(_QUAT_mul, QuatMul(QUAT(r), QUAT(a), QUAT(b)))
+MatBinaryMethod(_QUAT_rotate, QuatRotate(VEC(r), QUAT(a), VEC(b)))
+MatUnaryMethod(_QUAT_normalize, VecKernel_normalize(QUAT(r), QUAT(a), 4))
+MatUnaryMethod(_QUAT_conjugate,
+    QUAT(r) = QUAT(a); for (int i = 0; i < 3; i++) QUAT(r).v[i] = -QUAT(r).v[i])
+MatNullaryMethod(_QUAT_identity, "Mat|Quat", QUAT(r).v[3] = 1)
+
+//(axis, angle)->Quat
+void _QUAT_from_axis_angle(Interpreter* intp)
+{
+    auto res = intp->NewRefTypeObject(intp->libLoader.LookupType("Mat|Quat"));
+    auto last = intp->valueStack.end() - 1;
+    PackedVec axis = {};
+    VecKernel_normalize(axis, VEC(*(last - 1)), 3);
+    float half = FLOAT(*last) * 0.5f;
+    VecScale(QUAT(res), axis, std::sin(half));
+    QUAT(res).v[3] = std::cos(half);
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(t, r, s)->Mat4
+void _MAT4_trs(Interpreter* intp)
+{
+    auto res = intp->NewRefTypeObject(intp->libLoader.LookupType("Mat|Mat4"));
+    auto last = intp->valueStack.end() - 1;
+    Mat4ComposeTRS(MAT4(res), VEC(*(last - 2)), QUAT(*(last - 1)), VEC(*last));
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+    intp->valueStack.back() = res;
+}
+
+/* (m, vecs)->-2
+ * Applies m in place to the Vec values held by the RefArray vecs, null
+ * and non Vec elements are skipped. Vec4 are transformed as is, smaller
+ * ones as points (w = 1). The matrix stays in registers across the batch
+ * and nothing is allocated.
+ */
+void _MAT4_transform_batch(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& m = MAT4(*(last - 1));
+    auto& vecs = *last;
+    if (vecs.IsNull() || !vecs.type->isArray || !GetCtrlBlk(INST(vecs))->IsRaw())
+    {
+        intp->ReportError("RefArray of Vec expected");
+        return;
+    }
+    auto elems = (ValueType*)INST(vecs);
+    auto n = Interpreter::ArrayLength(vecs);
+    //Quat is packed the same way, so element types are matched by name
+    TypeTable* vecTypes[] = {
+        intp->libLoader.LookupType("Vec|Vec2"),
+        intp->libLoader.LookupType("Vec|Vec3"),
+        intp->libLoader.LookupType("Vec|Vec4"),
+    };
+
+#ifdef VEC_USE_SSE
+    __m128 c[4];
+    Mat4LoadCols(m, c);
+    auto wOne = _mm_set_ps(1, 0, 0, 0);
+#endif
+    for (std::uint32_t i = 0; i < n; i++)
+    {
+        auto& e = elems[i];
+        if (!e.IsRef()) continue;
+        int dim = 2;
+        while (dim <= 4 && e.type != vecTypes[dim - 2]) dim++;
+        if (dim > 4) continue;
+        auto& v = VEC(e);
+#ifdef VEC_USE_SSE
+        auto lanes = _mm_load_ps(v.v);
+        if (dim < 4) lanes = _mm_or_ps(lanes, wOne);
+        _mm_store_ps(v.v, _mm_and_ps(Mat4MulLanes(c, lanes), VecLaneMask(dim)));
+#else
+        PackedVec p = v;
+        if (dim < 4) p.v[3] = 1;
+        Mat4MulVec(p, m, p);
+        for (int lane = dim; lane < 4; lane++) p.v[lane] = 0;
+        v = p;
+#endif
+    }
+
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+}
+
+#define MatBinWrapper(name, fn, aType, bType, retType) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static()->Constant()\
+        ->Arg("a", aType) \
+        ->Arg("b", bType) \
+        ->Return("res", retType))
+
+#define MatUnWrapper(name, fn, xType, retType) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static()->Constant()\
+        ->Arg("x", xType) \
+        ->Return("res", retType))
+
+#define MatCtorWrapper(name, fn, retType) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static()->Constant()\
+        ->Return("res", retType))
+
+#define Mat4Fields \
+    ->Field(FieldInfo("m00", "Num|Float")) ->Field(FieldInfo("m10", "Num|Float")) \
+    ->Field(FieldInfo("m20", "Num|Float")) ->Field(FieldInfo("m30", "Num|Float")) \
+    ->Field(FieldInfo("m01", "Num|Float")) ->Field(FieldInfo("m11", "Num|Float")) \
+    ->Field(FieldInfo("m21", "Num|Float")) ->Field(FieldInfo("m31", "Num|Float")) \
+    ->Field(FieldInfo("m02", "Num|Float")) ->Field(FieldInfo("m12", "Num|Float")) \
+    ->Field(FieldInfo("m22", "Num|Float")) ->Field(FieldInfo("m32", "Num|Float")) \
+    ->Field(FieldInfo("m03", "Num|Float")) ->Field(FieldInfo("m13", "Num|Float")) \
+    ->Field(FieldInfo("m23", "Num|Float")) ->Field(FieldInfo("m33", "Num|Float"))
+
+#define Mat3Fields \
+    ->Field(FieldInfo("m00", "Num|Float")) ->Field(FieldInfo("m10", "Num|Float")) \
+    ->Field(FieldInfo("m20", "Num|Float")) \
+    ->Field(FieldInfo("m01", "Num|Float")) ->Field(FieldInfo("m11", "Num|Float")) \
+    ->Field(FieldInfo("m21", "Num|Float")) \
+    ->Field(FieldInfo("m02", "Num|Float")) ->Field(FieldInfo("m12", "Num|Float")) \
+    ->Field(FieldInfo("m22", "Num|Float"))
+
+std::shared_ptr<LibraryInfo> RuntimeLibs::Mat()
+{
+    static std::shared_ptr<LibraryInfo> matLib ( (new LibraryInfo("Mat"))
+        ->Deps({ "Num", "Vec", "Arr" })
+        ->Class((new ClassInfo("Mat3"))
+            ->Packed(sizeof(PackedMat3))
+            Mat3Fields
+            MatBinWrapper("mul", _MAT3_mul, "Mat|Mat3", "Mat|Mat3", "Mat|Mat3")
+            MatBinWrapper("mul_vec", _MAT3_mul_vec, "Mat|Mat3", "Vec|Vec3", "Vec|Vec3")
+            MatUnWrapper("transpose", _MAT3_transpose, "Mat|Mat3", "Mat|Mat3")
+            MatUnWrapper("inverse", _MAT3_inverse, "Mat|Mat3", "Mat|Mat3")
+            MatCtorWrapper("identity", _MAT3_identity, "Mat|Mat3")
+        )
+        ->Class((new ClassInfo("Mat4"))
+            ->Packed(sizeof(PackedMat4))
+            Mat4Fields
+            MatBinWrapper("mul", _MAT4_mul, "Mat|Mat4", "Mat|Mat4", "Mat|Mat4")
+            MatBinWrapper("mul_vec", _MAT4_mul_vec, "Mat|Mat4", "Vec|Vec4", "Vec|Vec4")
+            MatBinWrapper("transform_point", _MAT4_transform_point, "Mat|Mat4", "Vec|Vec3", "Vec|Vec3")
+            MatBinWrapper("transform_dir", _MAT4_transform_dir, "Mat|Mat4", "Vec|Vec3", "Vec|Vec3")
+            MatUnWrapper("transpose", _MAT4_transpose, "Mat|Mat4", "Mat|Mat4")
+            MatUnWrapper("inverse", _MAT4_inverse, "Mat|Mat4", "Mat|Mat4")
+            MatCtorWrapper("identity", _MAT4_identity, "Mat|Mat4")
+            ->Method((new HostMethod("trs", &_MAT4_trs))
+                ->Static()->Constant()
+                ->Arg("t", "Vec|Vec3")
+                ->Arg("r", "Mat|Quat")
+                ->Arg("s", "Vec|Vec3")
+                ->Return("res", "Mat|Mat4"))
+            //Not constant, mutates the Vec values held by vecs
+            ->Method((new HostMethod("transform_batch", &_MAT4_transform_batch))
+                ->Static()
+                ->Arg("m", "Mat|Mat4")
+                ->Arg("vecs", "Arr|RefArray"))
+        )
+        ->Class((new ClassInfo("Quat"))
+            ->Packed(sizeof(PackedVec))
+            ->Field(FieldInfo("x", "Num|Float"))
+            ->Field(FieldInfo("y", "Num|Float"))
+            ->Field(FieldInfo("z", "Num|Float"))
+            ->Field(FieldInfo("w", "Num|Float"))
+            MatBinWrapper("mul", _QUAT_mul, "Mat|Quat", "Mat|Quat", "Mat|Quat")
+            MatBinWrapper("rotate", _QUAT_rotate, "Mat|Quat", "Vec|Vec3", "Vec|Vec3")
+            MatUnWrapper("normalize", _QUAT_normalize, "Mat|Quat", "Mat|Quat")
+            MatUnWrapper("conjugate", _QUAT_conjugate, "Mat|Quat", "Mat|Quat")
+            MatCtorWrapper("identity", _QUAT_identity, "Mat|Quat")
+            ->Method((new HostMethod("from_axis_angle", &_QUAT_from_axis_angle))
+                ->Static()->Constant()
+                ->Arg("axis", "Vec|Vec3")
+                ->Arg("angle", "Num|Float")
+                ->Return("res", "Mat|Quat"))
+        )
+        );
+
+    return matLib;
+}
+
+
+//(n)->arr
+template<bool isRef>
+void _ARR_new(Interpreter* intp, const char* arrName, const char* elemName)
+{
+    auto n = INT32(intp->valueStack.back());
+    if (n < 0)
+    {
+        intp->ReportError("Negative array length");
+        return;
+    }
+    auto arrTy = intp->libLoader.LookupType(arrName);
+    auto arr = isRef ?
+        intp->NewRefArray(arrTy, n) :
+        intp->NewPrimArray(arrTy, intp->libLoader.LookupType(elemName), n);
+    intp->valueStack.back() = arr;
+}
+
+void _INTARR_new(Interpreter* intp) { _ARR_new<false>(intp, "Arr|IntArray", "Num|Int"); }
+void _FLOATARR_new(Interpreter* intp) { _ARR_new<false>(intp, "Arr|FloatArray", "Num|Float"); }
+void _REFARR_new(Interpreter* intp) { _ARR_new<true>(intp, "Arr|RefArray", nullptr); }
+
+static bool ArrCheckRange(Interpreter* intp, const ValueType& arr, std::int32_t idx, std::int32_t n)
+{
+    if (arr.IsNull() || !arr.type->isArray)
+    {
+        intp->ReportError("Array expected");
+        return false;
+    }
+    auto len = Interpreter::ArrayLength(arr);
+    if (idx < 0 || n < 0 || (std::uint32_t)idx + (std::uint32_t)n > len)
+    {
+        intp->ReportError("Array index out of range: " + std::to_string(idx));
+        return false;
+    }
+    return true;
+}
+
+//(arr)->len
+void _ARR_length(Interpreter* intp)
+{
+    auto& arr = intp->valueStack.back();
+    if (!ArrCheckRange(intp, arr, 0, 0)) return;
+    ValueType len(intp->libLoader.LookupType("Num|Int"));
+    INT32(len) = Interpreter::ArrayLength(arr);
+    arr = len;
+}
+
+//(arr, v)->-2
+void _ARR_fill(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& arr = *(last - 1);
+    auto& v = *last;
+    if (!ArrCheckRange(intp, arr, 0, 0)) return;
+
+    auto len = Interpreter::ArrayLength(arr);
+    if (GetCtrlBlk(INST(arr))->IsRaw())
+    {
+        for (std::uint32_t i = 0; i < len; i++)
+        {
+            intp->gc.WriteField(v, arr, i, true);
+        }
+    }
+    else
+    {
+        auto header = (ArrayHeader*)INST(arr);
+        if (!Interpreter::IsElementOf(v, header))
+        {
+            intp->ReportError("Array element type mismatch: "
+                + (v.type ? v.type->name : "null") + " != " + header->elemType->name);
+            return;
+        }
+        std::fill_n(header->Elements<std::int32_t>(), len, INT32(v));
+    }
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+}
+
+//(dst, dstIdx, src, srcIdx, n)->-5
+void _ARR_copy(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& dst = *(last - 4);
+    auto dstIdx = INT32(*(last - 3));
+    auto& src = *(last - 2);
+    auto srcIdx = INT32(*(last - 1));
+    auto n = INT32(*last);
+    if (!ArrCheckRange(intp, dst, dstIdx, n) || !ArrCheckRange(intp, src, srcIdx, n)) return;
+
+    //IntArray and FloatArray share a layout, not a meaning
+    bool dstRaw = GetCtrlBlk(INST(dst))->IsRaw();
+    if (src.type != dst.type)
+    {
+        intp->ReportError("Array copy between incompatible types: "
+            + src.type->name + " -> " + dst.type->name);
+        return;
+    }
+
+    if (dstRaw)
+    {
+        //Element wise so the write barrier sees every store,
+        //copy backwards when the ranges overlap
+        auto elems = (ValueType*)INST(src);
+        if (INST(src) == INST(dst) && srcIdx < dstIdx)
+        {
+            for (auto i = n - 1; i >= 0; i--)
+                intp->gc.WriteField(elems[srcIdx + i], dst, dstIdx + i, true);
+        }
+        else
+        {
+            for (std::int32_t i = 0; i < n; i++)
+                intp->gc.WriteField(elems[srcIdx + i], dst, dstIdx + i, true);
+        }
+    }
+    else
+    {
+        memmove(((ArrayHeader*)INST(dst))->Elements<std::int32_t>() + dstIdx,
+            ((ArrayHeader*)INST(src))->Elements<std::int32_t>() + srcIdx,
+            n * sizeof(std::int32_t));
+    }
+    intp->valueStack.erase(last - 4, intp->valueStack.end());
+}
+
+//Bulk kernels over primitive arrays, one call processes a whole buffer.
+//AVX2 versions are compiled with a target attribute and picked at startup
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BULK_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define BULK_AVX2
+#else
+#define BULK_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+static bool CpuHasAvx2()
+{
+#if !defined(BULK_X86)
+    return false;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuid(r, 0);
+    if (r[0] < 7) return false;
+    __cpuid(r, 1);
+    bool fma = r[2] & (1 << 12);
+    bool osxsave = r[2] & (1 << 27);
+    //OS must save ymm state
+    if (!fma || !osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(r, 7, 0);
+    return r[1] & (1 << 5);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+static const bool bulkUseAvx2 = CpuHasAvx2();
+
+#ifdef BULK_X86
+template<typename T> struct BulkReg;
+
+template<>
+struct BulkReg<float>
+{
+    using Reg = __m256;
+    static BULK_AVX2 Reg Load(const float* p) { return _mm256_loadu_ps(p); }
+    static BULK_AVX2 void Store(float* p, Reg v) { _mm256_storeu_ps(p, v); }
+    static BULK_AVX2 Reg Splat(float x) { return _mm256_set1_ps(x); }
+};
+
+template<>
+struct BulkReg<std::int32_t>
+{
+    using Reg = __m256i;
+    static BULK_AVX2 Reg Load(const std::int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static BULK_AVX2 void Store(std::int32_t* p, Reg v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static BULK_AVX2 Reg Splat(std::int32_t x) { return _mm256_set1_epi32(x); }
+};
+
+//Ops without a Vec overload for an element type run scalar only
+template<typename T>
+static auto BulkLoadOf() -> decltype(BulkReg<T>::Load(nullptr));
+
+template<typename Op, typename T>
+constexpr auto BulkHasVec1(int) -> decltype(Op::Vec(BulkLoadOf<T>()), bool()) { return true; }
+template<typename Op, typename T>
+constexpr bool BulkHasVec1(...) { return false; }
+
+template<typename Op, typename T>
+constexpr auto BulkHasVec2(int) -> decltype(Op::Vec(BulkLoadOf<T>(), BulkLoadOf<T>()), bool()) { return true; }
+template<typename Op, typename T>
+constexpr bool BulkHasVec2(...) { return false; }
+#endif
+
+struct BulkOp_add
+{
+    template<typename T> static T Scalar(T x, T y) { return x + y; }
+    template<typename T> static T Identity() { return 0; }
+#ifdef BULK_X86
+    static BULK_AVX2 __m256 Vec(__m256 x, __m256 y) { return _mm256_add_ps(x, y); }
+    static BULK_AVX2 __m256i Vec(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+#endif
+};
+
+struct BulkOp_sub
+{
+    template<typename T> static T Scalar(T x, T y) { return x - y; }
+#ifdef BULK_X86
+    static BULK_AVX2 __m256 Vec(__m256 x, __m256 y) { return _mm256_sub_ps(x, y); }
+    static BULK_AVX2 __m256i Vec(__m256i x, __m256i y) { return _mm256_sub_epi32(x, y); }
+#endif
+};
+
+struct BulkOp_mul
+{
+    template<typename T> static T Scalar(T x, T y) { return x * y; }
+#ifdef BULK_X86
+    static BULK_AVX2 __m256 Vec(__m256 x, __m256 y) { return _mm256_mul_ps(x, y); }
+    static BULK_AVX2 __m256i Vec(__m256i x, __m256i y) { return _mm256_mullo_epi32(x, y); }
+#endif
+};
+
+//No integer division in AVX2
+struct BulkOp_div
+{
+    template<typename T> static T Scalar(T x, T y) { return x / y; }
+#ifdef BULK_X86
+    static BULK_AVX2 __m256 Vec(__m256 x, __m256 y) { return _mm256_div_ps(x, y); }
+#endif
+};
+
+struct BulkOp_min
+{
+    template<typename T> static T Scalar(T x, T y) { return y < x ? y : x; }
+    template<typename T> static T Identity() { return std::numeric_limits<T>::has_infinity ?
+        std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max(); }
+#ifdef BULK_X86
+    static BULK_AVX2 __m256 Vec(__m256 x, __m256 y) { return _mm256_min_ps(x, y); }
+    static BULK_AVX2 __m256i Vec(__m256i x, __m256i y) { return _mm256_min_epi32(x, y); }
+#endif
+};
+
+struct BulkOp_max
+{
+    template<typename T> static T Scalar(T x, T y) { return x < y ? y : x; }
+    template<typename T> static T Identity() { return std::numeric_limits<T>::has_infinity ?
+        -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::min(); }
+#ifdef BULK_X86
+    static BULK_AVX2 __m256 Vec(__m256 x, __m256 y) { return _mm256_max_ps(x, y); }
+    static BULK_AVX2 __m256i Vec(__m256i x, __m256i y) { return _mm256_max_epi32(x, y); }
+#endif
+};
+
+struct BulkOp_neg
+{
+    template<typename T> static T Scalar(T x) { return -x; }
+#ifdef BULK_X86
+    static BULK_AVX2 __m256 Vec(__m256 x) { return _mm256_xor_ps(x, _mm256_set1_ps(-0.0f)); }
+    static BULK_AVX2 __m256i Vec(__m256i x) { return _mm256_sub_epi32(_mm256_setzero_si256(), x); }
+#endif
+};
+
+//Same libm calls as the scalar Num methods, only the dispatch is saved
+#define BulkFnUnOp(fn) \
+    struct BulkOp_##fn { static float Scalar(float x) { return fn(x); } };
+#define BulkFnBinOp(fn) \
+    struct BulkOp_##fn { static float Scalar(float x, float y) { return fn(x, y); } };
+
+FOREACH_TRIG(BulkFnUnOp)
+BulkFnUnOp(exp)
+BulkFnUnOp(log)
+BulkFnUnOp(log10)
+BulkFnUnOp(cbrt)
+BulkFnBinOp(atan2)
+BulkFnBinOp(pow)
+BulkFnBinOp(fmod)
+
+struct BulkOp_sqrt
+{
+    static float Scalar(float x) { return sqrt(x); }
+#ifdef BULK_X86
+    static BULK_AVX2 __m256 Vec(__m256 x) { return _mm256_sqrt_ps(x); }
+#endif
+};
+
+//Comparisons produce 0/1 like the scalar ones
+#ifdef BULK_X86
+#define BulkCmpVec(fpred, ivec) \
+    static BULK_AVX2 __m256i Vec(__m256 x, __m256 y) { \
+        return _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(x, y, fpred)), _mm256_set1_epi32(1)); } \
+    static BULK_AVX2 __m256i Vec(__m256i x, __m256i y) { \
+        return _mm256_and_si256(ivec, _mm256_set1_epi32(1)); }
+#else
+#define BulkCmpVec(fpred, ivec)
+#endif
+
+#define BulkCmpOp(name, op, fpred, ivec) \
+    struct BulkOp_##name { \
+        template<typename T> static std::int32_t Scalar(T x, T y) { return (x)op(y); } \
+        BulkCmpVec(fpred, ivec) \
+    };
+
+//Low bit is all that's kept, so a plain xor inverts
+#define BULK_NOT(v) _mm256_xor_si256(v, _mm256_set1_epi32(1))
+BulkCmpOp(greater_than, >,  _CMP_GT_OQ,  _mm256_cmpgt_epi32(x, y))
+BulkCmpOp(less_than,    <,  _CMP_LT_OQ,  _mm256_cmpgt_epi32(y, x))
+BulkCmpOp(equal,        ==, _CMP_EQ_OQ,  _mm256_cmpeq_epi32(x, y))
+BulkCmpOp(not_greater,  <=, _CMP_LE_OQ,  BULK_NOT(_mm256_cmpgt_epi32(x, y)))
+BulkCmpOp(not_less,     >=, _CMP_GE_OQ,  BULK_NOT(_mm256_cmpgt_epi32(y, x)))
+BulkCmpOp(not_equal,    !=, _CMP_NEQ_UQ, BULK_NOT(_mm256_cmpeq_epi32(x, y)))
+
+//d = op(a)
+template<typename Op, typename T>
+static void BulkUnaryScalar(T* d, const T* a, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) d[i] = Op::Scalar(a[i]);
+}
+
+//d = op(a, b)
+template<typename Op, typename T, typename D>
+static void BulkBinaryScalar(D* d, const T* a, const T* b, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++) d[i] = Op::Scalar(a[i], b[i]);
+}
+
+//d = a * b + c
+template<typename T>
+static void BulkFmaScalar(T* d, const T* a, const T* b, const T* c, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; i++)
+    {
+        if constexpr (std::is_floating_point_v<T>) d[i] = std::fma(a[i], b[i], c[i]);
+        else d[i] = a[i] * b[i] + c[i];
+    }
+}
+
+template<typename Op, typename T>
+static T BulkReduceScalar(const T* a, std::size_t n, T acc)
+{
+    for (std::size_t i = 0; i < n; i++) acc = Op::template Scalar<T>(acc, a[i]);
+    return acc;
+}
+
+template<typename T>
+static T BulkDotScalar(const T* a, const T* b, std::size_t n, T acc)
+{
+    for (std::size_t i = 0; i < n; i++) acc += a[i] * b[i];
+    return acc;
+}
+
+template<typename T>
+static void BulkPrefixScalar(T* d, const T* a, std::size_t n, T acc)
+{
+    for (std::size_t i = 0; i < n; i++) d[i] = acc = acc + a[i];
+}
+
+#ifdef BULK_X86
+template<typename Op, typename T>
+static BULK_AVX2 void BulkUnaryAvx2(T* d, const T* a, std::size_t n)
+{
+    using R = BulkReg<T>;
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) R::Store(d + i, Op::Vec(R::Load(a + i)));
+    BulkUnaryScalar<Op>(d + i, a + i, n - i);
+}
+
+template<typename Op, typename T, typename D>
+static BULK_AVX2 void BulkBinaryAvx2(D* d, const T* a, const T* b, std::size_t n)
+{
+    using R = BulkReg<T>;
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) BulkReg<D>::Store(d + i, Op::Vec(R::Load(a + i), R::Load(b + i)));
+    BulkBinaryScalar<Op>(d + i, a + i, b + i, n - i);
+}
+
+template<typename T>
+static BULK_AVX2 void BulkFmaAvx2(T* d, const T* a, const T* b, const T* c, std::size_t n)
+{
+    using R = BulkReg<T>;
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+            R::Store(d + i, _mm256_fmadd_ps(R::Load(a + i), R::Load(b + i), R::Load(c + i)));
+        else
+            R::Store(d + i, _mm256_add_epi32(
+                _mm256_mullo_epi32(R::Load(a + i), R::Load(b + i)), R::Load(c + i)));
+    }
+    BulkFmaScalar(d + i, a + i, b + i, c + i, n - i);
+}
+
+//Four independent accumulators to hide the add latency
+template<typename Op, typename T>
+static BULK_AVX2 T BulkReduceAvx2(const T* a, std::size_t n, T acc)
+{
+    using R = BulkReg<T>;
+    auto id = R::Splat(Op::template Identity<T>());
+    auto acc0 = id, acc1 = id, acc2 = id, acc3 = id;
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        acc0 = Op::Vec(acc0, R::Load(a + i));
+        acc1 = Op::Vec(acc1, R::Load(a + i + 8));
+        acc2 = Op::Vec(acc2, R::Load(a + i + 16));
+        acc3 = Op::Vec(acc3, R::Load(a + i + 24));
+    }
+    for (; i + 8 <= n; i += 8) acc0 = Op::Vec(acc0, R::Load(a + i));
+    acc0 = Op::Vec(Op::Vec(acc0, acc1), Op::Vec(acc2, acc3));
+
+    alignas(32) T lanes[8];
+    R::Store(lanes, acc0);
+    acc = BulkReduceScalar<Op>(lanes, 8, acc);
+    return BulkReduceScalar<Op>(a + i, n - i, acc);
+}
+
+template<typename T>
+static BULK_AVX2 T BulkDotAvx2(const T* a, const T* b, std::size_t n, T acc)
+{
+    using R = BulkReg<T>;
+    auto acc0 = R::Splat(0), acc1 = R::Splat(0);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            acc0 = _mm256_fmadd_ps(R::Load(a + i), R::Load(b + i), acc0);
+            acc1 = _mm256_fmadd_ps(R::Load(a + i + 8), R::Load(b + i + 8), acc1);
+        }
+        else
+        {
+            acc0 = _mm256_add_epi32(acc0, _mm256_mullo_epi32(R::Load(a + i), R::Load(b + i)));
+            acc1 = _mm256_add_epi32(acc1, _mm256_mullo_epi32(R::Load(a + i + 8), R::Load(b + i + 8)));
+        }
+    }
+
+    alignas(32) T lanes[8];
+    R::Store(lanes, BulkOp_add::Vec(acc0, acc1));
+    acc = BulkReduceScalar<BulkOp_add>(lanes, 8, acc);
+    return BulkDotScalar(a + i, b + i, n - i, acc);
+}
+
+//In register scan over 4 lanes: x += x << 1 lane, x += x << 2 lanes
+template<typename T>
+static BULK_AVX2 void BulkPrefixAvx2(T* d, const T* a, std::size_t n, T acc)
+{
+    std::size_t i = 0;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        auto carry = _mm_set1_ps(acc);
+        for (; i + 4 <= n; i += 4)
+        {
+            auto x = _mm_loadu_ps(a + i);
+            x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+            x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+            x = _mm_add_ps(x, carry);
+            _mm_storeu_ps(d + i, x);
+            carry = _mm_shuffle_ps(x, x, 0xFF);
+        }
+        acc = _mm_cvtss_f32(carry);
+    }
+    else
+    {
+        auto carry = _mm_set1_epi32(acc);
+        for (; i + 4 <= n; i += 4)
+        {
+            auto x = _mm_loadu_si128((const __m128i*)(a + i));
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi32(x, carry);
+            _mm_storeu_si128((__m128i*)(d + i), x);
+            carry = _mm_shuffle_epi32(x, 0xFF);
+        }
+        acc = _mm_cvtsi128_si32(carry);
+    }
+    BulkPrefixScalar(d + i, a + i, n - i, acc);
+}
+#endif
+
+template<typename Op, typename T>
+static void BulkUnary(T* d, const T* a, std::size_t n)
+{
+#ifdef BULK_X86
+    if constexpr (BulkHasVec1<Op, T>(0))
+    {
+        if (bulkUseAvx2) return BulkUnaryAvx2<Op>(d, a, n);
+    }
+#endif
+    BulkUnaryScalar<Op>(d, a, n);
+}
+
+template<typename Op, typename T, typename D>
+static void BulkBinary(D* d, const T* a, const T* b, std::size_t n)
+{
+#ifdef BULK_X86
+    if constexpr (BulkHasVec2<Op, T>(0))
+    {
+        if (bulkUseAvx2) return BulkBinaryAvx2<Op>(d, a, b, n);
+    }
+#endif
+    BulkBinaryScalar<Op>(d, a, b, n);
+}
+
+template<typename T>
+static void BulkFma(T* d, const T* a, const T* b, const T* c, std::size_t n)
+{
+#ifdef BULK_X86
+    if (bulkUseAvx2) return BulkFmaAvx2(d, a, b, c, n);
+#endif
+    BulkFmaScalar(d, a, b, c, n);
+}
+
+template<typename Op, typename T>
+static T BulkReduce(const T* a, std::size_t n)
+{
+    T acc = Op::template Identity<T>();
+#ifdef BULK_X86
+    if (bulkUseAvx2) return BulkReduceAvx2<Op>(a, n, acc);
+#endif
+    return BulkReduceScalar<Op>(a, n, acc);
+}
+
+template<typename T>
+static T BulkDot(const T* a, const T* b, std::size_t n)
+{
+#ifdef BULK_X86
+    if (bulkUseAvx2) return BulkDotAvx2(a, b, n, T(0));
+#endif
+    return BulkDotScalar(a, b, n, T(0));
+}
+
+template<typename T>
+static void BulkPrefix(T* d, const T* a, std::size_t n)
+{
+#ifdef BULK_X86
+    if (bulkUseAvx2) return BulkPrefixAvx2(d, a, n, T(0));
+#endif
+    BulkPrefixScalar(d, a, n, T(0));
+}
+
+//Element pointer of a primitive array. Takes the length from the
+//first array of a call (n == BulkAnyLen), later ones must match it
+static constexpr std::uint32_t BulkAnyLen = ~0u;
+
+template<typename T>
+static T* BulkData(Interpreter* intp, const ValueType& arr, std::uint32_t& n)
+{
+    if (arr.IsNull() || !arr.type->isArray || GetCtrlBlk(INST(arr))->IsRaw())
+    {
+        intp->ReportError("Primitive array expected");
+        return nullptr;
+    }
+    //Int and float kernels would read each other's bits
+    auto expected = intp->libLoader.LookupType(std::is_same_v<T, float> ? "Arr|FloatArray" : "Arr|IntArray");
+    if (arr.type != expected)
+    {
+        intp->ReportError("Array type mismatch: " + arr.type->name + " != " + expected->name);
+        return nullptr;
+    }
+    auto header = (ArrayHeader*)INST(arr);
+    if (n == BulkAnyLen) n = header->length;
+    else if (header->length != n)
+    {
+        intp->ReportError("Array length mismatch: "
+            + std::to_string(header->length) + " != " + std::to_string(n));
+        return nullptr;
+    }
+    return header->Elements<T>();
+}
+
+//(dst, src)->-2
+template<typename Op, typename T>
+void BulkUnaryMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto n = BulkAnyLen;
+    auto d = BulkData<T>(intp, *(last - 1), n);
+    auto a = d ? BulkData<T>(intp, *last, n) : nullptr;
+    if (a == nullptr) return;
+
+    BulkUnary<Op>(d, a, n);
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+}
+
+//(dst, a, b)->-3, dst is an IntArray for comparisons
+template<typename Op, typename T, typename D = T>
+void BulkBinaryMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto n = BulkAnyLen;
+    auto d = BulkData<D>(intp, *(last - 2), n);
+    auto a = d ? BulkData<T>(intp, *(last - 1), n) : nullptr;
+    auto b = a ? BulkData<T>(intp, *last, n) : nullptr;
+    if (b == nullptr) return;
+
+    BulkBinary<Op>(d, a, b, n);
+    intp->valueStack.erase(last - 2, intp->valueStack.end());
+}
+
+//(dst, a, b, c)->-4
+template<typename T>
+void BulkFmaMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto n = BulkAnyLen;
+    auto d = BulkData<T>(intp, *(last - 3), n);
+    auto a = d ? BulkData<T>(intp, *(last - 2), n) : nullptr;
+    auto b = a ? BulkData<T>(intp, *(last - 1), n) : nullptr;
+    auto c = b ? BulkData<T>(intp, *last, n) : nullptr;
+    if (c == nullptr) return;
+
+    BulkFma(d, a, b, c, n);
+    intp->valueStack.erase(last - 3, intp->valueStack.end());
+}
+
+//(dst, src)->-2, inclusive
+template<typename T>
+void BulkPrefixMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto n = BulkAnyLen;
+    auto d = BulkData<T>(intp, *(last - 1), n);
+    auto a = d ? BulkData<T>(intp, *last, n) : nullptr;
+    if (a == nullptr) return;
+
+    BulkPrefix(d, a, n);
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+}
+
+template<typename T>
+static ValueType BulkScalarResult(Interpreter* intp, T x)
+{
+    ValueType res(intp->libLoader.LookupType(
+        std::is_floating_point_v<T> ? "Num|Float" : "Num|Int"));
+    if constexpr (std::is_floating_point_v<T>) FLOAT(res) = x;
+    else INT32(res) = x;
+    return res;
+}
+
+//(a)->res, min and max of an empty array are the op identity
+template<typename Op, typename T>
+void BulkReduceMethod(Interpreter* intp)
+{
+    auto n = BulkAnyLen;
+    auto a = BulkData<T>(intp, intp->valueStack.back(), n);
+    if (a == nullptr) return;
+
+    intp->valueStack.back() = BulkScalarResult(intp, BulkReduce<Op>(a, n));
+}
+
+//(a, b)->res
+template<typename T>
+void BulkDotMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto n = BulkAnyLen;
+    auto a = BulkData<T>(intp, *(last - 1), n);
+    auto b = a ? BulkData<T>(intp, *last, n) : nullptr;
+    if (b == nullptr) return;
+
+    auto res = BulkScalarResult(intp, BulkDot(a, b, n));
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+#define BulkUnWrapper(name, T, arrType) \
+    ->Method((new HostMethod(#name, &BulkUnaryMethod<BulkOp_##name, T>)) \
+        ->Static() \
+        ->Arg("dst", arrType) \
+        ->Arg("src", arrType))
+
+#define BulkBinWrapper(name, T, arrType) \
+    ->Method((new HostMethod(#name, &BulkBinaryMethod<BulkOp_##name, T>)) \
+        ->Static() \
+        ->Arg("dst", arrType) \
+        ->Arg("a", arrType) \
+        ->Arg("b", arrType))
+
+#define BulkCmpWrapper(name, T, arrType) \
+    ->Method((new HostMethod(#name, &BulkBinaryMethod<BulkOp_##name, T, std::int32_t>)) \
+        ->Static() \
+        ->Arg("mask", "Arr|IntArray") \
+        ->Arg("a", arrType) \
+        ->Arg("b", arrType))
+
+#define BulkReduceWrapper(name, op, T, arrType, resType) \
+    ->Method((new HostMethod(#name, &BulkReduceMethod<BulkOp_##op, T>)) \
+        ->Static()->Constant() \
+        ->Arg("a", arrType) \
+        ->Return("res", resType))
+
+#define BulkMethodInfos(T, arrType, resType) \
+    ->Method((new HostMethod("fma", &BulkFmaMethod<T>)) \
+        ->Static() \
+        ->Arg("dst", arrType) \
+        ->Arg("a", arrType) \
+        ->Arg("b", arrType) \
+        ->Arg("c", arrType)) \
+    ->Method((new HostMethod("prefix_sum", &BulkPrefixMethod<T>)) \
+        ->Static() \
+        ->Arg("dst", arrType) \
+        ->Arg("src", arrType)) \
+    ->Method((new HostMethod("dot", &BulkDotMethod<T>)) \
+        ->Static()->Constant() \
+        ->Arg("a", arrType) \
+        ->Arg("b", arrType) \
+        ->Return("res", resType)) \
+    BulkReduceWrapper(sum, add, T, arrType, resType) \
+    BulkReduceWrapper(min, min, T, arrType, resType) \
+    BulkReduceWrapper(max, max, T, arrType, resType) \
+    BulkUnWrapper(neg, T, arrType)
+
+#define BulkFloatBinWrapper(name, ...) BulkBinWrapper(name, float, "Arr|FloatArray")
+#define BulkFloatUnWrapper(name, ...) BulkUnWrapper(name, float, "Arr|FloatArray")
+#define BulkFloatCmpWrapper(name, ...) BulkCmpWrapper(name, float, "Arr|FloatArray")
+#define BulkIntBinWrapper(name, ...) BulkBinWrapper(name, std::int32_t, "Arr|IntArray")
+#define BulkIntCmpWrapper(name, ...) BulkCmpWrapper(name, std::int32_t, "Arr|IntArray")
+
+#define ArrMethodInfos(arrType, elemType, newFn) \
+    ->ArrayType() \
+    ->Method((new HostMethod("new", &newFn)) \
+        ->Static() \
+        ->Arg("n", "Num|Int") \
+        ->Return("arr", arrType)) \
+    ->Method((new HostMethod("length", &_ARR_length)) \
+        ->Static()->Constant() \
+        ->Arg("arr", arrType) \
+        ->Return("len", "Num|Int")) \
+    ->Method((new HostMethod("fill", &_ARR_fill)) \
+        ->Static() \
+        ->Arg("arr", arrType) \
+        ->Arg("v", elemType)) \
+    ->Method((new HostMethod("copy", &_ARR_copy)) \
+        ->Static() \
+        ->Arg("dst", arrType) \
+        ->Arg("dstIdx", "Num|Int") \
+        ->Arg("src", arrType) \
+        ->Arg("srcIdx", "Num|Int") \
+        ->Arg("n", "Num|Int"))
+
+std::shared_ptr<LibraryInfo> RuntimeLibs::Arr()
+{
+    static std::shared_ptr<LibraryInfo> arrLib ( (new LibraryInfo("Arr"))
+        ->Deps({ "Num" })
+        ->Class((new ClassInfo("IntArray"))
+            ArrMethodInfos("Arr|IntArray", "Num|Int", _INTARR_new)
+            BulkMethodInfos(std::int32_t, "Arr|IntArray", "Num|Int")
+            FOREACH_ARITH(BulkIntBinWrapper)
+            CMP(BulkIntCmpWrapper)
+        )
+        ->Class((new ClassInfo("FloatArray"))
+            ArrMethodInfos("Arr|FloatArray", "Num|Float", _FLOATARR_new)
+            BulkMethodInfos(float, "Arr|FloatArray", "Num|Float")
+            FOREACH_ARITH(BulkFloatBinWrapper)
+            BulkFloatBinWrapper(atan2)
+            BulkFloatBinWrapper(pow)
+            BulkFloatBinWrapper(fmod)
+            FOREACH_TRIG(BulkFloatUnWrapper)
+            FOREACH_COMMON(BulkFloatUnWrapper)
+            CMP(BulkFloatCmpWrapper)
+        )
+        //Elements keep their own type
+        ->Class((new ClassInfo("RefArray"))
+            ArrMethodInfos("Arr|RefArray", "", _REFARR_new)
+        )
+        );
+
+    return arrLib;
+}
+
+
+#define STR(vt) Interpreter::StrView(vt)
+
+//(a, b)->Str
+void _STR_concat(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto lenA = STR(*(last - 1)).size();
+    auto lenB = STR(*last).size();
+    if (lenB == 0)
+    {
+        intp->valueStack.pop_back();
+        return;
+    }
+
+    auto res = intp->NewStrBuffer(lenA + lenB);
+    //Allocation may move the operands
+    last = intp->valueStack.end() - 1;
+    auto bytes = Interpreter::StrBytes(res);
+    memcpy(bytes, STR(*(last - 1)).data(), lenA);
+    memcpy(bytes + lenA, STR(*last).data(), lenB);
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(s, begin, end)->Str, [begin, end)
+void _STR_slice(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto len = STR(*(last - 2)).size();
+    auto begin = INT32(*(last - 1));
+    auto end = INT32(*last);
+    if (begin < 0 || end < begin || (std::size_t)end > len)
+    {
+        intp->ReportError("String index out of range: "
+            + std::to_string(begin) + ", " + std::to_string(end));
+        return;
+    }
+
+    auto res = intp->NewStrBuffer(end - begin);
+    last = intp->valueStack.end() - 1;
+    memcpy(Interpreter::StrBytes(res), STR(*(last - 2)).data() + begin, end - begin);
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+    intp->valueStack.back() = res;
+}
+
+//(s, sub)->Int, -1 if not found
+void _STR_find(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto pos = STR(*(last - 1)).find(STR(*last));
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = pos == std::string_view::npos ? -1 : (std::int32_t)pos;
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(a, b)->Int, -1, 0 or 1 in byte order
+void _STR_compare(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto cmp = Interpreter::StrEqual(*(last - 1), *last) ? 0 : STR(*(last - 1)).compare(STR(*last));
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = (cmp > 0) - (cmp < 0);
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(a, b)->Int
+void _STR_equal(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = Interpreter::StrEqual(*(last - 1), *last);
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(s)->Int
+void _STR_length(Interpreter* intp)
+{
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = (std::int32_t)STR(intp->valueStack.back()).size();
+    intp->valueStack.back() = res;
+}
+
+//(s)->Int
+void _STR_hash(Interpreter* intp)
+{
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = (std::int32_t)Interpreter::StrHash(intp->valueStack.back());
+    intp->valueStack.back() = res;
+}
+
+//(s)->Str
+void _STR_intern(Interpreter* intp)
+{
+    auto& s = intp->valueStack.back();
+    if (!s.IsRef() || (((StrHeader*)INST(s))->flags & StrHeader::Interned)) return;
+    auto iter = intp->internedStrs.find(STR(s));
+    if (iter != intp->internedStrs.end())
+    {
+        s = iter->second;
+        return;
+    }
+    //Interning allocates, copy out of the managed heap first
+    std::string text(STR(s));
+    auto res = intp->InternStr(text);
+    intp->valueStack.back() = res;
+}
+
+/* StrBuilder keeps a heap Str as its buffer. The header length is the
+ * used part, the rest of the blob is spare capacity, so appends only
+ * copy when the buffer doubles.
+ */
+static StrHeader* SbBuffer(const ValueType& sb)
+{
+    auto& buf = ((ValueType*)INST(sb))[0];
+    return buf.IsRef() ? (StrHeader*)INST(buf) : nullptr;
+}
+
+static std::size_t SbCapacity(StrHeader* buf)
+{
+    return buf == nullptr ? 0 : GetCtrlBlk(buf)->ObjectSize() - sizeof(StrHeader);
+}
+
+//()->StrBuilder
+void _SB_new(Interpreter* intp)
+{
+    auto sb = intp->NewRefTypeObject(intp->libLoader.LookupType("Str|StrBuilder"));
+    intp->valueStack.push_back(sb);
+}
+
+//(sb, s)->-2
+void _SB_append(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    if ((last - 1)->IsNull())
+    {
+        intp->ReportError("Append to null StrBuilder");
+        return;
+    }
+    auto len = STR(*last).size();
+    if (len == 0)
+    {
+        intp->valueStack.erase(last - 1, intp->valueStack.end());
+        return;
+    }
+    auto buf = SbBuffer(*(last - 1));
+    std::size_t used = buf == nullptr ? 0 : buf->length;
+
+    if (used + len > SbCapacity(buf))
+    {
+        auto cap = std::max<std::size_t>({ 2 * SbCapacity(buf), used + len, 64 });
+        auto grown = intp->NewStrBuffer(cap);
+        last = intp->valueStack.end() - 1;
+        auto oldBuf = SbBuffer(*(last - 1));
+        auto newBuf = (StrHeader*)INST(grown);
+        if (oldBuf != nullptr) memcpy(newBuf + 1, oldBuf + 1, used);
+        newBuf->length = (std::uint32_t)used;
+        intp->gc.WriteField(grown, *(last - 1), 0);
+        buf = newBuf;
+    }
+
+    memcpy((char*)(buf + 1) + used, STR(*last).data(), len);
+    buf->length = (std::uint32_t)(used + len);
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+}
+
+//(sb)->Str
+void _SB_to_str(Interpreter* intp)
+{
+    auto buf = SbBuffer(intp->valueStack.back());
+    std::size_t len = buf == nullptr ? 0 : buf->length;
+    auto res = intp->NewStrBuffer(len);
+    buf = SbBuffer(intp->valueStack.back());
+    if (len > 0) memcpy(Interpreter::StrBytes(res), buf + 1, len);
+    intp->valueStack.back() = res;
+}
+
+//(sb)->Int
+void _SB_length(Interpreter* intp)
+{
+    auto buf = SbBuffer(intp->valueStack.back());
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = buf == nullptr ? 0 : buf->length;
+    intp->valueStack.back() = res;
+}
+
+//(sb)->-1, keeps the capacity
+void _SB_clear(Interpreter* intp)
+{
+    auto buf = SbBuffer(intp->valueStack.back());
+    if (buf != nullptr) buf->length = 0;
+    intp->valueStack.pop_back();
+}
+
+#define StrBinWrapper(name, fn, retType) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static()->Constant() \
+        ->Arg("a", "Str|Str") \
+        ->Arg("b", "Str|Str") \
+        ->Return("res", retType))
+
+#define StrUnWrapper(name, fn, retType) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static()->Constant() \
+        ->Arg("s", "Str|Str") \
+        ->Return("res", retType))
+
+std::shared_ptr<LibraryInfo> RuntimeLibs::Strings()
+{
+    //concat may return a and intern a shared string, so neither is
+    //constant, see MethodInfoBase::isConstant. slice could be, but no
+    //Str is built by NewRefTypeObject, so nothing would be sunk
+    static std::shared_ptr<LibraryInfo> strLib ( (new LibraryInfo("Str"))
+        ->Deps({ "Num" })
+        ->Class((new ClassInfo("Str"))
+            ->RefType()
+            ->Method((new HostMethod("concat", &_STR_concat))
+                ->Static()
+                ->Arg("a", "Str|Str")
+                ->Arg("b", "Str|Str")
+                ->Return("res", "Str|Str"))
+            ->Method((new HostMethod("slice", &_STR_slice))
+                ->Static()
+                ->Arg("s", "Str|Str")
+                ->Arg("begin", "Num|Int")
+                ->Arg("end", "Num|Int")
+                ->Return("res", "Str|Str"))
+            ->Method((new HostMethod("intern", &_STR_intern))
+                ->Static()
+                ->Arg("s", "Str|Str")
+                ->Return("res", "Str|Str"))
+            StrBinWrapper("find", _STR_find, "Num|Int")
+            StrBinWrapper("compare", _STR_compare, "Num|Int")
+            StrBinWrapper("equal", _STR_equal, "Num|Int")
+            StrUnWrapper("length", _STR_length, "Num|Int")
+            StrUnWrapper("hash", _STR_hash, "Num|Int")
+        )
+        ->Class((new ClassInfo("StrBuilder"))
+            ->RefType()
+            ->Field(FieldInfo("buf", "Str|Str"))
+            ->Method((new HostMethod("new", &_SB_new))
+                ->Static()
+                ->Return("sb", "Str|StrBuilder"))
+            ->Method((new HostMethod("append", &_SB_append))
+                ->Static()
+                ->Arg("sb", "Str|StrBuilder")
+                ->Arg("s", "Str|Str"))
+            ->Method((new HostMethod("to_str", &_SB_to_str))
+                ->Static()
+                ->Arg("sb", "Str|StrBuilder")
+                ->Return("res", "Str|Str"))
+            ->Method((new HostMethod("length", &_SB_length))
+                ->Static()->Constant()
+                ->Arg("sb", "Str|StrBuilder")
+                ->Return("len", "Num|Int"))
+            ->Method((new HostMethod("clear", &_SB_clear))
+                ->Static()
+                ->Arg("sb", "Str|StrBuilder"))
+        )
+        );
+
+    return strLib;
+}
+
+
+/* Map is a Robin Hood table split over two arrays, so the GC only
+ * scans the part that holds references:
+ *   meta    IntArray, per slot (hash & 0xFFFF0000) | (probe distance + 1),
+ *           0 for an empty slot
+ *   entries RefArray, key and value of slot i at 2i and 2i + 1
+ * Capacity is a power of two, both arrays are made by the first put.
+ */
+enum MapField { MapCount = 0, MapMeta, MapEntries };
+
+static constexpr std::uint32_t MapMinCapacity = 8;
+static constexpr std::uint32_t MapTagMask = 0xFFFF0000u;
+static constexpr std::uint32_t MapDistMask = 0x0000FFFFu;
+
+static ValueType* MapFields(const ValueType& map) { return (ValueType*)INST(map); }
+
+static std::uint32_t* MapMetaOf(const ValueType& map)
+{
+    auto& meta = MapFields(map)[MapMeta];
+    return meta.IsRef() ? ((ArrayHeader*)INST(meta))->Elements<std::uint32_t>() : nullptr;
+}
+
+static ValueType* MapEntriesOf(const ValueType& map)
+{
+    auto& entries = MapFields(map)[MapEntries];
+    return entries.IsRef() ? (ValueType*)INST(entries) : nullptr;
+}
+
+static std::uint32_t MapCapacity(const ValueType& map)
+{
+    auto& meta = MapFields(map)[MapMeta];
+    return meta.IsRef() ? Interpreter::ArrayLength(meta) : 0;
+}
+
+static bool MapCheck(Interpreter* intp, const ValueType& map)
+{
+    if (map.IsNull())
+    {
+        intp->ReportError("Null map");
+        return false;
+    }
+    return true;
+}
+
+//Reports unhashable keys
+static bool MapKeyHash(Interpreter* intp, const ValueType& key, std::uint32_t& h)
+{
+    if (key.IsNull())
+    {
+        intp->ReportError("Null map key");
+        return false;
+    }
+    if (key.type == intp->StrType()) h = Interpreter::StrHash(key);
+    //References hash by identity, the address changes with every move
+    else if (key.type->IsReferenceType()) h = intp->gc.IdentityHash(INST(key));
+    else
+    {
+        h = (std::uint32_t)INT32(key);
+        //Only -0 and NaN bit patterns need to know if it's a Float
+        if ((h == 0x80000000u || (h & 0x7F800000u) == 0x7F800000u)
+            && key.type == intp->libLoader.LookupType("Num|Float"))
+        {
+            if (FLOAT(key) != FLOAT(key))
+            {
+                intp->ReportError("NaN map key");
+                return false;
+            }
+            //-0 == 0, so they must share a hash
+            if (FLOAT(key) == 0) h = 0;
+        }
+    }
+
+    //murmur3 fmix32, Int keys are often sequential
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return true;
+}
+
+static bool MapKeyEqual(Interpreter* intp, const ValueType& a, const ValueType& b)
+{
+    if (a.type != b.type) return false;
+    if (a.type == intp->StrType()) return Interpreter::StrEqual(a, b);
+    if (a.type->IsReferenceType()) return INST(a) == INST(b);
+    //Float keys are never NaN, == only differs from bitwise on -0
+    if (FLOAT(a) == FLOAT(b) && INT32(a) != INT32(b))
+        return a.type == intp->libLoader.LookupType("Num|Float");
+    return INT32(a) == INT32(b);
+}
+
+//Slot of key, or -1
+static std::int32_t MapFind(Interpreter* intp, const ValueType& map, const ValueType& key, std::uint32_t h)
+{
+    auto meta = MapMetaOf(map);
+    if (meta == nullptr) return -1;
+    auto entries = MapEntriesOf(map);
+    auto mask = MapCapacity(map) - 1;
+    auto tag = h & MapTagMask;
+    for (std::uint32_t pos = h & mask, dist = 1;; pos = (pos + 1) & mask, dist++)
+    {
+        auto m = meta[pos];
+        //An entry closer to its home than we are to ours ends the run
+        if ((m & MapDistMask) < dist) return -1;
+        if ((m & MapTagMask) == tag && MapKeyEqual(intp, entries[2 * pos], key)) return pos;
+    }
+}
+
+//Key must not be in the table and a slot must be free. Doesn't allocate.
+//Fails when a probe distance runs out of bits, leaving the entry that
+//lost its slot in key and value
+static bool MapInsert(Interpreter* intp, const ValueType& map, ValueType& key, ValueType& value, std::uint32_t h)
+{
+    auto meta = MapMetaOf(map);
+    auto& entries = MapFields(map)[MapEntries];
+    auto slots = MapEntriesOf(map);
+    auto mask = MapCapacity(map) - 1;
+    auto cur = (h & MapTagMask) | 1;
+    for (std::uint32_t pos = h & mask;; pos = (pos + 1) & mask)
+    {
+        auto m = meta[pos];
+        if (m == 0 || (m & MapDistMask) < (cur & MapDistMask))
+        {
+            //Richer entry gives its slot away and probes on
+            ValueType k = slots[2 * pos], v = slots[2 * pos + 1];
+            meta[pos] = cur;
+            intp->gc.WriteField(key, entries, 2 * pos, true);
+            intp->gc.WriteField(value, entries, 2 * pos + 1, true);
+            if (m == 0) return true;
+            cur = m;
+            key = k;
+            value = v;
+        }
+        if ((cur & MapDistMask) == MapDistMask) return false;
+        cur++;
+    }
+}
+
+//Backward shift, no tombstones
+static void MapErase(Interpreter* intp, const ValueType& map, std::uint32_t pos)
+{
+    auto meta = MapMetaOf(map);
+    auto& entries = MapFields(map)[MapEntries];
+    auto slots = MapEntriesOf(map);
+    auto mask = MapCapacity(map) - 1;
+    for (auto next = (pos + 1) & mask; (meta[next] & MapDistMask) > 1; pos = next, next = (next + 1) & mask)
+    {
+        meta[pos] = meta[next] - 1;
+        intp->gc.WriteField(slots[2 * next], entries, 2 * pos, true);
+        intp->gc.WriteField(slots[2 * next + 1], entries, 2 * pos + 1, true);
+    }
+    meta[pos] = 0;
+    slots[2 * pos] = ValueType();
+    slots[2 * pos + 1] = ValueType();
+    INT32(MapFields(map)[MapCount])--;
+}
+
+//Map is at valueStack[mapIdx], it's the only thing that survives
+//the allocations here
+static void MapRehash(Interpreter* intp, std::size_t mapIdx, std::uint32_t cap)
+{
+    auto& stack = intp->valueStack;
+    for (;; cap *= 2)
+    {
+        stack.push_back(intp->NewPrimArray(
+            intp->libLoader.LookupType("Arr|IntArray"), intp->libLoader.LookupType("Num|Int"), cap));
+        stack.push_back(intp->NewRefArray(intp->libLoader.LookupType("Arr|RefArray"), 2 * cap));
+        auto& map = stack[mapIdx];
+        auto oldCap = MapCapacity(map);
+        ValueType oldMeta = MapFields(map)[MapMeta], oldEntries = MapFields(map)[MapEntries];
+        intp->gc.WriteField(*(stack.end() - 2), map, MapMeta);
+        intp->gc.WriteField(stack.back(), map, MapEntries);
+
+        bool ok = true;
+        for (std::uint32_t i = 0; ok && i < oldCap; i++)
+        {
+            if (((ArrayHeader*)INST(oldMeta))->Elements<std::uint32_t>()[i] == 0) continue;
+            auto slots = (ValueType*)INST(oldEntries);
+            ValueType key = slots[2 * i], value = slots[2 * i + 1];
+            std::uint32_t h;
+            MapKeyHash(intp, key, h);
+            ok = MapInsert(intp, map, key, value, h);
+        }
+        if (!ok)
+        {
+            //Old table is untouched, retry larger
+            intp->gc.WriteField(oldMeta, map, MapMeta);
+            intp->gc.WriteField(oldEntries, map, MapEntries);
+        }
+        stack.erase(stack.end() - 2, stack.end());
+        if (ok) return;
+    }
+}
+
+//Put into the map at valueStack[mapIdx], grows it first if needed
+static void MapPut(Interpreter* intp, std::size_t mapIdx, const ValueType& key, const ValueType& value)
+{
+    std::uint32_t h;
+    if (!MapKeyHash(intp, key, h)) return;
+    auto& map = intp->valueStack[mapIdx];
+    auto pos = MapFind(intp, map, key, h);
+    if (pos >= 0)
+    {
+        intp->gc.WriteField(value, MapFields(map)[MapEntries], 2 * pos + 1, true);
+        return;
+    }
+
+    //Stay below 7/8 load
+    auto cap = MapCapacity(map);
+    auto cnt = (std::uint32_t)INT32(MapFields(map)[MapCount]);
+    //Key and value must live through a rehash
+    intp->valueStack.push_back(key);
+    intp->valueStack.push_back(value);
+    if ((cnt + 1) * 8 > cap * 7)
+        MapRehash(intp, mapIdx, std::max(MapMinCapacity, cap * 2));
+    while (!MapInsert(intp, intp->valueStack[mapIdx],
+        *(intp->valueStack.end() - 2), intp->valueStack.back(), h))
+    {
+        //Whichever entry got pushed out goes in after growing
+        MapKeyHash(intp, *(intp->valueStack.end() - 2), h);
+        MapRehash(intp, mapIdx, MapCapacity(intp->valueStack[mapIdx]) * 2);
+    }
+    INT32(MapFields(intp->valueStack[mapIdx])[MapCount])++;
+    intp->valueStack.erase(intp->valueStack.end() - 2, intp->valueStack.end());
+}
+
+//()->Map
+void _MAP_new(Interpreter* intp)
+{
+    auto map = intp->NewRefTypeObject(intp->libLoader.LookupType("Map|Map"));
+    intp->valueStack.push_back(map);
+}
+
+//(map, key)->value, null if missing
+void _MAP_get(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& map = *(last - 1);
+    if (!MapCheck(intp, map)) return;
+    std::uint32_t h;
+    if (!MapKeyHash(intp, *last, h)) return;
+    auto pos = MapFind(intp, map, *last, h);
+    ValueType res = pos < 0 ? ValueType() : MapEntriesOf(map)[2 * pos + 1];
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(map, key)->Int
+void _MAP_has(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& map = *(last - 1);
+    if (!MapCheck(intp, map)) return;
+    std::uint32_t h;
+    if (!MapKeyHash(intp, *last, h)) return;
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = MapFind(intp, map, *last, h) >= 0;
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(map, key, value)->-3
+void _MAP_put(Interpreter* intp)
+{
+    auto mapIdx = intp->valueStack.size() - 3;
+    if (!MapCheck(intp, intp->valueStack[mapIdx])) return;
+    ValueType key = intp->valueStack[mapIdx + 1], value = intp->valueStack[mapIdx + 2];
+    MapPut(intp, mapIdx, key, value);
+    intp->valueStack.resize(mapIdx);
+}
+
+//(map, key)->Int, 1 if it was there
+void _MAP_remove(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& map = *(last - 1);
+    if (!MapCheck(intp, map)) return;
+    std::uint32_t h;
+    if (!MapKeyHash(intp, *last, h)) return;
+    auto pos = MapFind(intp, map, *last, h);
+    if (pos >= 0) MapErase(intp, map, pos);
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = pos >= 0;
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(map)->Int
+void _MAP_count(Interpreter* intp)
+{
+    auto& map = intp->valueStack.back();
+    if (!MapCheck(intp, map)) return;
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = INT32(MapFields(map)[MapCount]);
+    map = res;
+}
+
+//(map)->-1, keeps the capacity
+void _MAP_clear(Interpreter* intp)
+{
+    auto& map = intp->valueStack.back();
+    if (!MapCheck(intp, map)) return;
+    auto meta = MapMetaOf(map);
+    if (meta != nullptr)
+    {
+        auto cap = MapCapacity(map);
+        std::fill_n(meta, cap, 0);
+        std::fill_n(MapEntriesOf(map), 2 * cap, ValueType());
+    }
+    INT32(MapFields(map)[MapCount]) = 0;
+    intp->valueStack.pop_back();
+}
+
+/* Iteration goes by slot:
+ *   for (i = next(m, 0); i >= 0; i = next(m, i + 1)) key_at(m, i) ...
+ * Slot order is unspecified and puts or removes in between may move entries.
+ */
+//(map, slot)->Int, first used slot at or after slot, -1 at the end
+void _MAP_next(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& map = *(last - 1);
+    if (!MapCheck(intp, map)) return;
+    auto meta = MapMetaOf(map);
+    auto cap = (std::int32_t)MapCapacity(map);
+    auto pos = std::max(INT32(*last), 0);
+    while (pos < cap && meta[pos] == 0) pos++;
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = pos < cap ? pos : -1;
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(map, slot)->key or value
+template<bool isValue>
+void _MAP_at(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& map = *(last - 1);
+    if (!MapCheck(intp, map)) return;
+    auto pos = INT32(*last);
+    if (pos < 0 || (std::uint32_t)pos >= MapCapacity(map) || MapMetaOf(map)[pos] == 0)
+    {
+        intp->ReportError("Invalid map slot: " + std::to_string(pos));
+        return;
+    }
+    ValueType res = MapEntriesOf(map)[2 * pos + isValue];
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//Key or value i of a host array, typed by the array
+static ValueType MapArrayElement(const ValueType& arr, std::uint32_t i)
+{
+    if (GetCtrlBlk(INST(arr))->IsRaw()) return ((ValueType*)INST(arr))[i];
+    auto header = (ArrayHeader*)INST(arr);
+    ValueType elem(header->elemType);
+    INT32(elem) = header->Elements<std::int32_t>()[i];
+    return elem;
+}
+
+//(keys, values)->Map, later duplicates win
+void _MAP_from_arrays(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    if (!ArrCheckRange(intp, *(last - 1), 0, 0) || !ArrCheckRange(intp, *last, 0, 0)) return;
+    auto n = Interpreter::ArrayLength(*(last - 1));
+    if (Interpreter::ArrayLength(*last) != n)
+    {
+        intp->ReportError("Array length mismatch: "
+            + std::to_string(Interpreter::ArrayLength(*last)) + " != " + std::to_string(n));
+        return;
+    }
+
+    auto mapIdx = intp->valueStack.size();
+    intp->valueStack.push_back(intp->NewRefTypeObject(intp->libLoader.LookupType("Map|Map")));
+    //Presize so the loop never rehashes
+    auto cap = MapMinCapacity;
+    while (n * 8 > cap * 7) cap *= 2;
+    if (n > 0) MapRehash(intp, mapIdx, cap);
+
+    for (std::uint32_t i = 0; i < n && intp->status != Interpreter::ExecutionStatus::Error; i++)
+    {
+        auto& stack = intp->valueStack;
+        MapPut(intp, mapIdx,
+            MapArrayElement(stack[mapIdx - 2], i), MapArrayElement(stack[mapIdx - 1], i));
+    }
+    auto map = intp->valueStack.back();
+    intp->valueStack.resize(mapIdx - 1);
+    intp->valueStack.back() = map;
+}
+
+#define MapQueryWrapper(name, fn, argName, argType, retName, retType) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static()->Constant() \
+        ->Arg("map", "Map|Map") \
+        ->Arg(argName, argType) \
+        ->Return(retName, retType))
+
+std::shared_ptr<LibraryInfo> RuntimeLibs::Map()
+{
+    static std::shared_ptr<LibraryInfo> mapLib ( (new LibraryInfo("Map"))
+        ->Deps({ "Num", "Arr", "Str" })
+        ->Class((new ClassInfo("Map"))
+            ->RefType()
+            ->Field(FieldInfo("count", "Num|Int"))
+            ->Field(FieldInfo("meta", "Arr|IntArray"))
+            ->Field(FieldInfo("entries", "Arr|RefArray"))
+            ->Method((new HostMethod("new", &_MAP_new))
+                ->Static()
+                ->Return("map", "Map|Map"))
+            ->Method((new HostMethod("put", &_MAP_put))
+                ->Static()
+                ->Arg("map", "Map|Map")
+                ->Arg("key", "")
+                ->Arg("value", ""))
+            ->Method((new HostMethod("remove", &_MAP_remove))
+                ->Static()
+                ->Arg("map", "Map|Map")
+                ->Arg("key", "")
+                ->Return("removed", "Num|Int"))
+            ->Method((new HostMethod("clear", &_MAP_clear))
+                ->Static()
+                ->Arg("map", "Map|Map"))
+            ->Method((new HostMethod("from_arrays", &_MAP_from_arrays))
+                ->Static()
+                ->Arg("keys", "")
+                ->Arg("values", "")
+                ->Return("map", "Map|Map"))
+            MapQueryWrapper("get", _MAP_get, "key", "", "value", "")
+            MapQueryWrapper("has", _MAP_has, "key", "", "res", "Num|Int")
+            MapQueryWrapper("next", _MAP_next, "slot", "Num|Int", "slot", "Num|Int")
+            MapQueryWrapper("key_at", _MAP_at<false>, "slot", "Num|Int", "key", "")
+            MapQueryWrapper("value_at", _MAP_at<true>, "slot", "Num|Int", "value", "")
+            ->Method((new HostMethod("count", &_MAP_count))
+                ->Static()->Constant()
+                ->Arg("map", "Map|Map")
+                ->Return("count", "Num|Int"))
+        )
+        );
+
+    return mapLib;
+}
+
+
+/* Table keeps rows of a columnar type column by column, see TableField.
+ * Field values are read and written with ldmem/stmem on (table, row).
+ * Kernels below name a field by string and stream its whole column.
+ */
+static ValueType* TableFields(const ValueType& table) { return (ValueType*)INST(table); }
+
+static bool TableCheck(Interpreter* intp, const ValueType& table)
+{
+    if (table.IsNull() || table.type != intp->TableType())
+    {
+        intp->ReportError("Table expected");
+        return false;
+    }
+    return true;
+}
+
+//Plain column of a field: first element, row count and element type
+struct TableColumn
+{
+    std::int32_t* data;
+    std::uint32_t count;
+    TypeTable* type;
+    bool isFloat;
+};
+
+static bool TableColumnOf(Interpreter* intp, const ValueType& table, const ValueType& field, TableColumn& col)
+{
+    if (!TableCheck(intp, table)) return false;
+    auto fields = TableFields(table);
+    auto rowType = fields[TableRow].type;
+    auto fdName = intp->libLoader.tlut[rowType]->GetFullName() + "|" + std::string(STR(field));
+    auto slot = intp->libLoader.LookupFieldIndex(fdName);
+    if (slot < 0 || intp->libLoader.LookupFieldWidth(fdName) != 1)
+    {
+        intp->ReportError("Column not found: " + fdName);
+        return false;
+    }
+    if (rowType->columns[slot] & TypeTable::ColumnRef)
+    {
+        intp->ReportError("Plain column expected: " + fdName);
+        return false;
+    }
+    auto cap = (std::uint32_t)INT32(fields[TableCapacity]);
+    col.data = ((ArrayHeader*)INST(fields[TablePrims]))->Elements<std::int32_t>()
+        + rowType->columns[slot] * cap;
+    col.count = INT32(fields[TableCount]);
+    col.type = rowType->fields[slot];
+    col.isFloat = col.type == intp->libLoader.LookupType("Num|Float");
+    return true;
+}
+
+//Sets the ref cells of rows [begin, end) to typed nulls, so removed
+//rows don't keep objects alive
+static void TableReleaseRows(const ValueType& table, std::uint32_t begin, std::uint32_t end)
+{
+    auto fields = TableFields(table);
+    auto rowType = fields[TableRow].type;
+    auto cap = (std::uint32_t)INT32(fields[TableCapacity]);
+    auto refs = (ValueType*)INST(fields[TableRefs]);
+    for (std::size_t slot = 0; slot < rowType->columns.size(); slot++)
+    {
+        auto col = rowType->columns[slot];
+        if (!(col & TypeTable::ColumnRef)) continue;
+        col &= ~TypeTable::ColumnRef;
+        std::fill(refs + col * cap + begin, refs + col * cap + end, ValueType(rowType->fields[slot]));
+    }
+}
+
+//(rowType, capacity)->Table, rowType is the full type name
+void _TABLE_new(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto rowType = intp->libLoader.LookupType(std::string(STR(*(last - 1))));
+    auto cap = INT32(*last);
+    if (rowType == nullptr || cap < 0)
+    {
+        intp->ReportError("Bad table: " + std::string(STR(*(last - 1))) + ", " + std::to_string(cap));
+        return;
+    }
+    auto table = intp->NewTable(rowType, cap);
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = table;
+}
+
+//(table)->Int, index of the new row, its fields are zero or null
+void _TABLE_add(Interpreter* intp)
+{
+    auto tableIdx = intp->valueStack.size() - 1;
+    if (!TableCheck(intp, intp->valueStack.back())) return;
+    auto fields = TableFields(intp->valueStack.back());
+    auto row = (std::uint32_t)INT32(fields[TableCount]);
+    auto cap = (std::uint32_t)INT32(fields[TableCapacity]);
+    if (row == cap)
+    {
+        intp->ReserveTableRows(tableIdx, std::max(16u, cap * 2));
+        fields = TableFields(intp->valueStack.back());
+        cap = INT32(fields[TableCapacity]);
+    }
+
+    auto rowType = fields[TableRow].type;
+    auto prims = ((ArrayHeader*)INST(fields[TablePrims]))->Elements<std::int32_t>();
+    for (std::uint32_t c = 0; c < rowType->primColumns; c++) prims[c * cap + row] = 0;
+    INT32(fields[TableCount])++;
+
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = row;
+    intp->valueStack.back() = res;
+}
+
+//(table, row)->-2, the last row moves into its place
+void _TABLE_remove(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto& table = *(last - 1);
+    if (!TableCheck(intp, table)) return;
+    auto fields = TableFields(table);
+    auto row = INT32(*last);
+    auto count = INT32(fields[TableCount]);
+    if (row < 0 || row >= count)
+    {
+        intp->ReportError("Table row out of range: " + std::to_string(row));
+        return;
+    }
+
+    auto rowType = fields[TableRow].type;
+    auto cap = (std::uint32_t)INT32(fields[TableCapacity]);
+    auto back = (std::uint32_t)count - 1;
+    auto prims = ((ArrayHeader*)INST(fields[TablePrims]))->Elements<std::int32_t>();
+    for (std::uint32_t c = 0; c < rowType->primColumns; c++) prims[c * cap + row] = prims[c * cap + back];
+    for (std::uint32_t c = 0; c < rowType->refColumns; c++)
+    {
+        auto refs = (ValueType*)INST(fields[TableRefs]);
+        intp->gc.WriteField(refs[c * cap + back], fields[TableRefs], c * cap + row, true);
+    }
+    TableReleaseRows(table, back, back + 1);
+    INT32(fields[TableCount]) = back;
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+}
+
+//(table)->Int
+void _TABLE_count(Interpreter* intp)
+{
+    auto& table = intp->valueStack.back();
+    if (!TableCheck(intp, table)) return;
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = INT32(TableFields(table)[TableCount]);
+    table = res;
+}
+
+//(table)->-1, keeps the capacity
+void _TABLE_clear(Interpreter* intp)
+{
+    auto& table = intp->valueStack.back();
+    if (!TableCheck(intp, table)) return;
+    TableReleaseRows(table, 0, INT32(TableFields(table)[TableCount]));
+    INT32(TableFields(table)[TableCount]) = 0;
+    intp->valueStack.pop_back();
+}
+
+//(table, field)->res, same kernels as the array reductions
+template<typename Op>
+void TableReduceMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    TableColumn col;
+    if (!TableColumnOf(intp, *(last - 1), *last, col)) return;
+
+    ValueType res(col.type);
+    if (col.isFloat) FLOAT(res) = BulkReduce<Op>((const float*)col.data, col.count);
+    else INT32(res) = BulkReduce<Op>(col.data, col.count);
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(table, field, value)->-3, column = op(column, value)
+template<typename Op>
+void TableMapMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    TableColumn col;
+    if (!TableColumnOf(intp, *(last - 2), *(last - 1), col)) return;
+
+    if (col.isFloat)
+    {
+        auto d = (float*)col.data;
+        auto y = FLOAT(*last);
+        for (std::uint32_t i = 0; i < col.count; i++) d[i] = Op::Scalar(d[i], y);
+    }
+    else
+    {
+        auto y = INT32(*last);
+        for (std::uint32_t i = 0; i < col.count; i++) col.data[i] = Op::Scalar(col.data[i], y);
+    }
+    intp->valueStack.erase(last - 2, intp->valueStack.end());
+}
+
+//Counts matches when rows is null, so the result can be sized first
+template<typename Op, typename T>
+static std::uint32_t TableSelect(const T* a, std::uint32_t n, T y, std::int32_t* rows)
+{
+    std::uint32_t cnt = 0;
+    if (rows == nullptr)
+    {
+        for (std::uint32_t i = 0; i < n; i++) cnt += Op::Scalar(a[i], y);
+        return cnt;
+    }
+    for (std::uint32_t i = 0; i < n; i++)
+    {
+        if (Op::Scalar(a[i], y)) rows[cnt++] = i;
+    }
+    return cnt;
+}
+
+//(table, field, value)->IntArray, rows where op(column, value) holds
+template<typename Op>
+void TableFilterMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    TableColumn col;
+    if (!TableColumnOf(intp, *(last - 2), *(last - 1), col)) return;
+
+    auto Select = [&](std::int32_t* rows) {
+        return col.isFloat ?
+            TableSelect<Op>((const float*)col.data, col.count, FLOAT(*last), rows) :
+            TableSelect<Op>(col.data, col.count, INT32(*last), rows);
+    };
+    auto cnt = Select(nullptr);
+    auto res = intp->NewPrimArray(intp->libLoader.LookupType("Arr|IntArray"),
+        intp->libLoader.LookupType("Num|Int"), cnt);
+    //Columns may have moved
+    last = intp->valueStack.end() - 1;
+    TableColumnOf(intp, *(last - 2), *(last - 1), col);
+    Select(((ArrayHeader*)INST(res))->Elements<std::int32_t>());
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+    intp->valueStack.back() = res;
+}
+
+//(table, field)->Int/FloatArray, copy of the column
+void _TABLE_to_array(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    TableColumn col;
+    if (!TableColumnOf(intp, *(last - 1), *last, col)) return;
+
+    auto res = intp->NewPrimArray(intp->libLoader.LookupType(col.isFloat ? "Arr|FloatArray" : "Arr|IntArray"),
+        col.type, col.count);
+    last = intp->valueStack.end() - 1;
+    TableColumnOf(intp, *(last - 1), *last, col);
+    memcpy(((ArrayHeader*)INST(res))->Elements<std::int32_t>(), col.data, col.count * sizeof(std::int32_t));
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+#define TableColumnWrapper(name, fn, retName, retType) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static()->Constant() \
+        ->Arg("table", "Table|Table") \
+        ->Arg("field", "Str|Str") \
+        ->Return(retName, retType))
+
+#define TableMapWrapper(name, fn) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static() \
+        ->Arg("table", "Table|Table") \
+        ->Arg("field", "Str|Str") \
+        ->Arg("value", ""))
+
+#define TableFilterWrapper(name, fn) \
+    ->Method((new HostMethod(name, &fn)) \
+        ->Static() \
+        ->Arg("table", "Table|Table") \
+        ->Arg("field", "Str|Str") \
+        ->Arg("value", "") \
+        ->Return("rows", "Arr|IntArray"))
+
+std::shared_ptr<LibraryInfo> RuntimeLibs::Table()
+{
+    static std::shared_ptr<LibraryInfo> tableLib ( (new LibraryInfo("Table"))
+        ->Deps({ "Num", "Arr", "Str" })
+        ->Class((new ClassInfo("Table"))
+            ->RefType()
+            ->Field(FieldInfo("count", "Num|Int"))
+            ->Field(FieldInfo("capacity", "Num|Int"))
+            ->Field(FieldInfo("prims", "Arr|IntArray"))
+            ->Field(FieldInfo("refs", "Arr|RefArray"))
+            //Retyped to the row type by NewTable
+            ->Field(FieldInfo("row", "Table|Table"))
+            ->Method((new HostMethod("new", &_TABLE_new))
+                ->Static()
+                ->Arg("rowType", "Str|Str")
+                ->Arg("capacity", "Num|Int")
+                ->Return("table", "Table|Table"))
+            ->Method((new HostMethod("add", &_TABLE_add))
+                ->Static()
+                ->Arg("table", "Table|Table")
+                ->Return("row", "Num|Int"))
+            ->Method((new HostMethod("remove", &_TABLE_remove))
+                ->Static()
+                ->Arg("table", "Table|Table")
+                ->Arg("row", "Num|Int"))
+            ->Method((new HostMethod("clear", &_TABLE_clear))
+                ->Static()
+                ->Arg("table", "Table|Table"))
+            ->Method((new HostMethod("count", &_TABLE_count))
+                ->Static()->Constant()
+                ->Arg("table", "Table|Table")
+                ->Return("count", "Num|Int"))
+            TableColumnWrapper("sum", TableReduceMethod<BulkOp_add>, "res", "")
+            TableColumnWrapper("min", TableReduceMethod<BulkOp_min>, "res", "")
+            TableColumnWrapper("max", TableReduceMethod<BulkOp_max>, "res", "")
+            TableMapWrapper("map_add", TableMapMethod<BulkOp_add>)
+            TableMapWrapper("map_mul", TableMapMethod<BulkOp_mul>)
+            TableFilterWrapper("filter_less", TableFilterMethod<BulkOp_less_than>)
+            TableFilterWrapper("filter_greater", TableFilterMethod<BulkOp_greater_than>)
+            TableFilterWrapper("filter_equal", TableFilterMethod<BulkOp_equal>)
+            ->Method((new HostMethod("to_array", &_TABLE_to_array))
+                ->Static()
+                ->Arg("table", "Table|Table")
+                ->Arg("field", "Str|Str")
+                ->Return("arr", ""))
+        )
+        );
+
+    return tableLib;
+}
+
+
+//Read only file mappings. Offsets are u32, so files are capped at 4GiB
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+/* IO|Buffer is a pinned blob holding only this header. The GC tracks it
+ * like any other object but never moves it, and the mapping is released
+ * by its dtor once the buffer is collected, or earlier by close.
+ */
+struct alignas(16) IoMapping
+{
+    const std::uint8_t* base;
+    std::uint32_t size;
+};
+
+static void IoUnmap(IoMapping* map)
+{
+    if (map->base != nullptr)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(map->base);
+#else
+        munmap((void*)map->base, map->size);
+#endif
+    }
+    map->base = nullptr;
+    map->size = 0;
+}
+
+//Empty files map to a null base
+static bool IoMap(const std::string& path, IoMapping& map, std::string& err)
+{
+    map.base = nullptr;
+    map.size = 0;
+#ifdef _WIN32
+    auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) { err = "cannot open"; return false; }
+    LARGE_INTEGER size;
+    bool ok = GetFileSizeEx(file, &size);
+    if (ok && size.QuadPart > std::numeric_limits<std::uint32_t>::max()) { err = "file too large"; ok = false; }
+    if (ok && size.QuadPart > 0)
+    {
+        auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        map.base = mapping == nullptr ? nullptr :
+            (const std::uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        //The view keeps the mapping alive
+        if (mapping != nullptr) CloseHandle(mapping);
+        if (map.base == nullptr) { err = "cannot map"; ok = false; }
+        else map.size = (std::uint32_t)size.QuadPart;
+    }
+    CloseHandle(file);
+    return ok;
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { err = strerror(errno); return false; }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (!ok) err = strerror(errno);
+    else if (!S_ISREG(st.st_mode)) { err = "not a regular file"; ok = false; }
+    else if ((std::uint64_t)st.st_size > std::numeric_limits<std::uint32_t>::max()) { err = "file too large"; ok = false; }
+    if (ok && st.st_size > 0)
+    {
+        auto base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) { err = strerror(errno); ok = false; }
+        else
+        {
+            map.base = (const std::uint8_t*)base;
+            map.size = (std::uint32_t)st.st_size;
+        }
+    }
+    //Mapping outlives the descriptor
+    close(fd);
+    return ok;
+#endif
+}
+
+static IoMapping* IoBufferOf(Interpreter* intp, const ValueType& buf)
+{
+    if (buf.IsNull() || buf.type != intp->libLoader.LookupType("IO|Buffer"))
+    {
+        intp->ReportError("IO buffer expected");
+        return nullptr;
+    }
+    return (IoMapping*)INST(buf);
+}
+
+//Bytes [offset, offset + len) must be inside the mapping
+static const std::uint8_t* IoRange(Interpreter* intp, IoMapping* map, std::uint64_t offset, std::uint64_t len)
+{
+    if (offset + len > map->size)
+    {
+        intp->ReportError("Buffer range out of bounds: " + std::to_string(offset)
+            + "+" + std::to_string(len) + " > " + std::to_string(map->size));
+        return nullptr;
+    }
+    return map->base + offset;
+}
+
+//Element type of a view, read unaligned
+template<typename T>
+static ValueType IoLoad(Interpreter* intp, const std::uint8_t* p)
+{
+    T x;
+    memcpy(&x, p, sizeof(T));
+    ValueType res(intp->libLoader.LookupType(std::is_floating_point_v<T> ? "Num|Float" : "Num|Int"));
+    if constexpr (std::is_floating_point_v<T>) FLOAT(res) = x;
+    else INT32(res) = x;
+    return res;
+}
+
+//Pinned, never moved, only the dtor is needed
+static std::uint8_t IoMappingKind()
+{
+    static const auto kind = ManagedObjectCtrlBlock::RegisterKind({ nullptr,
+        [](BytePtr payload) { IoUnmap((IoMapping*)payload); } });
+    return kind;
+}
+
+//(path)->Buffer
+void _IO_open(Interpreter* intp)
+{
+    std::string path(STR(intp->valueStack.back()));
+    IoMapping map;
+    std::string err;
+    if (!IoMap(path, map, err))
+    {
+        intp->ReportError("Cannot map " + path + ": " + err);
+        return;
+    }
+
+    auto ty = intp->libLoader.LookupType("IO|Buffer");
+    intp->NotifyGC();
+    auto payload = intp->gc.AllocateBlob(sizeof(IoMapping), true, IoMappingKind());
+    GetCtrlBlk(payload)->vptr = ty;
+    *(IoMapping*)payload = map;
+
+    ValueType buf(ty);
+    buf.data.obj = payload;
+    intp->valueStack.back() = buf;
+}
+
+//(buf)->-1, views of it report out of bounds afterwards
+void _IO_close(Interpreter* intp)
+{
+    auto map = IoBufferOf(intp, intp->valueStack.back());
+    if (map == nullptr) return;
+    IoUnmap(map);
+    intp->valueStack.pop_back();
+}
+
+//(buf)->Int
+void _IO_size(Interpreter* intp)
+{
+    auto map = IoBufferOf(intp, intp->valueStack.back());
+    if (map == nullptr) return;
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = map->size;
+    intp->valueStack.back() = res;
+}
+
+//(buf, offset)->value
+template<typename T>
+void IoReadMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto map = IoBufferOf(intp, *(last - 1));
+    auto p = map ? IoRange(intp, map, (std::uint32_t)INT32(*last), sizeof(T)) : nullptr;
+    if (p == nullptr) return;
+    auto res = IoLoad<T>(intp, p);
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(buf, pos, byte)->Int, offset of the next byte at or after pos, size if none
+void _IO_find(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto map = IoBufferOf(intp, *(last - 2));
+    auto pos = (std::uint32_t)INT32(*(last - 1));
+    if (map == nullptr || IoRange(intp, map, pos, 0) == nullptr) return;
+    auto hit = (const std::uint8_t*)memchr(map->base + pos, INT32(*last) & 0xFF, map->size - pos);
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = hit == nullptr ? map->size : (std::uint32_t)(hit - map->base);
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+    intp->valueStack.back() = res;
+}
+
+//Calls fn with the end of every record, the last record needs no delimiter
+template<typename Fn>
+static void IoForEachRecord(const IoMapping* map, int delim, Fn&& fn)
+{
+    auto p = map->base, end = map->base + map->size;
+    while (p < end)
+    {
+        auto hit = (const std::uint8_t*)memchr(p, delim, end - p);
+        if (hit == nullptr) hit = end;
+        fn((std::uint32_t)(hit - map->base));
+        p = hit + 1;
+    }
+}
+
+//(buf, delim)->IntArray, end offset of every record. Record i spans
+//[ends[i - 1] + 1, ends[i]), the first one starts at 0
+void _IO_split(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto map = IoBufferOf(intp, *(last - 1));
+    if (map == nullptr) return;
+    auto delim = INT32(*last) & 0xFF;
+    std::uint32_t cnt = 0;
+    IoForEachRecord(map, delim, [&](std::uint32_t) { cnt++; });
+
+    //Buffer is pinned, map stays valid through the allocation
+    auto res = intp->NewPrimArray(intp->libLoader.LookupType("Arr|IntArray"),
+        intp->libLoader.LookupType("Num|Int"), cnt);
+    auto ends = ((ArrayHeader*)INST(res))->Elements<std::int32_t>();
+    IoForEachRecord(map, delim, [&](std::uint32_t e) { *ends++ = e; });
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(buf, begin, end)->Str, copies the bytes
+void _IO_str(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto map = IoBufferOf(intp, *(last - 2));
+    auto begin = (std::uint32_t)INT32(*(last - 1));
+    auto end = (std::uint32_t)INT32(*last);
+    if (map == nullptr) return;
+    if (end < begin)
+    {
+        intp->ReportError("Buffer range out of bounds: " + std::to_string(begin) + ", " + std::to_string(end));
+        return;
+    }
+    auto p = IoRange(intp, map, begin, end - begin);
+    if (p == nullptr) return;
+    auto res = intp->NewStrBuffer(end - begin);
+    memcpy(Interpreter::StrBytes(res), p, end - begin);
+    intp->valueStack.erase(last - 1, intp->valueStack.end());
+    intp->valueStack.back() = res;
+}
+
+/* Views read elements of T at offset + i * stride, so interleaved
+ * records can be walked a field at a time. They hold the buffer, bounds
+ * are checked on every access in case it was closed.
+ */
+enum IoViewField { IoViewBuf = 0, IoViewOffset, IoViewStride, IoViewCount };
+
+//(buf, offset, stride, count)->View
+template<typename T>
+void IoViewNewMethod(Interpreter* intp, const char* viewName)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto map = IoBufferOf(intp, *(last - 3));
+    if (map == nullptr) return;
+    auto offset = (std::uint32_t)INT32(*(last - 2));
+    auto stride = (std::uint32_t)INT32(*(last - 1));
+    auto count = INT32(*last);
+    if (count < 0 || (count > 0 &&
+        IoRange(intp, map, offset + (std::uint64_t)stride * (count - 1), sizeof(T)) == nullptr))
+    {
+        if (count < 0) intp->ReportError("Negative view length");
+        return;
+    }
+
+    auto view = intp->NewRefTypeObject(intp->libLoader.LookupType(viewName));
+    last = intp->valueStack.end() - 1;
+    auto fields = (ValueType*)INST(view);
+    intp->gc.WriteField(*(last - 3), view, IoViewBuf, true);
+    fields[IoViewOffset] = *(last - 2);
+    fields[IoViewStride] = *(last - 1);
+    fields[IoViewCount] = *last;
+    intp->valueStack.erase(last - 2, intp->valueStack.end());
+    intp->valueStack.back() = view;
+}
+
+void _IO_INTVIEW_new(Interpreter* intp) { IoViewNewMethod<std::int32_t>(intp, "IO|IntView"); }
+void _IO_FLOATVIEW_new(Interpreter* intp) { IoViewNewMethod<float>(intp, "IO|FloatView"); }
+void _IO_BYTEVIEW_new(Interpreter* intp) { IoViewNewMethod<std::uint8_t>(intp, "IO|ByteView"); }
+
+//Address of element i, null after reporting
+template<typename T>
+static const std::uint8_t* IoViewElement(Interpreter* intp, const ValueType& view, std::int32_t i)
+{
+    if (view.IsNull())
+    {
+        intp->ReportError("Null view");
+        return nullptr;
+    }
+    auto fields = (ValueType*)INST(view);
+    if (i < 0 || i >= INT32(fields[IoViewCount]))
+    {
+        intp->ReportError("View index out of range: " + std::to_string(i));
+        return nullptr;
+    }
+    auto map = (IoMapping*)INST(fields[IoViewBuf]);
+    return IoRange(intp, map, (std::uint32_t)INT32(fields[IoViewOffset])
+        + (std::uint64_t)(std::uint32_t)INT32(fields[IoViewStride]) * i, sizeof(T));
+}
+
+//(view, i)->value
+template<typename T>
+void IoViewAtMethod(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto p = IoViewElement<T>(intp, *(last - 1), INT32(*last));
+    if (p == nullptr) return;
+    auto res = IoLoad<T>(intp, p);
+    intp->valueStack.pop_back();
+    intp->valueStack.back() = res;
+}
+
+//(view)->Int
+void _IO_VIEW_length(Interpreter* intp)
+{
+    auto& view = intp->valueStack.back();
+    if (view.IsNull())
+    {
+        intp->ReportError("Null view");
+        return;
+    }
+    view = ((ValueType*)INST(view))[IoViewCount];
+}
+
+//(view)->Int/FloatArray, gathers all elements, bytes widen to Int
+template<typename T>
+void IoViewToArrayMethod(Interpreter* intp)
+{
+    auto& view = intp->valueStack.back();
+    if (view.IsNull())
+    {
+        intp->ReportError("Null view");
+        return;
+    }
+    auto count = INT32(((ValueType*)INST(view))[IoViewCount]);
+    if (count > 0 && IoViewElement<T>(intp, view, count - 1) == nullptr) return;
+
+    constexpr bool isFloat = std::is_floating_point_v<T>;
+    auto res = intp->NewPrimArray(intp->libLoader.LookupType(isFloat ? "Arr|FloatArray" : "Arr|IntArray"),
+        intp->libLoader.LookupType(isFloat ? "Num|Float" : "Num|Int"), count);
+    auto fields = (ValueType*)INST(intp->valueStack.back());
+    auto p = ((IoMapping*)INST(fields[IoViewBuf]))->base + (std::uint32_t)INT32(fields[IoViewOffset]);
+    auto stride = (std::uint32_t)INT32(fields[IoViewStride]);
+    auto dst = ((ArrayHeader*)INST(res))->Elements<std::conditional_t<isFloat, float, std::int32_t>>();
+    for (std::int32_t i = 0; i < count; i++, p += stride)
+    {
+        T x;
+        memcpy(&x, p, sizeof(T));
+        dst[i] = x;
+    }
+    intp->valueStack.back() = res;
+}
+
+/* CSV and fixed width records decoded into typed columns. A decoder
+ * holds the schema and turns up to chunk records per feed into fresh
+ * column arrays, so large inputs are consumed in bounded pieces:
+ * +--------+-------------------------------------------------+
+ * | kinds  | IntArray of CsvKind, one per column             |
+ * | widths | IntArray, field widths for fixed width records  |
+ * | names  | RefArray of Str                                 |
+ * | delim  | field delimiter, 0 for fixed width              |
+ * | chunk  | records per feed                                |
+ * | rows   | records decoded by the last feed                |
+ * | cols   | RefArray of Int/Float/RefArray, rows long       |
+ * +--------+-------------------------------------------------+
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CSV_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+enum CsvField { CsvKinds = 0, CsvWidths, CsvNames, CsvDelim, CsvChunk, CsvRows, CsvColumns };
+enum CsvKind : std::int32_t { CsvInt = 0, CsvFloat, CsvStr };
+
+static int CsvLowestBit(std::uint64_t m)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    _BitScanForward64(&i, m);
+    return (int)i;
+#else
+    return __builtin_ctzll(m);
+#endif
+}
+
+/* Finds the next delimiter, newline or quote. Bytes are classified 64 at
+ * a time into bit masks, so a short field costs one bit scan instead of
+ * a byte loop. Positions are offsets, base is reloaded if the source moves
+ */
+struct CsvScanner
+{
+    const char* base;
+    std::uint32_t size;
+    char delim, quote;
+    std::uint32_t blk = 0, blkEnd = 0;
+    //Every structural byte, and newlines and quotes only
+    std::uint64_t mask = 0, lineMask = 0;
+
+    void Classify(std::uint32_t at)
+    {
+        auto p = base + at;
+        mask = lineMask = 0;
+#ifdef CSV_USE_SSE2
+        auto d = _mm_set1_epi8(delim), n = _mm_set1_epi8('\n'), q = _mm_set1_epi8(quote);
+        for (int i = 0; i < 4; i++)
+        {
+            auto v = _mm_loadu_si128((const __m128i*)(p + i * 16));
+            auto line = _mm_or_si128(_mm_cmpeq_epi8(v, n), _mm_cmpeq_epi8(v, q));
+            auto hit = _mm_or_si128(line, _mm_cmpeq_epi8(v, d));
+            mask |= (std::uint64_t)(std::uint32_t)_mm_movemask_epi8(hit) << (i * 16);
+            lineMask |= (std::uint64_t)(std::uint32_t)_mm_movemask_epi8(line) << (i * 16);
+        }
+#else
+        for (int i = 0; i < 64; i++)
+        {
+            bool line = p[i] == '\n' || p[i] == quote;
+            mask |= (std::uint64_t)(line || p[i] == delim) << i;
+            lineMask |= (std::uint64_t)line << i;
+        }
+#endif
+    }
+
+    //Offset of the first structural byte at or after pos, size if none.
+    //lineOnly: skip delimiters
+    template<bool lineOnly = false>
+    std::uint32_t Next(std::uint32_t pos)
+    {
+        while (pos < size)
+        {
+            if (pos >= blk && pos < blkEnd)
+            {
+                auto m = (lineOnly ? lineMask : mask) & (~0ull << (pos - blk));
+                if (m != 0) return blk + CsvLowestBit(m);
+                pos = blkEnd;
+                continue;
+            }
+            //Tail is too short for a block
+            if (size - pos < 64) break;
+            blk = pos;
+            blkEnd = pos + 64;
+            Classify(pos);
+        }
+        for (; pos < size; pos++)
+        {
+            auto c = base[pos];
+            if ((!lineOnly && c == delim) || c == '\n' || c == quote) return pos;
+        }
+        return size;
+    }
+};
+
+static bool CsvBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+/* Parses a plain [-]digits[.digits] number at b and returns the byte
+ * after it, nullptr for anything else. Up to 2^24 the mantissa and the
+ * power of ten are exact floats, so one division rounds correctly
+ */
+template<typename T>
+static inline const char* CsvScanNum(const char* b, const char* e, T& x)
+{
+    auto p = b;
+    bool neg = p < e && *p == '-';
+    p += neg;
+    std::uint32_t m = 0, frac = 0;
+    auto digits = p;
+    while (p < e && (std::uint8_t)(*p - '0') < 10 && p - digits < 9) m = m * 10 + (*p++ - '0');
+    if (p == digits) return nullptr;
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        if (p < e && *p == '.')
+        {
+            auto f = ++p;
+            while (p < e && (std::uint8_t)(*p - '0') < 10 && p - digits < 10) m = m * 10 + (*p++ - '0');
+            frac = (std::uint32_t)(p - f);
+        }
+        if (m > (1u << 24)) return nullptr;
+        static constexpr float pow10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+        x = (neg ? -(T)m : (T)m) / pow10[frac];
+    }
+    else x = neg ? -(T)m : (T)m;
+    //A digit here means too many of them
+    return p < e && (std::uint8_t)(*p - '0') < 10 ? nullptr : p;
+}
+
+//Numbers may be padded with blanks, empty fields read as 0
+template<typename T>
+static bool CsvParseNum(const char* b, const char* e, T& x)
+{
+    if (CsvScanNum(b, e, x) == e) return true;
+
+    while (b < e && CsvBlank(*b)) b++;
+    while (e > b && CsvBlank(e[-1])) e--;
+    x = 0;
+    if (b == e) return true;
+    //from_chars takes no plus sign
+    if (*b == '+' && e - b > 1 && b[1] != '-') b++;
+    auto res = std::from_chars(b, e, x);
+    return res.ec == std::errc() && res.ptr == e;
+}
+
+static ValueType* CsvFields(Interpreter* intp, const ValueType& csv)
+{
+    if (csv.IsNull())
+    {
+        intp->ReportError("Null CSV decoder");
+        return nullptr;
+    }
+    return (ValueType*)INST(csv);
+}
+
+//(schema, delim, chunk)->Csv. Schema is "name:type[:width],...", type is
+//int, float, str or the full Num|Int, Num|Float, Str|Str. Delim 0 reads
+//fixed width records, every column needs a width then
+void _IO_CSV_new(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    std::string schema(STR(*(last - 2)));
+    auto delim = INT32(*(last - 1));
+    auto chunk = INT32(*last);
+
+    std::vector<std::string> names;
+    std::vector<std::int32_t> kinds, widths;
+    std::size_t begin = 0;
+    while (begin <= schema.size() && !schema.empty())
+    {
+        auto end = std::min(schema.find(',', begin), schema.size());
+        auto entry = schema.substr(begin, end - begin);
+        begin = end + 1;
+
+        auto c1 = entry.find(':');
+        auto c2 = c1 == std::string::npos ? c1 : entry.find(':', c1 + 1);
+        auto type = c1 == std::string::npos ? "" : entry.substr(c1 + 1, c2 == std::string::npos ? c2 : c2 - c1 - 1);
+        std::int32_t kind = -1, width = 0;
+        if (type == "int" || type == "Num|Int") kind = CsvInt;
+        else if (type == "float" || type == "Num|Float") kind = CsvFloat;
+        else if (type == "str" || type == "Str|Str") kind = CsvStr;
+        if (c2 != std::string::npos)
+        {
+            auto w = entry.c_str() + c2 + 1;
+            if (!CsvParseNum(w, entry.c_str() + entry.size(), width) || width <= 0) kind = -1;
+        }
+        if (c1 == 0 || kind < 0 || (delim == 0 && width == 0))
+        {
+            intp->ReportError("Bad CSV schema entry: \"" + entry + "\"");
+            return;
+        }
+        names.push_back(entry.substr(0, c1));
+        kinds.push_back(kind);
+        widths.push_back(width);
+    }
+    if (names.empty() || chunk <= 0 || delim < 0 || delim > 0xFF || delim == '\n' || delim == '"')
+    {
+        intp->ReportError("Bad CSV decoder: \"" + schema + "\", " + std::to_string(delim)
+            + ", " + std::to_string(chunk));
+        return;
+    }
+
+    auto csv = intp->NewRefTypeObject(intp->libLoader.LookupType("IO|Csv"));
+    intp->valueStack.push_back(csv);
+    auto fields = (ValueType*)INST(csv);
+    INT32(fields[CsvDelim]) = delim;
+    INT32(fields[CsvChunk]) = chunk;
+
+    auto kindArr = intp->NewIntArray(kinds.data(), kinds.size());
+    intp->gc.WriteField(kindArr, intp->valueStack.back(), CsvKinds);
+    auto widthArr = intp->NewIntArray(widths.data(), widths.size());
+    intp->gc.WriteField(widthArr, intp->valueStack.back(), CsvWidths);
+    auto nameArr = intp->NewRefArray(intp->libLoader.LookupType("Arr|RefArray"), names.size());
+    intp->gc.WriteField(nameArr, intp->valueStack.back(), CsvNames);
+    for (std::size_t i = 0; i < names.size(); i++)
+    {
+        auto name = intp->NewStr(names[i]);
+        intp->gc.WriteField(name, ((ValueType*)INST(intp->valueStack.back()))[CsvNames], i, true);
+    }
+
+    csv = intp->valueStack.back();
+    intp->valueStack.resize(intp->valueStack.size() - 3);
+    intp->valueStack.back() = csv;
+}
+
+/* Decodes up to chunk records starting at pos into new columns, and
+ * returns where the next feed starts, the input size once all is read.
+ * Blank lines are skipped, missing fields are 0 or empty and extra ones
+ * are dropped. Quoted fields follow RFC 4180, "" inside them is a quote.
+ */
+static void CsvFeed(Interpreter* intp, bool fromStr)
+{
+    auto& stack = intp->valueStack;
+    auto csvIdx = stack.size() - 3, srcIdx = csvIdx + 1;
+    auto fields = CsvFields(intp, stack[csvIdx]);
+    if (fields == nullptr) return;
+    if (!fromStr && IoBufferOf(intp, stack[srcIdx]) == nullptr) return;
+
+    auto ncols = Interpreter::ArrayLength(fields[CsvKinds]);
+    std::vector<std::int32_t> kinds(ncols), widths(ncols);
+    memcpy(kinds.data(), ((ArrayHeader*)INST(fields[CsvKinds]))->Elements<std::int32_t>(), ncols * 4);
+    memcpy(widths.data(), ((ArrayHeader*)INST(fields[CsvWidths]))->Elements<std::int32_t>(), ncols * 4);
+    auto delim = (char)INT32(fields[CsvDelim]);
+    auto chunk = (std::uint32_t)INT32(fields[CsvChunk]);
+
+    //Columns are allocated before any byte is read, Str fields allocate
+    //as they go and everything is reloaded after that. A chunk of
+    //columns is dropped by the next feed, so even big ones are young:
+    //in the heap a Str column would keep its strings past the minor
+    //GCs until a full GC finds it dead
+    auto colsArr = intp->NewRefArray(intp->libLoader.LookupType("Arr|RefArray"), ncols);
+    intp->gc.WriteField(colsArr, stack[csvIdx], CsvColumns, true);
+    for (std::uint32_t c = 0; c < ncols; c++)
+    {
+        auto col = kinds[c] == CsvStr ?
+            intp->NewRefArray(intp->libLoader.LookupType("Arr|RefArray"), chunk, true) :
+            intp->NewPrimArray(intp->libLoader.LookupType(kinds[c] == CsvInt ? "Arr|IntArray" : "Arr|FloatArray"),
+                intp->libLoader.LookupType(kinds[c] == CsvInt ? "Num|Int" : "Num|Float"), chunk, true);
+        intp->gc.WriteField(col, ((ValueType*)INST(stack[csvIdx]))[CsvColumns], c, true);
+    }
+
+    CsvScanner sc;
+    std::vector<ValueType> cols(ncols);
+    auto reload = [&]()
+    {
+        if (fromStr)
+        {
+            auto text = STR(stack[srcIdx]);
+            sc.base = text.data();
+            sc.size = (std::uint32_t)text.size();
+        }
+        else
+        {
+            auto map = (IoMapping*)INST(stack[srcIdx]);
+            sc.base = (const char*)map->base;
+            sc.size = map->size;
+        }
+        auto colVals = (ValueType*)INST(((ValueType*)INST(stack[csvIdx]))[CsvColumns]);
+        for (std::uint32_t c = 0; c < ncols; c++) cols[c] = colVals[c];
+    };
+    reload();
+    sc.delim = delim == 0 ? '\n' : delim;
+    sc.quote = delim == 0 ? '\n' : '"';
+
+    auto pos = (std::uint32_t)INT32(stack[srcIdx + 1]);
+    if (pos > sc.size)
+    {
+        intp->ReportError("CSV position out of bounds: " + std::to_string(pos));
+        return;
+    }
+
+    std::uint32_t row = 0;
+    //Field [b, e) of column c, quoted ones may hold "" pairs
+    auto store = [&](std::uint32_t c, std::uint32_t b, std::uint32_t e, bool quoted)
+    {
+        if (c >= ncols) return true;
+        auto kind = kinds[c];
+        if (kind != CsvStr)
+        {
+            auto elems = (ArrayHeader*)INST(cols[c]);
+            bool ok = kind == CsvInt ?
+                CsvParseNum(sc.base + b, sc.base + e, elems->Elements<std::int32_t>()[row]) :
+                CsvParseNum(sc.base + b, sc.base + e, elems->Elements<float>()[row]);
+            if (!ok)
+            {
+                intp->ReportError(std::string("Bad ") + (kind == CsvInt ? "Num|Int" : "Num|Float")
+                    + " field at byte " + std::to_string(b) + ": \""
+                    + std::string(sc.base + b, std::min(e - b, 32u)) + "\"");
+            }
+            return ok;
+        }
+
+        if (delim == 0)
+        {
+            while (b < e && CsvBlank(sc.base[b])) b++;
+            while (e > b && CsvBlank(sc.base[e - 1])) e--;
+        }
+        std::uint32_t len = e - b;
+        if (quoted)
+            for (auto i = b; i < e; i++) if (sc.base[i] == '"') { len--; i++; }
+        //Bump allocated strings move nothing and are young, so a young
+        //column takes them without a write barrier. The slow path may
+        //collect, everything is reloaded after it
+        ValueType str;
+        bool bumped = intp->TryNewStrBuffer(len, str);
+        if (!bumped)
+        {
+            str = intp->NewStrBuffer(len);
+            reload();
+        }
+        auto dst = Interpreter::StrBytes(str);
+        if (!quoted) memcpy(dst, sc.base + b, len);
+        else
+        {
+            for (auto i = b; i < e; i++)
+            {
+                *dst++ = sc.base[i];
+                if (sc.base[i] == '"') i++;
+            }
+        }
+        if (bumped && GetCtrlBlk(INST(cols[c]))->IsInNursery()) ((ValueType*)INST(cols[c]))[row] = str;
+        else intp->gc.WriteField(str, cols[c], row, true);
+        return true;
+    };
+
+    while (row < chunk && pos < sc.size)
+    {
+        std::uint32_t c = 0;
+        if (delim == 0)
+        {
+            auto eol = sc.Next(pos);
+            auto end = eol > pos && sc.base[eol - 1] == '\r' ? eol - 1 : eol;
+            auto b = pos;
+            pos = std::min(eol + 1, sc.size);
+            if (end == b) continue;
+            for (; c < ncols; c++)
+            {
+                auto e = std::min(b + (std::uint32_t)widths[c], end);
+                if (!store(c, b, e, false)) return;
+                b = e;
+            }
+        }
+        else
+        {
+            auto first = sc.base[pos];
+            if (first == '\n' || (first == '\r' && (pos + 1 == sc.size || sc.base[pos + 1] == '\n')))
+            {
+                pos = std::min(pos + (first == '\n' ? 1 : 2), sc.size);
+                continue;
+            }
+            for (;;)
+            {
+                //Extra fields are dropped, only the newline and quotes
+                //opening a field matter
+                if (c >= ncols)
+                {
+                    auto at = sc.Next<true>(pos);
+                    if (at == sc.size || sc.base[at] == '\n')
+                    {
+                        pos = std::min(at + 1, sc.size);
+                        break;
+                    }
+                    pos = sc.base[at - 1] == delim ? at : at + 1;
+                    if (pos != at) continue;
+                }
+                //Plain numbers are parsed as they are scanned. Only when
+                //something other than the field end follows one is the
+                //field scanned and parsed again below
+                if (c < ncols && kinds[c] != CsvStr)
+                {
+                    auto elems = (ArrayHeader*)INST(cols[c]);
+                    auto p = sc.base + pos, end = sc.base + sc.size;
+                    auto t = kinds[c] == CsvInt ?
+                        CsvScanNum(p, end, elems->Elements<std::int32_t>()[row]) :
+                        CsvScanNum(p, end, elems->Elements<float>()[row]);
+                    if (t != nullptr && t < end && *t == '\r' && (t + 1 == end || t[1] == '\n')) t++;
+                    if (t != nullptr && (t == end || *t == delim || *t == '\n'))
+                    {
+                        c++;
+                        pos = (std::uint32_t)(t - sc.base);
+                        if (pos >= sc.size) break;
+                        if (sc.base[pos++] == '\n') break;
+                        continue;
+                    }
+                }
+
+                std::uint32_t b, e;
+                bool quoted = pos < sc.size && sc.base[pos] == '"';
+                if (quoted)
+                {
+                    b = e = pos + 1;
+                    for (;;)
+                    {
+                        auto q = (const char*)memchr(sc.base + e, '"', sc.size - e);
+                        if (q == nullptr)
+                        {
+                            intp->ReportError("Unterminated quote at byte " + std::to_string(pos));
+                            return;
+                        }
+                        e = (std::uint32_t)(q - sc.base);
+                        if (e + 1 < sc.size && sc.base[e + 1] == '"') { e += 2; continue; }
+                        break;
+                    }
+                    //Anything between the closing quote and the delimiter is dropped
+                    pos = e + 1;
+                    while (pos < sc.size && sc.base[pos] != delim && sc.base[pos] != '\n') pos++;
+                }
+                else
+                {
+                    b = pos;
+                    pos = sc.Next(pos);
+                    //Quotes only open a field at its start
+                    while (pos < sc.size && sc.base[pos] == '"') pos = sc.Next(pos + 1);
+                    e = pos;
+                    if (e > b && (pos == sc.size || sc.base[pos] == '\n') && sc.base[e - 1] == '\r') e--;
+                }
+                if (!store(c++, b, e, quoted)) return;
+                if (pos >= sc.size) break;
+                if (sc.base[pos++] == '\n') break;
+            }
+        }
+        //Numeric columns are zero filled already
+        for (; c < ncols; c++)
+            if (kinds[c] == CsvStr) store(c, 0, 0, false);
+        row++;
+    }
+
+    //A short chunk gets columns of its own length
+    if (row < chunk)
+    {
+        for (std::uint32_t c = 0; c < ncols; c++)
+        {
+            if (kinds[c] != CsvStr)
+            {
+                ((ArrayHeader*)INST(cols[c]))->length = row;
+                continue;
+            }
+            auto col = intp->NewRefArray(intp->libLoader.LookupType("Arr|RefArray"), row, true);
+            reload();
+            for (std::uint32_t r = 0; r < row; r++)
+                intp->gc.WriteField(((ValueType*)INST(cols[c]))[r], col, r, true);
+            intp->gc.WriteField(col, ((ValueType*)INST(stack[csvIdx]))[CsvColumns], c, true);
+        }
+    }
+
+    INT32(((ValueType*)INST(stack[csvIdx]))[CsvRows]) = row;
+    ValueType res(intp->libLoader.LookupType("Num|Int"));
+    INT32(res) = pos;
+    stack.resize(csvIdx + 1);
+    stack.back() = res;
+}
+
+//(csv, buf, pos)->Int
+void _IO_CSV_feed(Interpreter* intp) { CsvFeed(intp, false); }
+//(csv, text, pos)->Int
+void _IO_CSV_feed_str(Interpreter* intp) { CsvFeed(intp, true); }
+
+//(csv)->Int
+void _IO_CSV_rows(Interpreter* intp)
+{
+    auto fields = CsvFields(intp, intp->valueStack.back());
+    if (fields == nullptr) return;
+    intp->valueStack.back() = fields[CsvRows];
+}
+
+//(csv, name)->IntArray/FloatArray/RefArray of the last feed
+void _IO_CSV_column(Interpreter* intp)
+{
+    auto last = intp->valueStack.end() - 1;
+    auto fields = CsvFields(intp, *(last - 1));
+    if (fields == nullptr) return;
+    auto name = STR(*last);
+    auto names = (ValueType*)INST(fields[CsvNames]);
+    auto ncols = Interpreter::ArrayLength(fields[CsvNames]);
+    for (std::uint32_t c = 0; c < ncols; c++)
+    {
+        if (STR(names[c]) != name) continue;
+        if (fields[CsvColumns].IsNull())
+        {
+            intp->ReportError("CSV decoder not fed yet");
+            return;
+        }
+        auto col = ((ValueType*)INST(fields[CsvColumns]))[c];
+        intp->valueStack.pop_back();
+        intp->valueStack.back() = col;
+        return;
+    }
+    intp->ReportError("No CSV column named " + std::string(name));
+}
+
+#define IoReadWrapper(name, T, retType) \
+    ->Method((new HostMethod(name, &IoReadMethod<T>)) \
+        ->Static()->Constant() \
+        ->Arg("buf", "IO|Buffer") \
+        ->Arg("offset", "Num|Int") \
+        ->Return("res", retType))
+
+#define IoViewInfos(viewType, T, newFn, elemType, arrType) \
+    ->RefType() \
+    ->Field(FieldInfo("buf", "IO|Buffer")) \
+    ->Field(FieldInfo("offset", "Num|Int")) \
+    ->Field(FieldInfo("stride", "Num|Int")) \
+    ->Field(FieldInfo("count", "Num|Int")) \
+    ->Method((new HostMethod("new", &newFn)) \
+        ->Static() \
+        ->Arg("buf", "IO|Buffer") \
+        ->Arg("offset", "Num|Int") \
+        ->Arg("stride", "Num|Int") \
+        ->Arg("count", "Num|Int") \
+        ->Return("view", viewType)) \
+    ->Method((new HostMethod("at", &IoViewAtMethod<T>)) \
+        ->Static()->Constant() \
+        ->Arg("view", viewType) \
+        ->Arg("i", "Num|Int") \
+        ->Return("res", elemType)) \
+    ->Method((new HostMethod("length", &_IO_VIEW_length)) \
+        ->Static()->Constant() \
+        ->Arg("view", viewType) \
+        ->Return("len", "Num|Int")) \
+    ->Method((new HostMethod("to_array", &IoViewToArrayMethod<T>)) \
+        ->Static() \
+        ->Arg("view", viewType) \
+        ->Return("arr", arrType))
+
+std::shared_ptr<LibraryInfo> RuntimeLibs::IO()
+{
+    static std::shared_ptr<LibraryInfo> ioLib ( (new LibraryInfo("IO"))
+        ->Deps({ "Num", "Arr", "Str" })
+        ->Class((new ClassInfo("Buffer"))
+            ->RefType()
+            ->Method((new HostMethod("open", &_IO_open))
+                ->Static()
+                ->Arg("path", "Str|Str")
+                ->Return("buf", "IO|Buffer"))
+            ->Method((new HostMethod("close", &_IO_close))
+                ->Static()
+                ->Arg("buf", "IO|Buffer"))
+            ->Method((new HostMethod("size", &_IO_size))
+                ->Static()->Constant()
+                ->Arg("buf", "IO|Buffer")
+                ->Return("size", "Num|Int"))
+            IoReadWrapper("read_int", std::int32_t, "Num|Int")
+            IoReadWrapper("read_float", float, "Num|Float")
+            IoReadWrapper("read_byte", std::uint8_t, "Num|Int")
+            ->Method((new HostMethod("find", &_IO_find))
+                ->Static()->Constant()
+                ->Arg("buf", "IO|Buffer")
+                ->Arg("pos", "Num|Int")
+                ->Arg("byte", "Num|Int")
+                ->Return("res", "Num|Int"))
+            ->Method((new HostMethod("split", &_IO_split))
+                ->Static()
+                ->Arg("buf", "IO|Buffer")
+                ->Arg("delim", "Num|Int")
+                ->Return("ends", "Arr|IntArray"))
+            ->Method((new HostMethod("str", &_IO_str))
+                ->Static()
+                ->Arg("buf", "IO|Buffer")
+                ->Arg("begin", "Num|Int")
+                ->Arg("end", "Num|Int")
+                ->Return("res", "Str|Str"))
+        )
+        ->Class((new ClassInfo("IntView"))
+            IoViewInfos("IO|IntView", std::int32_t, _IO_INTVIEW_new, "Num|Int", "Arr|IntArray"))
+        ->Class((new ClassInfo("FloatView"))
+            IoViewInfos("IO|FloatView", float, _IO_FLOATVIEW_new, "Num|Float", "Arr|FloatArray"))
+        ->Class((new ClassInfo("ByteView"))
+            IoViewInfos("IO|ByteView", std::uint8_t, _IO_BYTEVIEW_new, "Num|Int", "Arr|IntArray"))
+        ->Class((new ClassInfo("Csv"))
+            ->RefType()
+            ->Field(FieldInfo("kinds", "Arr|IntArray"))
+            ->Field(FieldInfo("widths", "Arr|IntArray"))
+            ->Field(FieldInfo("names", "Arr|RefArray"))
+            ->Field(FieldInfo("delim", "Num|Int"))
+            ->Field(FieldInfo("chunk", "Num|Int"))
+            ->Field(FieldInfo("rows", "Num|Int"))
+            ->Field(FieldInfo("cols", "Arr|RefArray"))
+            ->Method((new HostMethod("new", &_IO_CSV_new))
+                ->Static()
+                ->Arg("schema", "Str|Str")
+                ->Arg("delim", "Num|Int")
+                ->Arg("chunk", "Num|Int")
+                ->Return("csv", "IO|Csv"))
+            ->Method((new HostMethod("feed", &_IO_CSV_feed))
+                ->Static()
+                ->Arg("csv", "IO|Csv")
+                ->Arg("buf", "IO|Buffer")
+                ->Arg("pos", "Num|Int")
+                ->Return("next", "Num|Int"))
+            ->Method((new HostMethod("feed_str", &_IO_CSV_feed_str))
+                ->Static()
+                ->Arg("csv", "IO|Csv")
+                ->Arg("text", "Str|Str")
+                ->Arg("pos", "Num|Int")
+                ->Return("next", "Num|Int"))
+            ->Method((new HostMethod("rows", &_IO_CSV_rows))
+                ->Static()->Constant()
+                ->Arg("csv", "IO|Csv")
+                ->Return("rows", "Num|Int"))
+            ->Method((new HostMethod("column", &_IO_CSV_column))
+                ->Static()
+                ->Arg("csv", "IO|Csv")
+                ->Arg("name", "Str|Str")
+                ->Return("arr", "")))
+        );
+
+    return ioLib;
+}
@@ -56,5 +56,17 @@ struct RuntimeLibs
     static std::shared_ptr<LibraryInfo> Num();
 
     static std::shared_ptr<LibraryInfo> Vec();
+
+    static std::shared_ptr<LibraryInfo> Mat();
+
+    static std::shared_ptr<LibraryInfo> Arr();
+
+    static std::shared_ptr<LibraryInfo> Strings();
+
+    static std::shared_ptr<LibraryInfo> Map();
+
+    static std::shared_ptr<LibraryInfo> Table();
+
+    static std::shared_ptr<LibraryInfo> IO();
 };
 
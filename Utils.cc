@@ -67,6 +67,12 @@ const int OpLength[] = {
 
     1, 2, //JA,  JAI,
     1, 2, //JNA, JNAI,
+
+    1, //ldlen,  //(arr)->u32
+    1, //ldelem, //(arr, idx)->object
+    1, //stelem, //(val, arr, idx)
+
+    3, //ldstr,  //<string>->Str
     //LastIndex
 
     //directives
@@ -158,6 +164,8 @@ OpArgType OpCodeArgumentType(OpCode opcode)
         //2 immediate args: type, fnName:
     case OpCode::callstatic:
     case OpCode::ldstaticfn:
+        //String literal
+    case OpCode::ldstr:
         //Compiler directives:
     case OpCode::d_embed:
         return OpArgType::String;
@@ -77,7 +77,15 @@ enum class OpCode :uint8_t
     JA,  JAI,
     JNA, JNAI,
 
-LastIndex = JNAI,
+//Arrays
+    ldlen,  //(arr)->u32           1 load array length
+    ldelem, //(arr, idx)->object   1 load element, bounds checked
+    stelem, //(val, arr, idx)      1 store element, bounds checked
+
+//Strings
+    ldstr,  //<string>->Str        3 load interned string literal
+
+LastIndex = ldstr,
 
 
 //Compiler directives:
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Interpreter.h"
+
+/* Helpers shared by the benchmarks. Each one is a host program of its
+ * own, built from the repo root as shown at the top of its file. Times
+ * are the best of several runs: on a loaded machine the mean mostly
+ * measures the load
+ */
+
+template<typename Fn>
+double BestOfMs(int runs, Fn&& fn)
+{
+    double best = 1e300;
+    for (int i = 0; i < runs; i++)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+    }
+    return best;
+}
+
+inline void ReportMBs(const char* name, std::size_t bytes, double ms)
+{
+    printf("%-34s %8.1f MB %9.2f ms %9.1f MB/s\n", name, bytes / 1e6, ms, bytes / 1e6 / (ms / 1e3));
+}
+
+inline void ReportNs(const char* name, std::size_t iters, double ms)
+{
+    printf("%-34s %10zu it %9.2f ms %9.1f ns/it\n", name, iters, ms, ms * 1e6 / iters);
+}
+
+//Calls a library function on the value stack, a benchmark stops at
+//the first error
+inline void CallHost(Interpreter& intp, const char* name)
+{
+    intp.CallClosure(intp.LookupFunction(name));
+    if (intp.status != Interpreter::ExecutionStatus::Error) return;
+    printf("%s: %s\n", name, intp.errMsg.c_str());
+    exit(1);
+}
+
+inline ValueType IntVal(Interpreter& intp, int v)
+{
+    ValueType res(intp.libLoader.LookupType("Num|Int"));
+    res.data.value = v;
+    return res;
+}
@@ -0,0 +1,73 @@
+/* Small object allocation throughput and the heap size of long lived
+ * ones, the two things the object header size shows up in.
+ * Built from the repo root:
+ *   g++ -std=c++17 -O2 -I. bench/alloc.cpp GC.cc Interpreter.cc Library.cc Utils.cc Interop.cc RuntimeLibs.cc -pthread -o alloc_bench
+ *   ./alloc_bench
+ * RSS is read from /proc, 0 where there is none
+ */
+#include <fstream>
+#include <string>
+
+#include "Bench.h"
+#include "RuntimeLibs.h"
+
+constexpr int Ring = 4096;
+constexpr int ShortLived = 10000000;
+constexpr int LongLived = 500000;
+
+static long RssKB()
+{
+    std::ifstream f("/proc/self/status");
+    std::string line;
+    while (std::getline(f, line))
+        if (line.rfind("VmRSS:", 0) == 0) return std::stol(line.substr(6));
+    return 0;
+}
+
+int main()
+{
+    Interpreter intp;
+    intp.LoadLibrary(RuntimeLibs::Num());
+    intp.LoadLibrary(RuntimeLibs::Arr());
+    intp.CompileProgram();
+    auto& stack = intp.valueStack;
+    auto refArr = intp.libLoader.LookupType("Arr|RefArray");
+    auto intTy = intp.libLoader.LookupType("Num|Int");
+    printf("object header %zu bytes\n", MOCtrlBlkSize);
+
+    //Objects of 2-4 fields, one in 64 kept in a ring for a while
+    stack.push_back(intp.NewRefArray(refArr, Ring));
+    auto rss = RssKB();
+    auto ms = BestOfMs(1, [&]()
+    {
+        for (int i = 0; i < ShortLived; i++)
+        {
+            auto obj = intp.NewRefArray(refArr, 2 + (i & 3) % 3);
+            ValueType v(intTy);
+            v.data.value = i;
+            intp.gc.WriteField(v, obj, 0, true);
+            if ((i & 63) == 0) intp.gc.WriteField(obj, stack[0], (i >> 6) % Ring, true);
+        }
+    });
+    ReportNs("short lived 2-4 field objects", ShortLived, ms);
+
+    //3 field objects aged into the major heap
+    stack.push_back(intp.NewRefArray(refArr, LongLived));
+    ms = BestOfMs(1, [&]()
+    {
+        for (int i = 0; i < LongLived; i++)
+        {
+            auto obj = intp.NewRefArray(refArr, 3);
+            intp.gc.WriteField(obj, stack[1], i, true);
+        }
+        for (int i = 0; i < 8; i++) intp.gc.SweepManaged(intp.FindRoot(false));
+        intp.gc.SweepMajorHeap(intp.FindRoot(true));
+    });
+    ReportNs("promote 3 field objects", LongLived, ms);
+    auto stat = intp.gc.PrintAllocStat();
+    auto at = stat.find(" pages: ");
+    std::size_t pages = at == std::string::npos ? 0 : std::stoull(stat.substr(at + 8));
+    printf("heap payload %zu bytes, pages %zu bytes (%.1f per object), rss +%ld KB\n",
+        (std::size_t)intp.gc.allocMajorHeap, pages, (double)pages / LongLived, RssKB() - rss);
+    return 0;
+}
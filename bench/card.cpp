@@ -0,0 +1,111 @@
+/* Card table write barrier and the minor GC scan of dirty cards, on a
+ * RefArray of 300K slots in the major heap. The remembered set the
+ * cards replaced is stood in for by a std::unordered_set of slots,
+ * filled and walked the way the barrier and the minor GC used it.
+ * Built from the repo root:
+ *   g++ -std=c++17 -O2 -I. bench/card.cpp GC.cc Interpreter.cc Library.cc Utils.cc Interop.cc RuntimeLibs.cc -pthread -o card_bench
+ *   ./card_bench
+ */
+#include <unordered_set>
+
+#include "Bench.h"
+#include "RuntimeLibs.h"
+
+constexpr int Slots = 300000;
+constexpr int Runs = 20;
+
+int main()
+{
+    Interpreter intp;
+    intp.LoadLibrary(RuntimeLibs::Num());
+    intp.LoadLibrary(RuntimeLibs::Arr());
+    intp.CompileProgram();
+    auto& stack = intp.valueStack;
+    auto refArr = intp.libLoader.LookupType("Arr|RefArray");
+    auto intTy = intp.libLoader.LookupType("Num|Int");
+
+    //4.8 MB, allocated straight in the major heap
+    stack.push_back(intp.NewRefArray(refArr, Slots));
+    if (GetCtrlBlk(stack[0].data.obj)->IsInNursery())
+    {
+        printf("RefArray of %d is not in the major heap\n", Slots);
+        return 1;
+    }
+    auto minor = [&]() { intp.gc.SweepManaged(intp.FindRoot(false)); };
+    auto newObj = [&](int v)
+    {
+        auto inst = intp.gc.AllocateRawObject(1);
+        GetCtrlBlk(inst)->vptr = refArr;
+        new (inst) ValueType(intTy);
+        inst->data.value = v;
+        ValueType res(refArr);
+        res.data.obj = inst;
+        return res;
+    };
+    auto slots = [&]() { return (ValueType*)stack[0].data.obj; };
+    //Drops the young refs so the next run starts from clean cards
+    auto clear = [&]()
+    {
+        for (int i = 0; i < Slots; i++) slots()[i] = stack[0];
+        minor();
+    };
+
+    double distinctMs = 1e300, hotMs = 1e300, denseMs = 1e300;
+    for (int run = 0; run < Runs; run++)
+    {
+        stack.push_back(newObj(run));
+        auto young = stack.size() - 1;
+        distinctMs = std::min(distinctMs, BestOfMs(1, [&]()
+        {
+            for (int i = 0; i < Slots; i++) intp.gc.WriteField(stack[young], stack[0], i, true);
+        }));
+        hotMs = std::min(hotMs, BestOfMs(1, [&]()
+        {
+            for (int i = 0; i < Slots; i++) intp.gc.WriteField(stack[young], stack[0], i & 63, true);
+        }));
+        stack.pop_back();
+        //Every slot points at the one young object
+        denseMs = std::min(denseMs, BestOfMs(1, minor));
+        if (((ValueType*)slots()[Slots - 1].data.obj)->data.value != run)
+        {
+            printf("slot lost its young object\n");
+            return 1;
+        }
+        clear();
+    }
+
+    //One young object per 1000 slots, written right before the GC
+    double sparseMs = 1e300;
+    for (int run = 0; run < Runs; run++)
+    {
+        for (int i = 0; i < Slots; i += 1000)
+        {
+            stack.push_back(newObj(i));
+            intp.gc.WriteField(stack.back(), stack[0], i, true);
+            stack.pop_back();
+        }
+        sparseMs = std::min(sparseMs, BestOfMs(1, minor));
+        clear();
+    }
+
+    //The old barrier inserted every slot, the minor GC walked and emptied the set
+    std::unordered_set<ValueType*> backwardRefs;
+    auto setInsertMs = BestOfMs(Runs, [&]()
+    {
+        for (int i = 0; i < Slots; i++) backwardRefs.insert(slots() + i);
+        backwardRefs.clear();
+    });
+    auto setHotMs = BestOfMs(Runs, [&]()
+    {
+        for (int i = 0; i < Slots; i++) backwardRefs.insert(slots() + (i & 63));
+        backwardRefs.clear();
+    });
+
+    ReportNs("barrier, distinct slots", Slots, distinctMs);
+    ReportNs("barrier, 64 hot slots", Slots, hotMs);
+    ReportNs("set insert + clear, distinct slots", Slots, setInsertMs);
+    ReportNs("set insert + clear, 64 hot slots", Slots, setHotMs);
+    printf("minor GC, %d young refs        %9.2f ms\n", Slots, denseMs);
+    printf("minor GC, %d sparse young refs   %9.2f ms\n", Slots / 1000, sparseMs);
+    return 0;
+}
@@ -0,0 +1,170 @@
+/* Minor GC copy order: breadth-first Cheney scan against hierarchical
+ * copying (GarbageCollector::hierarchicalCopy), on pointer structures
+ * allocated out of walk order:
+ *   - a binary tree of 2^21 nodes allocated in shuffled order, walked
+ *     depth first,
+ *   - 4096 lists of 256 nodes allocated interleaved, walked one list
+ *     at a time.
+ * Walk times after the GC stand in for cache miss counts, and the
+ * share of tree edges leaving the parent's 4KB page is printed too.
+ * Built from the repo root:
+ *   g++ -std=c++17 -O2 -I. bench/copy_order.cpp GC.cc Interpreter.cc Library.cc Utils.cc Interop.cc RuntimeLibs.cc -pthread -o copy_order_bench
+ *   ./copy_order_bench
+ */
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "Bench.h"
+#include "RuntimeLibs.h"
+
+constexpr int TreeNodes = (1 << 21) - 1;
+constexpr int Lists = 4096, ListNodes = 256;
+constexpr int GCRuns = 4, WalkRuns = 10;
+
+static ValueType* Fields(const ValueType& v) { return (ValueType*)v.data.obj; }
+
+static long Walk(const ValueType& node)
+{
+    long sum = 0;
+    for (auto cur = node; cur.IsRef(); cur = Fields(cur)[2])
+        sum += Fields(cur)[0].data.value + Walk(Fields(cur)[1]);
+    return sum;
+}
+
+//Nodes are allocated without GC checks, a collection on the way
+//would put them in array order before the one measured
+struct Setup
+{
+    Interpreter intp;
+    TypeTable* nodeTy;
+    TypeTable* intTy;
+
+    explicit Setup(bool hierarchical)
+    {
+        auto lib = (new LibraryInfo("Bench"))->Deps({ "Num" })
+            ->Class((new ClassInfo("Node"))->RefType()
+                ->Field(FieldInfo("v", "Num|Int"))
+                ->Field(FieldInfo("left", "Bench|Node"))
+                ->Field(FieldInfo("right", "Bench|Node")));
+        intp.LoadLibrary(RuntimeLibs::Num());
+        intp.LoadLibrary(RuntimeLibs::Arr());
+        intp.LoadLibrary(std::shared_ptr<LibraryInfo>(lib));
+        intp.CompileProgram();
+        intp.gc.hierarchicalCopy = hierarchical;
+        //Kept in the nursery for every GC measured
+        intp.gc.matureGen = 15;
+        nodeTy = intp.libLoader.LookupType("Bench|Node");
+        intTy = intp.libLoader.LookupType("Num|Int");
+        //The first instance builds the prototype and picks the kind
+        intp.NewRefTypeObject(nodeTy);
+    }
+
+    ValueType NewNode(int v)
+    {
+        auto inst = intp.gc.AllocateRawObject(3, nodeTy->objKind);
+        GetCtrlBlk(inst)->vptr = nodeTy;
+        new (inst) ValueType(intTy);
+        inst[0].data.value = v;
+        new (inst + 1) ValueType(nodeTy);
+        new (inst + 2) ValueType(nodeTy);
+        ValueType res(nodeTy);
+        res.data.obj = inst;
+        return res;
+    }
+
+    double MinorGC()
+    {
+        return BestOfMs(GCRuns, [&]() { intp.gc.SweepManaged(intp.FindRoot(false)); });
+    }
+};
+
+static void Tree(bool hierarchical)
+{
+    Setup s(hierarchical);
+    auto& intp = s.intp;
+    auto arr = intp.extRefs.NewExtRef(intp.NewRefArray(intp.libLoader.LookupType("Arr|RefArray"), TreeNodes));
+    std::vector<int> perm(TreeNodes);
+    for (int i = 0; i < TreeNodes; i++) perm[i] = i;
+    std::shuffle(perm.begin(), perm.end(), std::mt19937(7));
+    for (int i = 0; i < TreeNodes; i++) intp.gc.WriteField(s.NewNode(i), *arr.get(), perm[i], true);
+    //Node k has children 2k+1 and 2k+2
+    for (int k = 0; k < TreeNodes; k++)
+    {
+        auto node = Fields(*arr.get())[k];
+        if (2 * k + 1 < TreeNodes) intp.gc.WriteField(Fields(*arr.get())[2 * k + 1], node, 1);
+        if (2 * k + 2 < TreeNodes) intp.gc.WriteField(Fields(*arr.get())[2 * k + 2], node, 2);
+    }
+    //The array is a heap object until the next full GC, its cards
+    //would hand the nodes to the minor GC in allocation order
+    auto root = intp.extRefs.NewExtRef(Fields(*arr.get())[0]);
+    for (int k = 0; k < TreeNodes; k++) intp.gc.WriteField(ValueType(), *arr.get(), k, true);
+    *arr.get() = ValueType();
+
+    auto gcMs = s.MinorGC();
+    long sum = 0;
+    auto walkMs = BestOfMs(WalkRuns, [&]() { sum = Walk(*root.get()); });
+    if (sum != (long)TreeNodes * (TreeNodes - 1) / 2)
+    {
+        printf("tree broken\n");
+        exit(1);
+    }
+
+    long edges = 0, offPage = 0;
+    std::vector<ValueType> todo{ *root.get() };
+    while (!todo.empty())
+    {
+        auto node = Fields(todo.back());
+        todo.pop_back();
+        for (int c = 1; c <= 2; c++)
+        {
+            if (!node[c].IsRef()) continue;
+            edges++;
+            offPage += ((std::uintptr_t)node >> 12) != ((std::uintptr_t)Fields(node[c]) >> 12);
+            todo.push_back(node[c]);
+        }
+    }
+    printf("%-13s tree   minor GC %8.2f ms  walk %7.2f ms (%4.1f ns/node)  edges off page %4.1f%%\n",
+        hierarchical ? "hierarchical" : "breadth-first", gcMs, walkMs, walkMs * 1e6 / TreeNodes, 100.0 * offPage / edges);
+}
+
+static void InterleavedLists(bool hierarchical)
+{
+    Setup s(hierarchical);
+    auto& intp = s.intp;
+    auto heads = intp.extRefs.NewExtRef(intp.NewRefArray(intp.libLoader.LookupType("Arr|RefArray"), Lists));
+    for (int n = 0; n < ListNodes; n++)
+    {
+        for (int l = 0; l < Lists; l++)
+        {
+            auto node = s.NewNode(n);
+            Fields(node)[2].data = Fields(*heads.get())[l].data;
+            intp.gc.WriteField(node, *heads.get(), l, true);
+        }
+    }
+
+    auto gcMs = s.MinorGC();
+    std::vector<int> order(Lists);
+    for (int l = 0; l < Lists; l++) order[l] = l;
+    std::shuffle(order.begin(), order.end(), std::mt19937(3));
+    long sum = 0;
+    auto walkMs = BestOfMs(WalkRuns, [&]()
+    {
+        sum = 0;
+        for (int l : order) sum += Walk(Fields(*heads.get())[l]);
+    });
+    if (sum != (long)Lists * ListNodes * (ListNodes - 1) / 2)
+    {
+        printf("lists broken\n");
+        exit(1);
+    }
+    printf("%-13s lists  minor GC %8.2f ms  walk %7.2f ms (%4.1f ns/node)\n",
+        hierarchical ? "hierarchical" : "breadth-first", gcMs, walkMs, walkMs * 1e6 / Lists / ListNodes);
+}
+
+int main()
+{
+    for (bool hierarchical : { false, true }) Tree(hierarchical);
+    for (bool hierarchical : { false, true }) InterleavedLists(hierarchical);
+    return 0;
+}
@@ -0,0 +1,160 @@
+/* IO|Csv decoding throughput against a scalar loop splitting fields byte
+ * by byte and parsing numbers with from_chars, both chunked by 65536 rows.
+ * Built from the repo root:
+ *   g++ -std=c++17 -O2 -I. bench/csv.cpp GC.cc Interpreter.cc Library.cc Utils.cc Interop.cc RuntimeLibs.cc -pthread -o csv_bench
+ *   ./csv_bench [rows] [dir]
+ * Two files of about 30 bytes per row are written to dir, default the
+ * current directory
+ */
+#include <charconv>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "RuntimeLibs.h"
+
+constexpr int Chunk = 65536;
+constexpr int Runs = 5;
+
+static std::string ReadAll(const std::string& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(f), {});
+}
+
+int main(int argc, char** argv)
+{
+    int rows = argc > 1 ? atoi(argv[1]) : 2000000;
+    std::string dir = argc > 2 ? argv[2] : ".";
+    auto mixedPath = dir + "/csv_bench_mixed.csv", textPath = dir + "/csv_bench_text.csv";
+    {
+        std::ofstream f(mixedPath, std::ios::binary);
+        for (int i = 0; i < rows; i++)
+            f << i << ',' << (i % 1000) * 0.25f << ",name_number_" << i % 97 << ',' << i * 7 % 13 << '\n';
+    }
+    {
+        std::ofstream f(textPath, std::ios::binary);
+        for (int i = 0; i < rows / 2; i++)
+            f << i << ",the quick brown fox jumps over the lazy dog number " << i % 1000
+              << " of many,and another free text column that is long\n";
+    }
+
+    Interpreter intp;
+    intp.LoadLibrary(RuntimeLibs::Num());
+    intp.LoadLibrary(RuntimeLibs::Arr());
+    intp.LoadLibrary(RuntimeLibs::Strings());
+    intp.LoadLibrary(RuntimeLibs::IO());
+    intp.CompileProgram();
+    auto& stack = intp.valueStack;
+
+    //Feeds the whole file in chunks, summing the first column so the
+    //rows are checked and not just decoded
+    auto decode = [&](const std::string& path, const char* schema, int expectRows)
+    {
+        stack.push_back(intp.NewStr(path));
+        CallHost(intp, "IO|Buffer|open");
+        stack.push_back(stack.back());
+        CallHost(intp, "IO|Buffer|size");
+        auto size = stack.back().data.value;
+        stack.pop_back();
+        stack.push_back(intp.NewStr(schema));
+        stack.push_back(IntVal(intp, ','));
+        stack.push_back(IntVal(intp, Chunk));
+        CallHost(intp, "IO|Csv|new");
+        auto bufIdx = stack.size() - 2, csvIdx = stack.size() - 1;
+
+        auto ms = BestOfMs(Runs, [&]()
+        {
+            long long sum = 0;
+            int pos = 0, decoded = 0;
+            while (pos < size)
+            {
+                stack.push_back(stack[csvIdx]);
+                stack.push_back(stack[bufIdx]);
+                stack.push_back(IntVal(intp, pos));
+                CallHost(intp, "IO|Csv|feed");
+                pos = stack.back().data.value;
+                stack.pop_back();
+                stack.push_back(stack[csvIdx]);
+                stack.push_back(intp.NewStr("id"));
+                CallHost(intp, "IO|Csv|column");
+                auto n = Interpreter::ArrayLength(stack.back());
+                auto ids = ((ArrayHeader*)stack.back().data.obj)->Elements<std::int32_t>();
+                for (std::uint32_t i = 0; i < n; i++) sum += ids[i];
+                decoded += n;
+                stack.pop_back();
+            }
+            if (decoded != expectRows || sum != (long long)expectRows * (expectRows - 1) / 2)
+            {
+                printf("%s: bad decode, %d rows\n", schema, decoded);
+                exit(1);
+            }
+        });
+        stack.resize(bufIdx);
+        return std::make_pair((std::size_t)size, ms);
+    };
+
+    auto mixed = ReadAll(mixedPath), text = ReadAll(textPath);
+    //fields: columns parsed, the rest only split. Strings are kept
+    //like the decoder keeps them
+    auto scalar = [&](const std::string& buf, int fields, bool strs)
+    {
+        return BestOfMs(Runs, [&]()
+        {
+            std::vector<std::int32_t> ids, ks;
+            std::vector<float> xs;
+            std::vector<std::string> ss;
+            const char* p = buf.data();
+            const char* end = p + buf.size();
+            while (p < end)
+            {
+                const char* b[4];
+                const char* e[4];
+                int c = 0;
+                b[0] = p;
+                for (; p < end && *p != '\n'; p++)
+                {
+                    if (*p != ',') continue;
+                    if (c < 3) e[c] = p;
+                    if (++c < 4) b[c] = p + 1;
+                }
+                e[std::min(c, 3)] = p++;
+                std::int32_t v;
+                std::from_chars(b[0], e[0], v);
+                ids.push_back(v);
+                if (fields > 1)
+                {
+                    float x;
+                    std::from_chars(b[1], e[1], x);
+                    xs.push_back(x);
+                }
+                if (strs)
+                {
+                    ss.emplace_back(b[2], e[2]);
+                    std::from_chars(b[3], e[3], v);
+                    ks.push_back(v);
+                }
+                if (ids.size() == Chunk)
+                {
+                    ids.clear();
+                    xs.clear();
+                    ss.clear();
+                    ks.clear();
+                }
+            }
+        });
+    };
+
+    auto r = decode(mixedPath, "id:int,x:float,s:str,k:int", rows);
+    ReportMBs("IO|Csv id,x,s,k", r.first, r.second);
+    ReportMBs("scalar id,x,s,k", mixed.size(), scalar(mixed, 4, true));
+    r = decode(mixedPath, "id:int,x:float", rows);
+    ReportMBs("IO|Csv id,x", r.first, r.second);
+    ReportMBs("scalar id,x", mixed.size(), scalar(mixed, 2, false));
+    r = decode(textPath, "id:int", rows / 2);
+    ReportMBs("IO|Csv long text, id", r.first, r.second);
+    ReportMBs("scalar long text, id", text.size(), scalar(text, 1, false));
+    return 0;
+}
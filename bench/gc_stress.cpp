@@ -0,0 +1,152 @@
+/* GC stress: linked lists grown, cross-linked and cut short at random
+ * while the collector runs, walked and checked every few thousand
+ * steps. The same work runs under each marking mode (incremental
+ * slices, a marker thread, a marker thread delayed at random by
+ * gcMarkStress), on 1 and on N GC worker threads, and with compaction
+ * left to compactRatio or forced on every full GC that frees 8 pages.
+ * Built from the repo root:
+ *   g++ -std=c++17 -O2 -I. bench/gc_stress.cpp GC.cc Interpreter.cc Library.cc Utils.cc Interop.cc RuntimeLibs.cc -pthread -o gc_stress
+ *   ./gc_stress [steps] [threads]
+ * Stops at the first broken list, races show up best with an idle core
+ * per thread
+ */
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+#include "RuntimeLibs.h"
+
+constexpr int Lists = 8;
+constexpr int CheckEvery = 5000;
+
+struct Mode
+{
+    const char* name;
+    bool concurrent, markStress;
+};
+
+static bool Run(const Mode& mode, int threads, bool forceCompact, int steps)
+{
+    auto lib = (new LibraryInfo("Stress"))->Deps({ "Num" })
+        ->Class((new ClassInfo("Node"))->RefType()
+            ->Field(FieldInfo("v", "Num|Int"))
+            ->Field(FieldInfo("next", "Stress|Node"))
+            ->Field(FieldInfo("side", "Stress|Node")));
+    Interpreter intp;
+    intp.gcConcurrentMark = mode.concurrent;
+    intp.gcMarkStress = mode.markStress;
+    intp.gc.workerCnt = threads;
+    //Above 0 but below any page share, only MinPages holds it back
+    if (forceCompact) intp.gc.compactRatio = 1e-9;
+    intp.LoadLibrary(RuntimeLibs::Num());
+    intp.LoadLibrary(std::shared_ptr<LibraryInfo>(lib));
+    intp.CompileProgram();
+    auto nodeTy = intp.libLoader.LookupType("Stress|Node");
+    auto intTy = intp.libLoader.LookupType("Num|Int");
+
+    //List l counts down from tops[l] along next, each node holding the
+    //head another list had then in side
+    std::vector<ExtRef> heads;
+    std::vector<int> lens(Lists, 0), tops(Lists, -1);
+    for (int l = 0; l < Lists; l++) heads.push_back(intp.extRefs.NewExtRef(ValueType(nodeTy)));
+    auto check = [&]()
+    {
+        for (int l = 0; l < Lists; l++)
+        {
+            auto cur = *heads[l].get();
+            int prev = 0, n = 0;
+            while (cur.IsRef())
+            {
+                auto fields = (ValueType*)cur.data.obj;
+                //The head is never dropped, the rest only go down
+                auto v = fields[0].data.value;
+                if (fields[0].type != intTy || (n == 0 ? v != tops[l] : v >= prev)
+                    || (fields[2].IsRef() && ((ValueType*)fields[2].data.obj)[1].type != nodeTy))
+                {
+                    printf("list %d broken at node %d\n", l, n);
+                    return false;
+                }
+                prev = v;
+                n++;
+                cur = fields[1];
+            }
+            if (n != lens[l])
+            {
+                printf("list %d has %d nodes, %d expected\n", l, n, lens[l]);
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::mt19937 rng(42);
+    bool ok = true;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps && ok; i++)
+    {
+        int l = rng() % Lists;
+        auto node = intp.NewRefTypeObject(nodeTy);
+        ValueType v(intTy);
+        v.data.value = ++tops[l];
+        intp.gc.WriteField(v, node, 0);
+        intp.gc.WriteField(*heads[l].get(), node, 1);
+        intp.gc.WriteField(*heads[rng() % Lists].get(), node, 2);
+        *heads[l].get() = node;
+        lens[l]++;
+        //Garbage
+        for (int g = 0; g < 3; g++) intp.NewRefTypeObject(nodeTy);
+        //Cut short, or thinned out to leave holes all over the pages
+        //the list was promoted to
+        if (rng() % 5000 == 0)
+        {
+            int keep = rng() % 1000;
+            auto cur = *heads[l].get();
+            for (int k = 0; k < keep && cur.IsRef(); k++) cur = ((ValueType*)cur.data.obj)[1];
+            if (cur.IsRef())
+            {
+                intp.gc.WriteField(ValueType(nodeTy), cur, 1);
+                lens[l] = keep + 1;
+            }
+        }
+        else if (rng() % 5000 == 0)
+        {
+            for (auto cur = *heads[l].get(); cur.IsRef(); cur = ((ValueType*)cur.data.obj)[1])
+            {
+                auto next = ((ValueType*)cur.data.obj)[1];
+                if (next.IsRef()) intp.gc.WriteField(((ValueType*)next.data.obj)[1], cur, 1);
+            }
+            lens[l] = (lens[l] + 1) / 2;
+        }
+        if (i % CheckEvery == 0 || i == steps - 1) ok = check();
+    }
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    printf("%-26s %2d thr %-8s %9.1f ms %6llu slices %5llu finals %4zu outruns %4llu compactions %s\n",
+        mode.name, threads, forceCompact ? "compact" : "", ms,
+        (unsigned long long)intp.gc.markSliceStats.count, (unsigned long long)intp.gc.finalPauseStats.count,
+        intp.gc.markOutrunCnt, (unsigned long long)intp.gc.compactStats.count, ok ? "ok" : "FAILED");
+    heads.clear();
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    int steps = argc > 1 ? atoi(argv[1]) : 1000000;
+    int threads = argc > 2 ? atoi(argv[2]) : (int)std::max(std::thread::hardware_concurrency(), 4u);
+    const Mode modes[] = {
+        { "incremental", false, false },
+        { "concurrent", true, false },
+        { "concurrent, marker stress", true, true },
+    };
+    for (auto& mode : modes)
+    {
+        for (int thr : { 1, threads })
+        {
+            for (bool compact : { false, true })
+            {
+                if (!Run(mode, thr, compact, steps)) return 1;
+            }
+        }
+    }
+    return 0;
+}
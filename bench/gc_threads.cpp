@@ -0,0 +1,104 @@
+/* Stop-the-world collections against GC worker threads, 1 to N: a minor
+ * GC copying a tree out of the nursery, and a full mark of a tree
+ * promoted to the heap. Built from the repo root:
+ *   g++ -std=c++17 -O2 -I. bench/gc_threads.cpp GC.cc Interpreter.cc Library.cc Utils.cc Interop.cc RuntimeLibs.cc -pthread -o gc_threads_bench
+ *   ./gc_threads_bench [max threads] [tree depth]
+ * Speedups only mean something with an idle core per thread
+ */
+#include <string>
+#include <thread>
+
+#include "Bench.h"
+#include "RuntimeLibs.h"
+
+constexpr int Fanout = 4;
+constexpr int Runs = 5;
+
+int main(int argc, char** argv)
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : (int)std::max(std::thread::hardware_concurrency(), 1u);
+    int depth = argc > 2 ? atoi(argv[2]) : 9;
+
+    Interpreter intp;
+    intp.LoadLibrary(RuntimeLibs::Num());
+    intp.LoadLibrary(RuntimeLibs::Arr());
+    intp.CompileProgram();
+    auto& stack = intp.valueStack;
+    auto refArr = intp.libLoader.LookupType("Arr|RefArray");
+    auto intTy = intp.libLoader.LookupType("Num|Int");
+
+    //Built without GC checks, nothing moves while the tree is linked
+    std::size_t nodes = 0;
+    auto build = [&](auto& self, int level) -> ValueType
+    {
+        nodes++;
+        auto inst = intp.gc.AllocateRawObject(Fanout);
+        GetCtrlBlk(inst)->vptr = refArr;
+        for (int i = 0; i < Fanout; i++)
+        {
+            if (level == depth)
+            {
+                new (inst + i) ValueType(intTy);
+                inst[i].data.value = i;
+            }
+            else new (inst + i) ValueType(self(self, level + 1));
+        }
+        ValueType res(refArr);
+        res.data.obj = inst;
+        return res;
+    };
+    auto count = [&](auto& self, const ValueType& v) -> std::size_t
+    {
+        if (v.type != refArr) return 0;
+        std::size_t n = 1;
+        for (int i = 0; i < Fanout; i++) n += self(self, ((ValueType*)v.data.obj)[i]);
+        return n;
+    };
+    auto check = [&](const char* what)
+    {
+        if (count(count, stack.back()) == nodes) return;
+        printf("%s: tree broken\n", what);
+        exit(1);
+    };
+    auto minor = [&]() { intp.gc.SweepManaged(intp.FindRoot(false)); };
+    auto major = [&]() { intp.gc.SweepMajorHeap(intp.FindRoot(true)); };
+
+    //A tree that stays, promoted by aging it through the minor GCs
+    stack.push_back(build(build, 0));
+    auto treeNodes = nodes;
+    for (int i = 0; i < 4; i++) minor();
+    printf("tree of %zu nodes, %d ways\n", treeNodes, Fanout);
+
+    double minor1 = 0, major1 = 0;
+    for (int threads = 1; threads <= maxThreads; threads++)
+    {
+        intp.gc.workerCnt = threads;
+
+        nodes = treeNodes;
+        auto majorMs = BestOfMs(Runs, major);
+        check("full mark");
+
+        //Every run copies a fresh tree, the last one is garbage by then
+        double minorMs = 1e300;
+        for (int run = 0; run < Runs; run++)
+        {
+            stack.push_back(build(build, 0));
+            nodes = treeNodes;
+            minorMs = std::min(minorMs, BestOfMs(1, minor));
+            check("minor GC");
+            stack.pop_back();
+            minor();
+            minor();
+        }
+
+        if (threads == 1)
+        {
+            minor1 = minorMs;
+            major1 = majorMs;
+        }
+        auto name = std::to_string(threads) + " threads";
+        printf("%-12s minor GC %8.2f ms x%.2f   full mark %8.2f ms x%.2f\n",
+            name.c_str(), minorMs, minor1 / minorMs, majorMs, major1 / majorMs);
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+/* NewRefTypeObject allocation rate, a slot object and a packed one,
+ * with one object in a thousand kept alive for a GC or two.
+ * Built from the repo root:
+ *   g++ -std=c++17 -O2 -I. bench/newobj.cpp GC.cc Interpreter.cc Library.cc Utils.cc Interop.cc RuntimeLibs.cc -pthread -o newobj_bench
+ *   ./newobj_bench
+ */
+#include "Bench.h"
+#include "RuntimeLibs.h"
+
+constexpr int Objects = 20000000;
+constexpr int Runs = 5;
+
+int main()
+{
+    Interpreter intp;
+    intp.LoadLibrary(RuntimeLibs::Num());
+    intp.LoadLibrary(RuntimeLibs::Mat());
+    intp.LoadLibrary(RuntimeLibs::Strings());
+    intp.CompileProgram();
+
+    for (auto name : { "Mat|Quat", "Str|StrBuilder" })
+    {
+        auto ty = intp.libLoader.LookupType(name);
+        intp.valueStack.push_back(intp.NewRefTypeObject(ty));
+        auto ms = BestOfMs(Runs, [&]()
+        {
+            for (int i = 0; i < Objects; i++)
+            {
+                auto obj = intp.NewRefTypeObject(ty);
+                if (i % 1000 == 0) intp.valueStack.back() = obj;
+            }
+        });
+
+        //The kept one must look freshly built from the prototype
+        auto inst = (ValueType*)intp.valueStack.back().data.obj;
+        bool fresh = true;
+        if (ty->IsPacked())
+        {
+            for (std::size_t i = 0; i < ty->packedSize; i++) fresh &= ((char*)inst)[i] == 0;
+        }
+        else
+        {
+            for (std::size_t i = 0; i < ty->fields.size(); i++)
+                fresh &= inst[i].type == ty->fields[i] && inst[i].data.value == 0;
+        }
+        if (!fresh)
+        {
+            printf("%s: object not initialized\n", name);
+            return 1;
+        }
+        intp.valueStack.pop_back();
+        printf("%-16s %8.1f M objects/s %6.1f ns/object\n", name, Objects / ms / 1e3, ms * 1e6 / Objects);
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+/* Vec storage: the Vec|Vec3 length and add host methods called straight
+ * from the host over a set of vectors, then a script loop calling Vec3
+ * add/mul/sub/length, with and without allocation sinking. Only library
+ * calls touch the payloads, so the same file also builds against a tree
+ * from before the packed float[4] layout. add allocates its result, its
+ * numbers include the collections of the tree built against. Built from
+ * the repo root:
+ *   g++ -std=c++17 -O2 -I. bench/vec.cpp GC.cc Interpreter.cc Library.cc Utils.cc Interop.cc RuntimeLibs.cc -pthread -o vec_bench
+ *   ./vec_bench [vectors]
+ * and the same from the root of an older checkout, with this file and
+ * Bench.h copied into its bench directory
+ */
+#include <cstring>
+
+#include "Bench.h"
+#include "RuntimeLibs.h"
+
+constexpr int HostCalls = 1 << 20;
+constexpr int LoopIters = 200000;
+constexpr int Runs = 5;
+
+static int FloatBits(float f)
+{
+    int i;
+    memcpy(&i, &f, 4);
+    return i;
+}
+
+static InstFn HostFn(Interpreter& intp, const char* name)
+{
+    auto fnBlk = std::get<1>(intp.libLoader.LookupFunction(name));
+    if (fnBlk == nullptr || !fnBlk->isEmbeddable)
+    {
+        printf("%s: not a host method\n", name);
+        exit(1);
+    }
+    return (InstFn)fnBlk->body[0].inst;
+}
+
+static void CallHostMethods(int vecCnt)
+{
+    auto prog = (new LibraryInfo(""))
+        ->Deps({ "Num", "Vec" })
+        ->Class((new ClassInfo("Program"))->RefType()
+            ->Method((new ProgramMethod("make"))->Static()
+                ->Arg("f", "Num|Float")->Return("r", "Vec|Vec3")
+                ->Body({
+                    {OpCode::newobj, "Vec|Vec3"},
+                    {OpCode::ldarg, 0}, {OpCode::ldarg, 1}, {OpCode::stmem, "Vec|Vec3|x"},
+                    {OpCode::ldarg, 0}, {OpCode::ldarg, 1}, {OpCode::stmem, "Vec|Vec3|y"},
+                    {OpCode::ldarg, 0}, {OpCode::ldarg, 1}, {OpCode::stmem, "Vec|Vec3|z"},
+                    {OpCode::ldarg, 1},
+                    {OpCode::starg, 0},
+                    {OpCode::RET},
+                })));
+    Interpreter intp;
+    intp.LoadLibrary(RuntimeLibs::Num());
+    intp.LoadLibrary(RuntimeLibs::Vec());
+    intp.LoadLibrary(std::shared_ptr<LibraryInfo>(prog));
+    intp.CompileProgram();
+    auto add = HostFn(intp, "Vec|Vec3|add");
+    auto length = HostFn(intp, "Vec|Vec3|length");
+
+    //a[i] at stack[i], b[i] at stack[vecCnt + i], collections move them
+    //in place
+    auto& stack = intp.valueStack;
+    auto fltTy = intp.libLoader.LookupType("Num|Float");
+    stack.reserve(2 * vecCnt + 8);
+    for (int i = 0; i < 2 * vecCnt; i++)
+    {
+        ValueType f(fltTy);
+        f.data.fval = i < vecCnt ? i * 0.5f : 1.0f;
+        stack.push_back(f);
+        CallHost(intp, "|Program|make");
+    }
+
+    int reps = std::max(HostCalls / vecCnt, 1);
+    //length allocates nothing and only reads the payload, add also
+    //allocates its result and so pays for the collections
+    double lengthSum = 0, addSum = 0;
+    auto lengthMs = BestOfMs(Runs, [&]()
+    {
+        float s = 0;
+        for (int rep = 0; rep < reps; rep++)
+        {
+            for (int i = 0; i < vecCnt; i++)
+            {
+                stack.push_back(stack[i]);
+                (*length)(&intp);
+                s += stack.back().data.fval;
+                stack.pop_back();
+            }
+        }
+        lengthSum = s;
+    });
+    ReportNs("Vec3 length, host calls", (std::size_t)reps * vecCnt, lengthMs);
+    auto addMs = BestOfMs(Runs, [&]()
+    {
+        float s = 0;
+        for (int rep = 0; rep < reps; rep++)
+        {
+            for (int i = 0; i < vecCnt; i++)
+            {
+                stack.push_back(stack[i]);
+                stack.push_back(stack[vecCnt + i]);
+                (*add)(&intp);
+                (*length)(&intp);
+                s += stack.back().data.fval;
+                stack.pop_back();
+            }
+        }
+        addSum = s;
+    });
+    ReportNs("Vec3 add + length, host calls", (std::size_t)reps * vecCnt, addMs);
+    printf("%-34s %g %g\n", "checksums", lengthSum, addSum);
+}
+
+static void ScriptLoop(bool sinking)
+{
+    auto prog = (new LibraryInfo(""))
+        ->Deps({ "Num", "Vec" })
+        ->Class((new ClassInfo("Program"))->RefType()
+            ->Method((new ProgramMethod("loop"))->Static()->Return("r", "Num|Float")
+                ->Body({
+                    {OpCode::PUSHIMM, 0},           //i
+                    {OpCode::PUSHIMM, 0},           //sum
+                    {OpCode::newobj, "Vec|Vec3"},   //v
+                    {OpCode::PUSHIMM, FloatBits(0.5f)}, {OpCode::ldarg, 2}, {OpCode::stmem, "Vec|Vec3|x"},
+                    {OpCode::PUSHIMM, FloatBits(0.25f)}, {OpCode::ldarg, 2}, {OpCode::stmem, "Vec|Vec3|y"},
+                    {OpCode::ldarg, 2},             //loop head
+                    {OpCode::ldarg, 2},
+                    {OpCode::callstatic, "Vec|Vec3|add"},
+                    {OpCode::ldarg, 2},
+                    {OpCode::callstatic, "Vec|Vec3|mul"},
+                    {OpCode::ldarg, 2},
+                    {OpCode::callstatic, "Vec|Vec3|sub"},
+                    {OpCode::callstatic, "Vec|Vec3|length"},
+                    {OpCode::ldarg, 1},
+                    {OpCode::callstatic, "Num|Float|add"},
+                    {OpCode::starg, 1},
+                    {OpCode::ldarg, 0},
+                    {OpCode::callstatic, "Num|Int|inc"},
+                    {OpCode::starg, 0},
+                    {OpCode::ldarg, 0},
+                    {OpCode::PUSHIMM, LoopIters},
+                    {OpCode::callstatic, "Num|Int|less_than"},
+                    {OpCode::JNZI, -17},
+                    {OpCode::ldarg, 1},
+                    {OpCode::starg, 0},
+                    {OpCode::RET},
+                })));
+    Interpreter intp;
+    intp.libLoader.enableAllocSinking = sinking;
+    intp.LoadLibrary(RuntimeLibs::Num());
+    intp.LoadLibrary(RuntimeLibs::Vec());
+    intp.LoadLibrary(std::shared_ptr<LibraryInfo>(prog));
+    intp.CompileProgram();
+    auto ms = BestOfMs(Runs, [&]()
+    {
+        CallHost(intp, "|Program|loop");
+        intp.valueStack.clear();
+    });
+    ReportNs(sinking ? "script loop, sinking" : "script loop, no sinking", LoopIters, ms);
+}
+
+int main(int argc, char** argv)
+{
+    CallHostMethods(argc > 1 ? atoi(argv[1]) : 1 << 12);
+    ScriptLoop(false);
+    ScriptLoop(true);
+    return 0;
+}